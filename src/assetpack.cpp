@@ -0,0 +1,293 @@
+#include "assetpack.h"
+
+#include "glstate.h"
+#include "image.h"
+
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#ifdef linux
+#include <GL/gl.h>
+#else
+#include <OpenGL/gl.h>
+#endif
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  static const unsigned int kLevelAlignment = 16;
+
+
+  //
+  // Types
+  //
+
+  typedef std::vector<unsigned char> ByteArray;
+
+
+  //
+  // Forward declarations
+  //
+
+  void Downsample(const unsigned char* src, unsigned int srcWidth, unsigned int srcHeight,
+                  unsigned char* dst, unsigned int dstWidth, unsigned int dstHeight);
+  bool ValidateAssetPack(const AssetPack* pack);
+
+
+  //
+  // AssetPack public methods
+  //
+
+  AssetPack::AssetPack() :
+    mapping(NULL),
+    data(NULL),
+    size(0),
+    header(NULL),
+    textures(NULL)
+  {
+  }
+
+
+  //
+  // Public functions
+  //
+
+  AssetPack* OpenAssetPack(const char* path)
+  {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+      return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(AssetPackHeader)) {
+      close(fd);
+      return NULL;
+    }
+
+    void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+      return NULL;
+
+    AssetPack* pack = OpenAssetPackInMemory(static_cast<const unsigned char*>(mapping), info.st_size);
+    if (pack == NULL) {
+      fprintf(stderr, "Ignoring invalid asset pack %s.\n", path);
+      munmap(mapping, info.st_size);
+      return NULL;
+    }
+    pack->mapping = mapping;
+    return pack;
+  }
+
+
+  AssetPack* OpenAssetPackInMemory(const unsigned char* data, size_t size)
+  {
+    if (data == NULL || size < sizeof(AssetPackHeader) || (size_t(data) & 3) != 0)
+      return NULL;
+
+    AssetPack* pack = new AssetPack();
+    pack->data = data;
+    pack->size = size;
+    pack->header = reinterpret_cast<const AssetPackHeader*>(data);
+    pack->textures = reinterpret_cast<const PackedTexture*>(pack->header + 1);
+
+    if (!ValidateAssetPack(pack)) {
+      delete pack;
+      return NULL;
+    }
+    return pack;
+  }
+
+
+  void CloseAssetPack(AssetPack* pack)
+  {
+    if (pack == NULL)
+      return;
+    if (pack->mapping != NULL)
+      munmap(pack->mapping, pack->size);
+    delete pack;
+  }
+
+
+  const PackedTexture* FindPackedTexture(const AssetPack* pack, const char* name)
+  {
+    if (pack == NULL)
+      return NULL;
+    for (unsigned int i = 0; i < pack->header->numTextures; ++i) {
+      if (strcasecmp(pack->textures[i].name, name) == 0)
+        return &pack->textures[i];
+    }
+    return NULL;
+  }
+
+
+  unsigned int UploadPackedTexture(const AssetPack* pack, const PackedTexture* tex)
+  {
+    assert(pack != NULL);
+    assert(tex != NULL);
+
+    const unsigned char* base = pack->data;
+
+    GLuint texID;
+    glGenTextures(1, &texID);
+    BindTexture(texID);
+    // Rows of BGRA8 are always a multiple of 4 bytes.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    tex->numLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, tex->numLevels - 1);
+    SetTexEnvMode(GL_MODULATE);
+
+    for (unsigned int i = 0; i < tex->numLevels; ++i) {
+      const PackedLevel& level = tex->levels[i];
+      glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, level.width, level.height, 0,
+                   GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, base + level.offset);
+    }
+    return texID;
+  }
+
+
+  bool WriteAssetPack(const char* path, const char* const* names,
+                      Image* const* images, unsigned int count)
+  {
+    AssetPackHeader header;
+    header.magic = kAssetPackMagic;
+    header.version = kAssetPackVersion;
+    header.numTextures = count;
+
+    std::vector<PackedTexture> textures(count);
+    ByteArray data;
+    size_t dataStart = sizeof(AssetPackHeader) + count * sizeof(PackedTexture);
+    dataStart = (dataStart + kLevelAlignment - 1) & ~size_t(kLevelAlignment - 1);
+
+    for (unsigned int i = 0; i < count; ++i) {
+      PackedTexture& tex = textures[i];
+      memset(&tex, 0, sizeof(tex));
+      snprintf(tex.name, kMaxPackedNameLength, "%s", names[i]);
+      for (char* ch = tex.name; *ch != '\0'; ++ch)
+        *ch = tolower((unsigned char)*ch);
+
+      Image* image = images[i];
+      image->convertToBGRA();
+      image->premultiplyAlpha();
+      ByteArray level(image->getPixels(), image->getPixels() + image->getWidth() * image->getHeight() * 4);
+      unsigned int width = image->getWidth();
+      unsigned int height = image->getHeight();
+
+      for (;;) {
+        PackedLevel& packed = tex.levels[tex.numLevels++];
+        packed.offset = dataStart + data.size();
+        packed.width = width;
+        packed.height = height;
+        data.insert(data.end(), level.begin(), level.end());
+        data.resize((data.size() + kLevelAlignment - 1) & ~size_t(kLevelAlignment - 1), 0);
+
+        if ((width == 1 && height == 1) || tex.numLevels == kMaxMipLevels)
+          break;
+
+        unsigned int nextWidth = (width > 1) ? width / 2 : 1;
+        unsigned int nextHeight = (height > 1) ? height / 2 : 1;
+        ByteArray next(nextWidth * nextHeight * 4);
+        Downsample(&level[0], width, height, &next[0], nextWidth, nextHeight);
+        level.swap(next);
+        width = nextWidth;
+        height = nextHeight;
+      }
+    }
+    header.dataSize = dataStart + data.size();
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+      fprintf(stderr, "Unable to open %s for writing.\n", path);
+      return false;
+    }
+
+    static const unsigned char kPadding[kLevelAlignment] = { 0 };
+    size_t indexEnd = sizeof(AssetPackHeader) + count * sizeof(PackedTexture);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              (count == 0 || fwrite(&textures[0], sizeof(PackedTexture), count, file) == count) &&
+              fwrite(kPadding, 1, dataStart - indexEnd, file) == dataStart - indexEnd &&
+              (data.empty() || fwrite(&data[0], 1, data.size(), file) == data.size());
+    if (fclose(file) != 0)
+      ok = false;
+
+    if (!ok)
+      fprintf(stderr, "Error while writing %s.\n", path);
+    return ok;
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  // Box filters src down to dst, which is half the size (rounded down, but
+  // never less than 1) in each dimension. The pixels are premultiplied, so a
+  // plain average of all four channels is already weighted by alpha.
+  void Downsample(const unsigned char* src, unsigned int srcWidth, unsigned int srcHeight,
+                  unsigned char* dst, unsigned int dstWidth, unsigned int dstHeight)
+  {
+    for (unsigned int y = 0; y < dstHeight; ++y) {
+      unsigned int y0 = (y * 2 < srcHeight) ? y * 2 : srcHeight - 1;
+      unsigned int y1 = (y * 2 + 1 < srcHeight) ? y * 2 + 1 : y0;
+      for (unsigned int x = 0; x < dstWidth; ++x) {
+        unsigned int x0 = (x * 2 < srcWidth) ? x * 2 : srcWidth - 1;
+        unsigned int x1 = (x * 2 + 1 < srcWidth) ? x * 2 + 1 : x0;
+        const unsigned char* a = src + (y0 * srcWidth + x0) * 4;
+        const unsigned char* b = src + (y0 * srcWidth + x1) * 4;
+        const unsigned char* c = src + (y1 * srcWidth + x0) * 4;
+        const unsigned char* d = src + (y1 * srcWidth + x1) * 4;
+
+        unsigned char* out = dst + (y * dstWidth + x) * 4;
+        for (int ch = 0; ch < 4; ++ch)
+          out[ch] = (a[ch] + b[ch] + c[ch] + d[ch] + 2) / 4;
+      }
+    }
+  }
+
+
+  bool ValidateAssetPack(const AssetPack* pack)
+  {
+    const AssetPackHeader* header = pack->header;
+    if (header->magic != kAssetPackMagic || header->version != kAssetPackVersion)
+      return false;
+    if (header->dataSize != pack->size)
+      return false;
+
+    size_t indexEnd = sizeof(AssetPackHeader) + size_t(header->numTextures) * sizeof(PackedTexture);
+    if (indexEnd > pack->size)
+      return false;
+
+    for (unsigned int i = 0; i < header->numTextures; ++i) {
+      const PackedTexture& tex = pack->textures[i];
+      if (tex.numLevels == 0 || tex.numLevels > kMaxMipLevels)
+        return false;
+      if (memchr(tex.name, '\0', kMaxPackedNameLength) == NULL)
+        return false;
+      for (unsigned int l = 0; l < tex.numLevels; ++l) {
+        const PackedLevel& level = tex.levels[l];
+        size_t levelSize = size_t(level.width) * level.height * 4;
+        if (level.offset < indexEnd || level.offset > pack->size ||
+            levelSize > pack->size - level.offset)
+          return false;
+      }
+    }
+    return true;
+  }
+
+} // namespace cat
+
@@ -0,0 +1,107 @@
+#ifndef cat_assetpack_h
+#define cat_assetpack_h
+
+#include <cstddef>
+
+namespace cat {
+
+  //
+  // Forward declarations
+  //
+
+  class Image;
+
+
+  //
+  // Constants
+  //
+
+  static const unsigned int kAssetPackMagic = 0x50544143; // "CATP"
+  static const unsigned int kAssetPackVersion = 2;
+  static const unsigned int kMaxPackedNameLength = 64;
+  static const unsigned int kMaxMipLevels = 16;
+
+
+  //
+  // Types
+  //
+
+  // The on-disk layout of a pack is:
+  //
+  //   AssetPackHeader
+  //   PackedTexture[numTextures]
+  //   pixel data for every level of every texture
+  //
+  // All pixel data is premultiplied BGRA8 (the layout GPUs use natively),
+  // tightly packed, in the same row order as the source image, and starts on
+  // a 16 byte boundary. Levels run from the full size image down to 1x1.
+  // Everything is stored in native byte order; packs are built as part of
+  // the build, so they never move between machines.
+  struct AssetPackHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int numTextures;
+    unsigned int dataSize;  // Size of the whole file, in bytes.
+  };
+
+
+  struct PackedLevel {
+    unsigned int offset;    // From the start of the file.
+    unsigned int width;
+    unsigned int height;
+  };
+
+
+  struct PackedTexture {
+    char name[kMaxPackedNameLength];  // Source filename, lowercased.
+    unsigned int numLevels;
+    PackedLevel levels[kMaxMipLevels];
+  };
+
+
+  // A pack in memory. Pointers into it stay valid until the pack is closed.
+  struct AssetPack {
+    void* mapping;              // NULL if the memory belongs to someone else.
+    const unsigned char* data;
+    size_t size;
+    const AssetPackHeader* header;
+    const PackedTexture* textures;
+
+    AssetPack();
+  };
+
+
+  //
+  // Functions
+  //
+
+  // Maps the pack at path into memory. Returns NULL if the file is missing or
+  // isn't a valid pack, in which case the caller should fall back to loading
+  // the source images.
+  AssetPack* OpenAssetPack(const char* path);
+  // Uses a pack which is already in memory, e.g. one built into the
+  // executable. The memory must stay valid until the pack is closed, and
+  // must be 4 byte aligned.
+  AssetPack* OpenAssetPackInMemory(const unsigned char* data, size_t size);
+  void CloseAssetPack(AssetPack* pack);
+
+  // Looks up a texture by its source filename, ignoring case. Returns NULL if
+  // the pack doesn't contain it.
+  const PackedTexture* FindPackedTexture(const AssetPack* pack, const char* name);
+
+  // Creates a texture from every level of tex and returns its ID. The pixels
+  // are already in the format GL wants, so this does no processing of its
+  // own. Must be called on the thread which owns the GL context.
+  unsigned int UploadPackedTexture(const AssetPack* pack, const PackedTexture* tex);
+
+  // Converts each image to premultiplied BGRA8, builds its mip chain and
+  // writes the lot out as a pack. names[i] is the name images[i] will be
+  // found under. Returns false (after printing the reason) if the file
+  // couldn't be written.
+  bool WriteAssetPack(const char* path, const char* const* names,
+                      Image* const* images, unsigned int count);
+
+} // namespace cat
+
+#endif // cat_assetpack_h
+
@@ -0,0 +1,235 @@
+#include "assetwatch.h"
+
+#include "atomic.h"
+#include "image.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <pthread.h>
+#include <string>
+#include <strings.h>
+#include <unistd.h>
+
+#ifdef linux
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  // How often the watcher thread checks whether it's been asked to stop.
+  static const int kStopCheckMillis = 250;
+
+  // Editors often write a file several times in quick succession, so we wait
+  // for things to go quiet for this long before decoding.
+  static const int kSettleMillis = 100;
+
+
+  //
+  // Types
+  //
+
+  struct ChangedAsset {
+    std::string name;
+    Image* image;
+  };
+
+
+  struct AssetWatcher {
+    std::string dir;
+    int inotifyFD;
+    pthread_t thread;
+    volatile int stop;
+
+    // Decoded images waiting for the render thread. Protected by lock.
+    std::list<ChangedAsset> changed;
+    pthread_mutex_t lock;
+
+    AssetWatcher(const char* dir);
+    ~AssetWatcher();
+  };
+
+
+  //
+  // Forward declarations
+  //
+
+  void* WatcherThread(void* arg);
+  void DecodeChangedAsset(AssetWatcher* watcher, const std::string& name);
+  bool IsImageFile(const char* name);
+
+
+  //
+  // AssetWatcher public methods
+  //
+
+  AssetWatcher::AssetWatcher(const char* dir) :
+    dir(dir),
+    inotifyFD(-1),
+    thread(),
+    stop(0),
+    changed()
+  {
+    pthread_mutex_init(&lock, NULL);
+  }
+
+
+  AssetWatcher::~AssetWatcher()
+  {
+    for (std::list<ChangedAsset>::iterator it = changed.begin(); it != changed.end(); ++it)
+      delete it->image;
+    if (inotifyFD >= 0)
+      close(inotifyFD);
+    pthread_mutex_destroy(&lock);
+  }
+
+
+  //
+  // Public functions
+  //
+
+  AssetWatcher* StartAssetWatcher(const char* dir)
+  {
+#ifdef linux
+    assert(dir != NULL);
+
+    AssetWatcher* watcher = new AssetWatcher(dir);
+    watcher->inotifyFD = inotify_init();
+    if (watcher->inotifyFD < 0 ||
+        inotify_add_watch(watcher->inotifyFD, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+      fprintf(stderr, "Unable to watch %s for changes.\n", dir);
+      delete watcher;
+      return NULL;
+    }
+    if (pthread_create(&watcher->thread, NULL, WatcherThread, watcher) != 0) {
+      delete watcher;
+      return NULL;
+    }
+    return watcher;
+#else
+    return NULL;
+#endif
+  }
+
+
+  void StopAssetWatcher(AssetWatcher* watcher)
+  {
+    if (watcher == NULL)
+      return;
+    AtomicStore(&watcher->stop, 1);
+    pthread_join(watcher->thread, NULL);
+    delete watcher;
+  }
+
+
+  Image* NextChangedAsset(AssetWatcher* watcher, char* name, size_t nameSize)
+  {
+    if (watcher == NULL)
+      return NULL;
+
+    Image* image = NULL;
+    pthread_mutex_lock(&watcher->lock);
+    if (!watcher->changed.empty()) {
+      ChangedAsset& asset = watcher->changed.front();
+      image = asset.image;
+      snprintf(name, nameSize, "%s", asset.name.c_str());
+      watcher->changed.pop_front();
+    }
+    pthread_mutex_unlock(&watcher->lock);
+    return image;
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  void* WatcherThread(void* arg)
+  {
+#ifdef linux
+    AssetWatcher* watcher = static_cast<AssetWatcher*>(arg);
+
+    // Names of files which have changed but haven't settled yet.
+    std::list<std::string> pending;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (!AtomicLoad(&watcher->stop)) {
+      struct pollfd pfd;
+      pfd.fd = watcher->inotifyFD;
+      pfd.events = POLLIN;
+      int timeout = pending.empty() ? kStopCheckMillis : kSettleMillis;
+      int ready = poll(&pfd, 1, timeout);
+
+      if (ready <= 0) {
+        // Nothing new for a while, so anything pending has settled.
+        for (std::list<std::string>::iterator it = pending.begin(); it != pending.end(); ++it)
+          DecodeChangedAsset(watcher, *it);
+        pending.clear();
+        continue;
+      }
+
+      ssize_t len = read(watcher->inotifyFD, buf, sizeof(buf));
+      for (ssize_t offset = 0; offset < len; ) {
+        const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buf + offset);
+        offset += sizeof(struct inotify_event) + event->len;
+        if (event->len == 0 || !IsImageFile(event->name))
+          continue;
+
+        std::string name(event->name);
+        pending.remove(name);
+        pending.push_back(name);
+      }
+    }
+#endif
+    return NULL;
+  }
+
+
+  void DecodeChangedAsset(AssetWatcher* watcher, const std::string& name)
+  {
+    std::string path = watcher->dir + "/" + name;
+    Image* image = NULL;
+    try {
+      image = new Image(path.c_str());
+      image->convertToBGRA();
+      image->premultiplyAlpha();
+    } catch (ImageException& ex) {
+      // Probably caught the file half written; we'll get another event
+      // when it's finished.
+      fprintf(stderr, "Unable to reload %s: %s\n", path.c_str(), ex.what());
+      return;
+    }
+
+    ChangedAsset asset;
+    asset.name = name;
+    asset.image = image;
+
+    // Only the newest version of each file matters.
+    pthread_mutex_lock(&watcher->lock);
+    for (std::list<ChangedAsset>::iterator it = watcher->changed.begin(); it != watcher->changed.end(); ) {
+      if (it->name == name) {
+        delete it->image;
+        it = watcher->changed.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    watcher->changed.push_back(asset);
+    pthread_mutex_unlock(&watcher->lock);
+  }
+
+
+  bool IsImageFile(const char* name)
+  {
+    const char* ext = strrchr(name, '.');
+    return ext != NULL && (strcasecmp(ext, ".tga") == 0 || strcasecmp(ext, ".bmp") == 0);
+  }
+
+} // namespace cat
+
@@ -0,0 +1,38 @@
+#ifndef cat_assetwatch_h
+#define cat_assetwatch_h
+
+#include <cstddef>
+
+namespace cat {
+
+  //
+  // Forward type declarations
+  //
+
+  class Image;
+  struct AssetWatcher;  // Opaque; see assetwatch.cpp for details.
+
+
+  //
+  // Functions
+  //
+
+  // Watches a directory for image files being written or moved into it. Each
+  // changed image gets decoded (and converted to premultiplied BGRA) on a
+  // background thread, then handed over via NextChangedAsset, so the render
+  // thread only has to upload it.
+  //
+  // Returns NULL if watching isn't supported on this platform or the
+  // directory can't be watched.
+  AssetWatcher* StartAssetWatcher(const char* dir);
+  void StopAssetWatcher(AssetWatcher* watcher);
+
+  // Returns the next image which has changed, or NULL if there aren't any.
+  // The caller takes ownership of the image. The file name (without the
+  // directory) is copied into name. Never blocks.
+  Image* NextChangedAsset(AssetWatcher* watcher, char* name, size_t nameSize);
+
+} // namespace cat
+
+#endif // cat_assetwatch_h
+
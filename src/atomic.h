@@ -0,0 +1,83 @@
+#ifndef cat_atomic_h
+#define cat_atomic_h
+
+namespace cat {
+
+  //
+  // Functions
+  //
+
+  // Thin wrappers around the GCC __sync builtins (also supported by clang).
+  // All of these act as full memory barriers.
+
+  inline int AtomicLoad(volatile int* ptr)
+  {
+    __sync_synchronize();
+    int value = *ptr;
+    __sync_synchronize();
+    return value;
+  }
+
+
+  inline void AtomicStore(volatile int* ptr, int value)
+  {
+    __sync_synchronize();
+    *ptr = value;
+    __sync_synchronize();
+  }
+
+
+  // Sets *ptr to value and returns the value it had previously.
+  inline int AtomicExchange(volatile int* ptr, int value)
+  {
+    int old = *ptr;
+    for (;;) {
+      int prev = __sync_val_compare_and_swap(ptr, old, value);
+      if (prev == old)
+        return old;
+      old = prev;
+    }
+  }
+
+
+  // Adds amount to *ptr and returns the value it had previously.
+  inline int AtomicFetchAdd(volatile int* ptr, int amount)
+  {
+    return __sync_fetch_and_add(ptr, amount);
+  }
+
+
+  // Raises *ptr to value if it's currently lower. Returns the new value.
+  inline long AtomicMax(volatile long* ptr, long value)
+  {
+    long old = *ptr;
+    while (old < value) {
+      long prev = __sync_val_compare_and_swap(ptr, old, value);
+      if (prev == old)
+        return value;
+      old = prev;
+    }
+    return old;
+  }
+
+
+  inline long AtomicLoad(volatile long* ptr)
+  {
+    __sync_synchronize();
+    long value = *ptr;
+    __sync_synchronize();
+    return value;
+  }
+
+
+  inline void AtomicStore(volatile long* ptr, long value)
+  {
+    __sync_synchronize();
+    *ptr = value;
+    __sync_synchronize();
+  }
+
+} // namespace cat
+
+#endif // cat_atomic_h
+
@@ -0,0 +1,675 @@
+#include "audio.h"
+
+#include "atomic.h"
+#include "metrics.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  static const double kAudioPeriodMillis = 1000.0 * kAudioPeriodFrames / kAudioSampleRate;
+
+  // How much audio ALSA keeps queued up ahead of what's playing. Enough to
+  // ride out a few late wakeups without being noticeably behind the game.
+  static const unsigned int kAudioLatencyMicros = 20000;
+
+  // With no sound card to keep time, the mixer paces itself; if it falls
+  // further behind than this it gives up catching up.
+  static const double kMaxAudioLagMillis = 100.0;
+
+  // Leaves some headroom for several sounds playing at once.
+  static const float kMasterVolume = 0.5f;
+
+  static const int kWAVHeaderSize = 44;
+
+
+  //
+  // Types
+  //
+
+  enum AudioOutput {
+    eAudioOutputNull,
+    eAudioOutputALSA,
+    eAudioOutputWAV
+  };
+
+
+  enum Waveform {
+    eWaveSine,
+    eWaveSquare,
+    eWaveTriangle,
+    eWaveNoise
+  };
+
+
+  struct Sound {
+    float* samples;   // Mono, from -1 to 1.
+    int length;       // In frames.
+  };
+
+
+  struct Voice {
+    bool active;
+    int sound;
+    int position;     // Next frame of the sound to play.
+    float gainLeft;
+    float gainRight;
+    long started;     // Order the voices were started in, for stealing.
+  };
+
+
+  struct AudioCommand {
+    int sound;
+    float pan;
+    float volume;
+  };
+
+
+  // Same scheme as InputQueue: the game thread is the only producer and the
+  // mixer thread is the only consumer, and neither ever waits for the other.
+  struct AudioCommandQueue {
+    AudioCommand commands[kAudioQueueSize];
+    // Only the consumer writes head and only the producer writes tail.
+    volatile int head;
+    volatile int tail;
+
+    AudioCommandQueue();
+
+    bool push(const AudioCommand& command);
+    bool pop(AudioCommand& command);
+  };
+
+
+  // Everything the mixer thread touches is allocated up front, so it never
+  // has to call into the allocator once it's running.
+  struct AudioEngine {
+    AudioOutput output;
+#ifdef HAVE_ALSA
+    snd_pcm_t* pcm;
+#endif
+    FILE* wav;
+    long wavFrames;
+
+    pthread_t thread;
+    volatile int stop;
+    volatile int muted;
+    AudioCommandQueue commands;
+
+    Sound sounds[eSoundTypeCount];
+    Voice voices[kMaxVoices];
+    long voicesStarted;
+
+    float left[kAudioPeriodFrames];
+    float right[kAudioPeriodFrames];
+    short out[kAudioPeriodFrames * kAudioChannels];
+
+    AudioEngine();
+    ~AudioEngine();
+  };
+
+
+  //
+  // Forward declarations
+  //
+
+  void* AudioThread(void* arg);
+  void RaiseThreadPriority();
+  void MixPeriod(AudioEngine* audio);
+  void StartVoice(AudioEngine* audio, const AudioCommand& command);
+  void MixVoice(const float* src, int count, float gainLeft, float gainRight, float* left, float* right);
+  void ConvertSamples(const float* left, const float* right, int count, float gain, short* out);
+  void WaitForNextPeriod(double& nextTime);
+
+  bool OpenALSA(AudioEngine* audio);
+  void WriteALSA(AudioEngine* audio);
+  bool OpenWAV(AudioEngine* audio, const char* path);
+  void WriteWAV(AudioEngine* audio);
+  void FinishWAV(AudioEngine* audio);
+  void PutLE16(unsigned char* dst, unsigned int value);
+  void PutLE32(unsigned char* dst, unsigned int value);
+
+  void GenerateSounds(Sound* sounds);
+  void NewSound(Sound& sound, double seconds);
+  void AddTone(Sound& sound, double start, double duration, double fromFreq, double toFreq,
+               Waveform wave, float volume);
+
+
+  //
+  // Global variables
+  //
+
+  static Metric* gAudioUnderrunsMetric = RegisterCounter(
+      "cat_audio_underruns_total", "Times the sound card ran out of samples to play.");
+
+
+  //
+  // AudioCommandQueue public methods
+  //
+
+  AudioCommandQueue::AudioCommandQueue() :
+    head(0),
+    tail(0)
+  {
+  }
+
+
+  bool AudioCommandQueue::push(const AudioCommand& command)
+  {
+    int t = tail;
+    if (t - AtomicLoad(&head) >= kAudioQueueSize)
+      return false;
+
+    commands[t & (kAudioQueueSize - 1)] = command;
+    AtomicStore(&tail, t + 1);
+    return true;
+  }
+
+
+  bool AudioCommandQueue::pop(AudioCommand& command)
+  {
+    int h = head;
+    if (h == AtomicLoad(&tail))
+      return false;
+
+    command = commands[h & (kAudioQueueSize - 1)];
+    AtomicStore(&head, h + 1);
+    return true;
+  }
+
+
+  //
+  // AudioEngine public methods
+  //
+
+  AudioEngine::AudioEngine() :
+    output(eAudioOutputNull),
+#ifdef HAVE_ALSA
+    pcm(NULL),
+#endif
+    wav(NULL),
+    wavFrames(0),
+    thread(),
+    stop(0),
+    muted(0),
+    commands(),
+    voicesStarted(0)
+  {
+    memset(voices, 0, sizeof(voices));
+    GenerateSounds(sounds);
+  }
+
+
+  AudioEngine::~AudioEngine()
+  {
+#ifdef HAVE_ALSA
+    if (pcm != NULL)
+      snd_pcm_close(pcm);
+#endif
+    if (wav != NULL)
+      FinishWAV(this);
+    for (int i = 0; i < eSoundTypeCount; ++i)
+      delete[] sounds[i].samples;
+  }
+
+
+  //
+  // Public functions
+  //
+
+  AudioEngine* StartAudio(const char* wavPath)
+  {
+    AudioEngine* audio = new AudioEngine();
+    if (wavPath != NULL) {
+      if (!OpenWAV(audio, wavPath)) {
+        delete audio;
+        return NULL;
+      }
+      audio->output = eAudioOutputWAV;
+    }
+    else if (OpenALSA(audio)) {
+      audio->output = eAudioOutputALSA;
+    }
+
+    if (pthread_create(&audio->thread, NULL, AudioThread, audio) != 0) {
+      fprintf(stderr, "Unable to start the audio thread.\n");
+      delete audio;
+      return NULL;
+    }
+    return audio;
+  }
+
+
+  void StopAudio(AudioEngine* audio)
+  {
+    if (audio == NULL)
+      return;
+    AtomicStore(&audio->stop, 1);
+    pthread_join(audio->thread, NULL);
+    delete audio;
+  }
+
+
+  bool PlaySound(AudioEngine* audio, SoundType sound, float pan, float volume)
+  {
+    if (audio == NULL)
+      return false;
+
+    AudioCommand command;
+    command.sound = sound;
+    command.pan = pan;
+    command.volume = volume;
+    return audio->commands.push(command);
+  }
+
+
+  void SetAudioMuted(AudioEngine* audio, bool muted)
+  {
+    if (audio != NULL)
+      AtomicStore(&audio->muted, muted ? 1 : 0);
+  }
+
+
+  bool AudioMuted(AudioEngine* audio)
+  {
+    return audio != NULL && AtomicLoad(&audio->muted) != 0;
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  void* AudioThread(void* arg)
+  {
+    AudioEngine* audio = static_cast<AudioEngine*>(arg);
+    SetProfileThreadName("Audio mixer");
+    RaiseThreadPriority();
+
+    double nextTime = ProfileTime();
+    while (!AtomicLoad(&audio->stop)) {
+      MixPeriod(audio);
+      if (audio->output == eAudioOutputALSA) {
+        // Blocks until there's room, which is all the pacing we need.
+        WriteALSA(audio);
+        continue;
+      }
+
+      if (audio->output == eAudioOutputWAV)
+        WriteWAV(audio);
+      WaitForNextPeriod(nextTime);
+    }
+    return NULL;
+  }
+
+
+  // Mixing late is an audible glitch, so try to get ahead of the game's own
+  // threads. This usually needs privileges we won't have, in which case we
+  // just carry on at normal priority.
+  void RaiseThreadPriority()
+  {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  }
+
+
+  void MixPeriod(AudioEngine* audio)
+  {
+    PROFILE_ZONE("MixAudio");
+
+    AudioCommand command;
+    while (audio->commands.pop(command))
+      StartVoice(audio, command);
+
+    std::fill(audio->left, audio->left + kAudioPeriodFrames, 0.0f);
+    std::fill(audio->right, audio->right + kAudioPeriodFrames, 0.0f);
+
+    for (int i = 0; i < kMaxVoices; ++i) {
+      Voice& voice = audio->voices[i];
+      if (!voice.active)
+        continue;
+
+      const Sound& sound = audio->sounds[voice.sound];
+      int count = std::min(kAudioPeriodFrames, sound.length - voice.position);
+      MixVoice(sound.samples + voice.position, count, voice.gainLeft, voice.gainRight,
+               audio->left, audio->right);
+      voice.position += count;
+      if (voice.position >= sound.length)
+        voice.active = false;
+    }
+
+    // Muted sounds keep playing silently, so unmuting doesn't bring back
+    // ones which should have finished already.
+    float gain = AtomicLoad(&audio->muted) ? 0.0f : kMasterVolume;
+    ConvertSamples(audio->left, audio->right, kAudioPeriodFrames, gain, audio->out);
+  }
+
+
+  void StartVoice(AudioEngine* audio, const AudioCommand& command)
+  {
+    if (command.sound < 0 || command.sound >= eSoundTypeCount)
+      return;
+
+    Voice* voice = NULL;
+    for (int i = 0; i < kMaxVoices && voice == NULL; ++i) {
+      if (!audio->voices[i].active)
+        voice = &audio->voices[i];
+    }
+    if (voice == NULL) {
+      voice = &audio->voices[0];
+      for (int i = 1; i < kMaxVoices; ++i) {
+        if (audio->voices[i].started < voice->started)
+          voice = &audio->voices[i];
+      }
+    }
+
+    // Equal power panning, so a sound is as loud in the middle as at the sides.
+    float pan = std::max(-1.0f, std::min(1.0f, command.pan));
+    float angle = (pan + 1.0f) * float(M_PI) / 4.0f;
+    voice->active = true;
+    voice->sound = command.sound;
+    voice->position = 0;
+    voice->gainLeft = cosf(angle) * command.volume * float(M_SQRT2);
+    voice->gainRight = sinf(angle) * command.volume * float(M_SQRT2);
+    voice->started = audio->voicesStarted++;
+  }
+
+
+  // Adds count mono samples from src into left and right with the given gains.
+  void MixVoice(const float* src, int count, float gainLeft, float gainRight, float* left, float* right)
+  {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 gl = _mm_set1_ps(gainLeft);
+    const __m128 gr = _mm_set1_ps(gainRight);
+    for (; i + 4 <= count; i += 4) {
+      __m128 s = _mm_loadu_ps(src + i);
+      _mm_storeu_ps(left + i, _mm_add_ps(_mm_loadu_ps(left + i), _mm_mul_ps(s, gl)));
+      _mm_storeu_ps(right + i, _mm_add_ps(_mm_loadu_ps(right + i), _mm_mul_ps(s, gr)));
+    }
+#endif
+    for (; i < count; ++i) {
+      left[i] += src[i] * gainLeft;
+      right[i] += src[i] * gainRight;
+    }
+  }
+
+
+  // Scales, clips and interleaves the mix into 16-bit stereo.
+  void ConvertSamples(const float* left, const float* right, int count, float gain, short* out)
+  {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 scale = _mm_set1_ps(gain);
+    const __m128 lo = _mm_set1_ps(-1.0f);
+    const __m128 hi = _mm_set1_ps(1.0f);
+    const __m128 full = _mm_set1_ps(32767.0f);
+    for (; i + 4 <= count; i += 4) {
+      // Clip before converting: out of range floats convert to INT_MIN.
+      __m128 l = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(left + i), scale), lo), hi);
+      __m128 r = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(right + i), scale), lo), hi);
+      __m128i li = _mm_cvtps_epi32(_mm_mul_ps(l, full));
+      __m128i ri = _mm_cvtps_epi32(_mm_mul_ps(r, full));
+      __m128i lr = _mm_packs_epi32(_mm_unpacklo_epi32(li, ri), _mm_unpackhi_epi32(li, ri));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 2), lr);
+    }
+#endif
+    for (; i < count; ++i) {
+      float l = std::max(-1.0f, std::min(1.0f, left[i] * gain));
+      float r = std::max(-1.0f, std::min(1.0f, right[i] * gain));
+      out[i * 2] = short(lrintf(l * 32767.0f));
+      out[i * 2 + 1] = short(lrintf(r * 32767.0f));
+    }
+  }
+
+
+  // Sleeps until it's time to mix the next period, as if a sound card were
+  // waiting for it.
+  void WaitForNextPeriod(double& nextTime)
+  {
+    nextTime += kAudioPeriodMillis;
+    double wait = nextTime - ProfileTime();
+    if (wait > 0)
+      usleep((useconds_t)(wait * 1000));
+    else if (wait < -kMaxAudioLagMillis)
+      nextTime = ProfileTime();
+  }
+
+
+#ifdef HAVE_ALSA
+
+  bool OpenALSA(AudioEngine* audio)
+  {
+    int err = snd_pcm_open(&audio->pcm, "default", SND_PCM_STREAM_PLAYBACK, 0);
+    if (err < 0) {
+      fprintf(stderr, "Unable to open the sound device: %s\n", snd_strerror(err));
+      audio->pcm = NULL;
+      return false;
+    }
+
+    err = snd_pcm_set_params(audio->pcm, SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED,
+                             kAudioChannels, kAudioSampleRate, 1, kAudioLatencyMicros);
+    if (err < 0) {
+      fprintf(stderr, "Unable to set up the sound device: %s\n", snd_strerror(err));
+      snd_pcm_close(audio->pcm);
+      audio->pcm = NULL;
+      return false;
+    }
+    return true;
+  }
+
+
+  void WriteALSA(AudioEngine* audio)
+  {
+    const short* samples = audio->out;
+    snd_pcm_sframes_t remaining = kAudioPeriodFrames;
+    while (remaining > 0) {
+      snd_pcm_sframes_t written = snd_pcm_writei(audio->pcm, samples, remaining);
+      if (written < 0) {
+        if (written == -EPIPE)
+          IncrementCounter(gAudioUnderrunsMetric);
+        int err = snd_pcm_recover(audio->pcm, int(written), 1);
+        if (err < 0) {
+          // Carry on without sound rather than spinning on a dead device.
+          fprintf(stderr, "Lost the sound device: %s\n", snd_strerror(err));
+          audio->output = eAudioOutputNull;
+          return;
+        }
+        continue;
+      }
+      samples += written * kAudioChannels;
+      remaining -= written;
+    }
+  }
+
+#else
+
+  bool OpenALSA(AudioEngine* audio)
+  {
+    return false;
+  }
+
+
+  void WriteALSA(AudioEngine* audio)
+  {
+  }
+
+#endif
+
+
+  // The header gets written with the sizes left as zero; FinishWAV fills
+  // them in.
+  bool OpenWAV(AudioEngine* audio, const char* path)
+  {
+    audio->wav = fopen(path, "wb");
+    if (audio->wav == NULL) {
+      fprintf(stderr, "Unable to write sound to %s: %s\n", path, strerror(errno));
+      return false;
+    }
+
+    const int kBytesPerFrame = kAudioChannels * 2;
+    unsigned char header[kWAVHeaderSize];
+    memcpy(header, "RIFF", 4);
+    PutLE32(header + 4, 0);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    PutLE32(header + 16, 16);
+    PutLE16(header + 20, 1); // PCM
+    PutLE16(header + 22, kAudioChannels);
+    PutLE32(header + 24, kAudioSampleRate);
+    PutLE32(header + 28, kAudioSampleRate * kBytesPerFrame);
+    PutLE16(header + 32, kBytesPerFrame);
+    PutLE16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    PutLE32(header + 40, 0);
+    fwrite(header, 1, sizeof(header), audio->wav);
+    return true;
+  }
+
+
+  void WriteWAV(AudioEngine* audio)
+  {
+    unsigned char bytes[kAudioPeriodFrames * kAudioChannels * 2];
+    for (int i = 0; i < kAudioPeriodFrames * kAudioChannels; ++i)
+      PutLE16(bytes + i * 2, (unsigned short)audio->out[i]);
+    fwrite(bytes, 1, sizeof(bytes), audio->wav);
+    audio->wavFrames += kAudioPeriodFrames;
+  }
+
+
+  void FinishWAV(AudioEngine* audio)
+  {
+    unsigned char size[4];
+    unsigned int dataBytes = (unsigned int)(audio->wavFrames * kAudioChannels * 2);
+
+    PutLE32(size, kWAVHeaderSize - 8 + dataBytes);
+    fseek(audio->wav, 4, SEEK_SET);
+    fwrite(size, 1, 4, audio->wav);
+
+    PutLE32(size, dataBytes);
+    fseek(audio->wav, kWAVHeaderSize - 4, SEEK_SET);
+    fwrite(size, 1, 4, audio->wav);
+
+    fclose(audio->wav);
+    audio->wav = NULL;
+  }
+
+
+  void PutLE16(unsigned char* dst, unsigned int value)
+  {
+    dst[0] = value & 0xFF;
+    dst[1] = (value >> 8) & 0xFF;
+  }
+
+
+  void PutLE32(unsigned char* dst, unsigned int value)
+  {
+    PutLE16(dst, value & 0xFFFF);
+    PutLE16(dst + 2, value >> 16);
+  }
+
+
+  // There are no sound files yet, so everything is made out of simple tones.
+  void GenerateSounds(Sound* sounds)
+  {
+    // A falling buzz with a burst of noise at the start.
+    Sound& lifeLost = sounds[eSoundLifeLost];
+    NewSound(lifeLost, 0.6);
+    AddTone(lifeLost, 0.0, 0.6, 440.0, 110.0, eWaveSquare, 0.35f);
+    AddTone(lifeLost, 0.0, 0.25, 0.0, 0.0, eWaveNoise, 0.3f);
+
+    // A rising sweep.
+    Sound& powerUp = sounds[eSoundPowerUp];
+    NewSound(powerUp, 0.4);
+    AddTone(powerUp, 0.0, 0.4, 300.0, 1200.0, eWaveSine, 0.5f);
+    AddTone(powerUp, 0.0, 0.4, 600.0, 2400.0, eWaveTriangle, 0.2f);
+
+    // C major arpeggio: C5, E5, G5, C6.
+    Sound& levelComplete = sounds[eSoundLevelComplete];
+    NewSound(levelComplete, 0.9);
+    AddTone(levelComplete, 0.00, 0.30, 523.25, 523.25, eWaveTriangle, 0.4f);
+    AddTone(levelComplete, 0.12, 0.30, 659.25, 659.25, eWaveTriangle, 0.4f);
+    AddTone(levelComplete, 0.24, 0.30, 783.99, 783.99, eWaveTriangle, 0.4f);
+    AddTone(levelComplete, 0.36, 0.54, 1046.50, 1046.50, eWaveTriangle, 0.4f);
+
+    // G4, E4, then a sagging C4.
+    Sound& gameOver = sounds[eSoundGameOver];
+    NewSound(gameOver, 1.2);
+    AddTone(gameOver, 0.0, 0.3, 392.00, 392.00, eWaveTriangle, 0.45f);
+    AddTone(gameOver, 0.3, 0.3, 329.63, 329.63, eWaveTriangle, 0.45f);
+    AddTone(gameOver, 0.6, 0.6, 261.63, 246.94, eWaveTriangle, 0.45f);
+  }
+
+
+  void NewSound(Sound& sound, double seconds)
+  {
+    sound.length = int(seconds * kAudioSampleRate);
+    sound.samples = new float[sound.length];
+    std::fill(sound.samples, sound.samples + sound.length, 0.0f);
+  }
+
+
+  // Adds a tone gliding from fromFreq to toFreq (in Hz) to the sound. It
+  // fades in quickly, to avoid a click, and then dies away over its length.
+  void AddTone(Sound& sound, double start, double duration, double fromFreq, double toFreq,
+               Waveform wave, float volume)
+  {
+    const double kAttack = 0.005;
+
+    int first = int(start * kAudioSampleRate);
+    int length = std::min(int(duration * kAudioSampleRate), sound.length - first);
+    unsigned int seed = 12345;
+    double phase = 0.0;
+    for (int i = 0; i < length; ++i) {
+      double t = double(i) / kAudioSampleRate;
+      double fraction = double(i) / length;
+      double envelope = (1.0 - fraction) * (1.0 - fraction);
+      if (t < kAttack)
+        envelope *= t / kAttack;
+
+      double value;
+      switch (wave) {
+        case eWaveSine:
+          value = sin(phase * 2.0 * M_PI);
+          break;
+        case eWaveSquare:
+          value = (phase < 0.5) ? 1.0 : -1.0;
+          break;
+        case eWaveTriangle:
+          value = (phase < 0.5) ? (4.0 * phase - 1.0) : (3.0 - 4.0 * phase);
+          break;
+        case eWaveNoise:
+        default:
+          seed = seed * 1103515245 + 12345;
+          value = ((seed >> 16) & 0x7FFF) / 16383.5 - 1.0;
+          break;
+      }
+      sound.samples[first + i] += float(value * envelope * volume);
+
+      phase += (fromFreq + (toFreq - fromFreq) * fraction) / kAudioSampleRate;
+      phase -= floor(phase);
+    }
+  }
+
+} // namespace cat
+
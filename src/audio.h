@@ -0,0 +1,68 @@
+#ifndef cat_audio_h
+#define cat_audio_h
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  static const int kAudioSampleRate = 44100;
+  static const int kAudioChannels = 2;
+  // Frames mixed at a time. Smaller means lower latency but more wakeups.
+  static const int kAudioPeriodFrames = 256;
+  // Sounds which can play at once. Starting another steals the voice which
+  // has been playing longest.
+  static const int kMaxVoices = 16;
+  // Must be a power of two.
+  static const int kAudioQueueSize = 64;
+
+
+  //
+  // Forward type declarations
+  //
+
+  struct AudioEngine;  // Opaque; see audio.cpp for details.
+
+
+  //
+  // Types
+  //
+
+  enum SoundType {
+    eSoundLifeLost,
+    eSoundPowerUp,
+    eSoundLevelComplete,
+    eSoundGameOver,
+
+    eSoundTypeCount   // Sentinel value.
+  };
+
+
+  //
+  // Functions
+  //
+
+  // Starts mixing on a background thread. If wavPath is NULL the sound goes
+  // to the default ALSA device, or nowhere (at the same pace) if there isn't
+  // one or the game was built without ALSA; otherwise it's written to that
+  // file as 16-bit stereo WAV. The sounds themselves are generated here, so
+  // there's nothing to load. Returns NULL if the file can't be written.
+  AudioEngine* StartAudio(const char* wavPath);
+  // Finishes writing the WAV file, if there is one.
+  void StopAudio(AudioEngine* audio);
+
+  // Queues a sound for the mixer thread. Pan runs from -1 (left) to 1
+  // (right). Only one thread may call this, and it never blocks or
+  // allocates; if the queue is full the sound is dropped and this returns
+  // false. Does nothing (and returns false) if audio is NULL.
+  bool PlaySound(AudioEngine* audio, SoundType sound, float pan = 0.0f, float volume = 1.0f);
+
+  // Can be called from any thread.
+  void SetAudioMuted(AudioEngine* audio, bool muted);
+  bool AudioMuted(AudioEngine* audio);
+
+} // namespace cat
+
+#endif // cat_audio_h
+
@@ -0,0 +1,443 @@
+#include "bloom.h"
+
+#include "glstate.h"
+#include "rendertarget.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+#define GL_GLEXT_PROTOTYPES 1
+#ifdef linux
+#include <GL/gl.h>
+#include <GL/glext.h>
+#else
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+#endif
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  static const int kMaxBloomLevels = 5;
+
+  // Brightness above which pixels start to contribute to the bloom.
+  static const float kBloomThreshold = 0.6f;
+  // How strongly the blurred result is added back into the scene.
+  static const float kBloomIntensity = 0.8f;
+
+  struct BloomTier {
+    int shift;    // Level 0 is the scene size divided by 2^shift.
+    int levels;
+  };
+
+  static const BloomTier kBloomTiers[eBloomQualityCount] = {
+    { 0, 0 }, // eBloomOff
+    { 2, 2 }, // eBloomLow
+    { 1, 3 }, // eBloomMedium
+    { 1, 5 }  // eBloomHigh
+  };
+
+  static const char* kBloomQualityNames[eBloomQualityCount] = {
+    "off",
+    "low",
+    "medium",
+    "high"
+  };
+
+
+  static const char* kQuadVertexShader =
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "  uv = gl_MultiTexCoord0.st;\n"
+    "  gl_Position = ftransform();\n"
+    "}\n";
+
+  // Keeps only the parts of the image brighter than the threshold, fading in
+  // smoothly above it.
+  static const char* kExtractFragmentShader =
+    "uniform sampler2D source;\n"
+    "uniform vec2 maxCoord;\n"
+    "uniform float threshold;\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "  vec3 c = texture2D(source, min(uv, maxCoord)).rgb;\n"
+    "  float brightness = max(c.r, max(c.g, c.b));\n"
+    "  float w = clamp((brightness - threshold) / (1.0 - threshold), 0.0, 1.0);\n"
+    "  gl_FragColor = vec4(c * w, 1.0);\n"
+    "}\n";
+
+  // 9-tap gaussian done as 5 bilinear taps along one axis. The taps are
+  // clamped to the part of the source which actually holds data.
+  static const char* kBlurFragmentShader =
+    "uniform sampler2D source;\n"
+    "uniform vec2 maxCoord;\n"
+    "uniform vec2 direction;\n"
+    "varying vec2 uv;\n"
+    "vec4 tap(vec2 p) { return texture2D(source, clamp(p, vec2(0.0), maxCoord)); }\n"
+    "void main() {\n"
+    "  vec2 o1 = direction * 1.3846153846;\n"
+    "  vec2 o2 = direction * 3.2307692308;\n"
+    "  gl_FragColor = tap(uv) * 0.2270270270\n"
+    "               + (tap(uv + o1) + tap(uv - o1)) * 0.3162162162\n"
+    "               + (tap(uv + o2) + tap(uv - o2)) * 0.0702702703;\n"
+    "}\n";
+
+
+  //
+  // Types
+  //
+
+  struct BloomLevel {
+    RenderTarget target;   // Holds the blurred result for this level.
+    RenderTarget scratch;  // Holds the horizontal pass.
+    int width;             // Part of the targets in use this frame.
+    int height;
+  };
+
+
+  struct BloomData {
+    GLuint extractProgram;
+    GLuint blurProgram;
+    BloomLevel levels[kMaxBloomLevels];
+    // The tier the chain is currently allocated for. Only the levels that
+    // tier uses get allocated.
+    int allocatedShift;
+    int allocatedLevels;
+
+    bool useTimestamps;
+    bool timerPending;
+    GLuint timerQueryIDs[2];
+    double lastTime;
+
+    BloomData();
+    ~BloomData();
+  };
+
+
+  //
+  // Forward declarations
+  //
+
+  GLuint CompileShader(GLenum type, const char* source);
+  GLuint LinkProgram(const char* vertexSource, const char* fragmentSource);
+  void DrawFullscreenQuad(float maxS, float maxT);
+  void SetSourceUniforms(GLuint program, const RenderTarget& source, int width, int height);
+  void ReadBloomTimer(BloomData* bloom);
+  void FreeBloomLevels(BloomData* bloom, int first);
+
+
+  //
+  // BloomData public methods
+  //
+
+  BloomData::BloomData() :
+    extractProgram(0),
+    blurProgram(0),
+    allocatedShift(-1),
+    allocatedLevels(0),
+    useTimestamps(false),
+    timerPending(false),
+    lastTime(-1)
+  {
+    for (int i = 0; i < kMaxBloomLevels; ++i) {
+      levels[i].width = 0;
+      levels[i].height = 0;
+    }
+    timerQueryIDs[0] = timerQueryIDs[1] = 0;
+  }
+
+
+  BloomData::~BloomData()
+  {
+    for (int i = 0; i < kMaxBloomLevels; ++i) {
+      DestroyRenderTarget(&levels[i].target);
+      DestroyRenderTarget(&levels[i].scratch);
+    }
+    if (extractProgram)
+      glDeleteProgram(extractProgram);
+    if (blurProgram)
+      glDeleteProgram(blurProgram);
+    if (timerQueryIDs[0])
+      glDeleteQueries(2, timerQueryIDs);
+  }
+
+
+  //
+  // Public functions
+  //
+
+  BloomData* CreateBloom(bool useTimestamps)
+  {
+    BloomData* bloom = new BloomData();
+    bloom->extractProgram = LinkProgram(kQuadVertexShader, kExtractFragmentShader);
+    bloom->blurProgram = LinkProgram(kQuadVertexShader, kBlurFragmentShader);
+    if (bloom->extractProgram == 0 || bloom->blurProgram == 0) {
+      delete bloom;
+      return NULL;
+    }
+
+    bloom->useTimestamps = useTimestamps;
+    if (useTimestamps)
+      glGenQueries(2, bloom->timerQueryIDs);
+    return bloom;
+  }
+
+
+  void DestroyBloom(BloomData* bloom)
+  {
+    delete bloom;
+  }
+
+
+  void ApplyBloom(BloomData* bloom, BloomQuality quality,
+                  const RenderTarget& scene, int sceneWidth, int sceneHeight)
+  {
+    if (bloom == NULL)
+      return;
+    if (quality == eBloomOff) {
+      // No point holding on to the video memory while it's off.
+      if (bloom->allocatedLevels > 0)
+        FreeBloomLevels(bloom, 0);
+      return;
+    }
+
+    const BloomTier& tier = kBloomTiers[quality];
+
+    // (Re)allocate the chain if the scene size or the tier's base resolution
+    // changed. The chain is sized for the full scene target so that changes
+    // to the render scale only shrink the viewports.
+    BloomLevel* levels = bloom->levels;
+    int baseWidth = std::max(1, scene.width >> tier.shift);
+    int baseHeight = std::max(1, scene.height >> tier.shift);
+    if (bloom->allocatedShift != tier.shift || bloom->allocatedLevels != tier.levels ||
+        levels[0].target.width != baseWidth || levels[0].target.height != baseHeight) {
+      for (int i = 0; i < tier.levels; ++i) {
+        int w = std::max(1, baseWidth >> i);
+        int h = std::max(1, baseHeight >> i);
+        CreateRenderTarget(&levels[i].target, w, h, false);
+        CreateRenderTarget(&levels[i].scratch, w, h, false);
+      }
+      FreeBloomLevels(bloom, tier.levels);
+      bloom->allocatedShift = tier.shift;
+      bloom->allocatedLevels = tier.levels;
+    }
+    for (int i = 0; i < tier.levels; ++i) {
+      levels[i].width = std::max(1, (sceneWidth >> tier.shift) >> i);
+      levels[i].height = std::max(1, (sceneHeight >> tier.shift) >> i);
+    }
+
+    ReadBloomTimer(bloom);
+    bool timing = bloom->useTimestamps && !bloom->timerPending;
+    if (timing)
+      glQueryCounter(bloom->timerQueryIDs[0], GL_TIMESTAMP);
+
+    UseWorldProjection();
+    SetCapability(GL_DEPTH_TEST, false);
+    SetDepthMask(false);
+    SetCapability(GL_BLEND, false);
+    SetCapability(GL_TEXTURE_2D, true);
+
+    // Bright pass: scene -> level 0. Bilinear filtering does the downsample.
+    UseProgram(bloom->extractProgram);
+    glUniform1i(glGetUniformLocation(bloom->extractProgram, "source"), 0);
+    glUniform1f(glGetUniformLocation(bloom->extractProgram, "threshold"), kBloomThreshold);
+    SetSourceUniforms(bloom->extractProgram, scene, sceneWidth, sceneHeight);
+    BindRenderTarget(&levels[0].target);
+    SetViewport(0, 0, levels[0].width, levels[0].height);
+    BindTexture(scene.colorTextureID);
+    DrawFullscreenQuad(float(sceneWidth) / scene.width, float(sceneHeight) / scene.height);
+
+    // Down the chain: each level is a horizontal blur of the level above it
+    // (downsampling as it goes), followed by a vertical blur.
+    UseProgram(bloom->blurProgram);
+    glUniform1i(glGetUniformLocation(bloom->blurProgram, "source"), 0);
+    GLint directionLoc = glGetUniformLocation(bloom->blurProgram, "direction");
+    for (int i = 0; i < tier.levels; ++i) {
+      const BloomLevel& src = levels[std::max(0, i - 1)];
+      BloomLevel& dst = levels[i];
+
+      SetSourceUniforms(bloom->blurProgram, src.target, src.width, src.height);
+      glUniform2f(directionLoc, 1.0f / src.target.width, 0.0f);
+      BindRenderTarget(&dst.scratch);
+      SetViewport(0, 0, dst.width, dst.height);
+      BindTexture(src.target.colorTextureID);
+      DrawFullscreenQuad(float(src.width) / src.target.width, float(src.height) / src.target.height);
+
+      SetSourceUniforms(bloom->blurProgram, dst.scratch, dst.width, dst.height);
+      glUniform2f(directionLoc, 0.0f, 1.0f / dst.scratch.height);
+      BindRenderTarget(&dst.target);
+      BindTexture(dst.scratch.colorTextureID);
+      DrawFullscreenQuad(float(dst.width) / dst.scratch.width, float(dst.height) / dst.scratch.height);
+    }
+    UseProgram(0);
+
+    // Back up the chain, adding each level into the one above it.
+    SetCapability(GL_BLEND, true);
+    SetBlendFunc(GL_ONE, GL_ONE);
+    SetTexEnvMode(GL_MODULATE);
+    SetColor(1, 1, 1);
+    for (int i = tier.levels - 1; i > 0; --i) {
+      const BloomLevel& src = levels[i];
+      const BloomLevel& dst = levels[i - 1];
+      BindRenderTarget(&dst.target);
+      SetViewport(0, 0, dst.width, dst.height);
+      BindTexture(src.target.colorTextureID);
+      DrawFullscreenQuad(float(src.width) / src.target.width, float(src.height) / src.target.height);
+    }
+
+    // Composite into the scene.
+    BindRenderTarget(&scene);
+    SetViewport(0, 0, sceneWidth, sceneHeight);
+    SetColor(kBloomIntensity, kBloomIntensity, kBloomIntensity);
+    BindTexture(levels[0].target.colorTextureID);
+    DrawFullscreenQuad(float(levels[0].width) / levels[0].target.width,
+                       float(levels[0].height) / levels[0].target.height);
+
+    SetDepthMask(true);
+    SetCapability(GL_DEPTH_TEST, true);
+
+    if (timing) {
+      glQueryCounter(bloom->timerQueryIDs[1], GL_TIMESTAMP);
+      bloom->timerPending = true;
+    }
+  }
+
+
+  double BloomTime(const BloomData* bloom)
+  {
+    return bloom ? bloom->lastTime : -1;
+  }
+
+
+  const char* BloomQualityName(BloomQuality quality)
+  {
+    assert(quality >= 0 && quality < eBloomQualityCount);
+    return kBloomQualityNames[quality];
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  GLuint CompileShader(GLenum type, const char* source)
+  {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    GLint compiled = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled) {
+      char log[4096];
+      glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+      fprintf(stderr, "Shader compile failed: %s\n", log);
+      glDeleteShader(shader);
+      return 0;
+    }
+    return shader;
+  }
+
+
+  GLuint LinkProgram(const char* vertexSource, const char* fragmentSource)
+  {
+    GLuint vertexShader = CompileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fragmentShader = CompileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    if (vertexShader == 0 || fragmentShader == 0) {
+      if (vertexShader)
+        glDeleteShader(vertexShader);
+      if (fragmentShader)
+        glDeleteShader(fragmentShader);
+      return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glLinkProgram(program);
+
+    // The program keeps the shaders alive for as long as it needs them.
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+      char log[4096];
+      glGetProgramInfoLog(program, sizeof(log), NULL, log);
+      fprintf(stderr, "Shader link failed: %s\n", log);
+      glDeleteProgram(program);
+      return 0;
+    }
+    return program;
+  }
+
+
+  // Assumes the projection maps the unit square to the viewport.
+  void DrawFullscreenQuad(float maxS, float maxT)
+  {
+    CountDrawCalls();
+    glBegin(GL_QUADS);
+      glTexCoord2f(0, 0);
+      glVertex2f(0, 0);
+
+      glTexCoord2f(maxS, 0);
+      glVertex2f(1, 0);
+
+      glTexCoord2f(maxS, maxT);
+      glVertex2f(1, 1);
+
+      glTexCoord2f(0, maxT);
+      glVertex2f(0, 1);
+    glEnd();
+  }
+
+
+  // Tells the shader how much of the source texture holds valid data, so
+  // that blur taps don't read past the edge of it.
+  void SetSourceUniforms(GLuint program, const RenderTarget& source, int width, int height)
+  {
+    GLint maxCoordLoc = glGetUniformLocation(program, "maxCoord");
+    glUniform2f(maxCoordLoc,
+                (width - 0.5f) / source.width,
+                (height - 0.5f) / source.height);
+  }
+
+
+  void ReadBloomTimer(BloomData* bloom)
+  {
+    if (!bloom->timerPending)
+      return;
+
+    GLint available = 0;
+    glGetQueryObjectiv(bloom->timerQueryIDs[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      return;
+
+    GLuint64 start = 0, end = 0;
+    glGetQueryObjectui64v(bloom->timerQueryIDs[0], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(bloom->timerQueryIDs[1], GL_QUERY_RESULT, &end);
+    bloom->lastTime = (end - start) / 1000000.0;
+    bloom->timerPending = false;
+  }
+
+
+  // Frees the levels from first down to the bottom of the chain.
+  void FreeBloomLevels(BloomData* bloom, int first)
+  {
+    for (int i = first; i < kMaxBloomLevels; ++i) {
+      DestroyRenderTarget(&bloom->levels[i].target);
+      DestroyRenderTarget(&bloom->levels[i].scratch);
+    }
+    if (first == 0) {
+      bloom->allocatedShift = -1;
+      bloom->allocatedLevels = 0;
+    }
+  }
+
+} // namespace cat
+
@@ -0,0 +1,57 @@
+#ifndef cat_bloom_h
+#define cat_bloom_h
+
+namespace cat {
+
+  //
+  // Forward type declarations
+  //
+
+  struct BloomData; // Opaque; see bloom.cpp for details.
+  struct RenderTarget;
+
+
+  //
+  // Types
+  //
+
+  // Each tier trades blur radius for cost. Every tier works at half resolution
+  // or less, so even the highest costs well under a full-resolution pass.
+  enum BloomQuality {
+    eBloomOff,
+    eBloomLow,      // Quarter resolution, 2 mip levels.
+    eBloomMedium,   // Half resolution, 3 mip levels.
+    eBloomHigh,     // Half resolution, 5 mip levels.
+
+    eBloomQualityCount  // Sentinel value.
+  };
+
+
+  //
+  // Functions
+  //
+
+  // Must be called with a current GL context. Returns NULL if the shaders
+  // couldn't be compiled, in which case bloom is simply skipped. Pass true for
+  // useTimestamps if the driver supports GL_TIMESTAMP queries (from
+  // GL_ARB_timer_query); otherwise the bloom pass won't be timed.
+  BloomData* CreateBloom(bool useTimestamps);
+  void DestroyBloom(BloomData* bloom);
+
+  // Extracts the bright parts of the scene, blurs them down and back up a mip
+  // chain, and adds the result back into the scene. Only the bottom-left
+  // sceneWidth x sceneHeight pixels of the scene target are used. Leaves the
+  // scene target bound, with its viewport restored.
+  void ApplyBloom(BloomData* bloom, BloomQuality quality,
+                  const RenderTarget& scene, int sceneWidth, int sceneHeight);
+
+  // GPU time for the most recently measured bloom pass, in milliseconds, or
+  // a negative value if nothing's been measured yet.
+  double BloomTime(const BloomData* bloom);
+
+  const char* BloomQualityName(BloomQuality quality);
+
+} // namespace cat
+
+#endif // cat_bloom_h
+
@@ -1,14 +1,27 @@
 #include "drawing.h"
 
+#include "assetwatch.h"
+#include "atomic.h"
+#include "bloom.h"
+#include "framestate.h"
 #include "gamedata.h"
+#include "glstate.h"
 #include "image.h"
 #include "level.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "rendertarget.h"
 #include "resource.h"
+#include "texturecache.h"
+#include "texturestream.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
+#include <unistd.h>
 
 #define GL_GLEXT_PROTOTYPES 1
 #ifdef linux
@@ -29,11 +42,62 @@ namespace cat {
 
   static const float kFloorZ = -1;
   static const float kPlayerZ = -0.5;
+  static const float kOpponentZ = -0.6;
+
+  // The other player in a versus game is drawn see-through.
+  static const float kOpponentAlpha = 0.5f;
   static const float kAtomZ = -0.2;
   static const float kTextZ = -0.1;
 
   static const float kCharHeight = 21;
 
+  static const unsigned int kMaxSprites = kMaxAtoms + kMaxEffectParticles;
+
+  // Built from the resource images by tools/bakeassets.cpp.
+  static const char* kTexturePackName = "textures.pack";
+
+  // Video memory we allow textures to use before unused ones get evicted.
+  static const size_t kTextureBudget = 64 * 1024 * 1024;
+
+  // The art gets edited in the source tree's resource directory, but the game
+  // reads the copy which the build stages next to the executable. The
+  // Makefile passes in the source directory's path, so that's the one we
+  // watch for changes whenever it's there.
+#ifdef CAT_SOURCE_RESOURCE_DIR
+  static const char* kSourceResourceDir = CAT_SOURCE_RESOURCE_DIR;
+#else
+  static const char* kSourceResourceDir = NULL;
+#endif
+
+  // Fraction of the time between two rendered frames during which the
+  // virtual shutter is open. Atoms get stretched along their direction of
+  // travel by the distance they move in this time.
+  static const double kShutterFraction = 1.0;
+
+  // Without timer queries the resolution follows the time between frames
+  // instead, which can't drop below the display's refresh interval when
+  // vsync is on. So the budget allows for a little over one refresh at
+  // 60Hz, and anything comfortably inside it counts as room to try a higher
+  // resolution.
+  static const double kFallbackSceneBudget = 1000.0 / 60.0 * 1.2;
+  static const double kFallbackHeadroom = 0.9;
+
+  // Streaks never get longer than this many simulation steps' worth of
+  // movement, even if the renderer has fallen a long way behind.
+  static const long kMaxStreakSteps = 4;
+
+  // The performance overlay works out its percentiles from this many frames
+  // (about ten seconds' worth), and graphs the most recent kPerfGraphFrames.
+  static const unsigned int kPerfHistory = 600;
+  static const unsigned int kPerfGraphFrames = 120;
+  // Frame time at the top of the graph, and the one we're aiming for, in
+  // milliseconds.
+  static const double kPerfGraphMaxTime = 50.0;
+  static const double kPerfTargetTime = 1000.0 / 60.0;
+  // Size of the graph, in pixels.
+  static const float kPerfGraphWidth = kPerfGraphFrames * 2;
+  static const float kPerfGraphHeight = 80;
+
 
   //
   // Types
@@ -47,16 +111,81 @@ namespace cat {
   };
 
 
+  // Vertex data for drawing a set of textured, coloured quads with a single
+  // call.
+  struct SpriteBatch {
+    unsigned int count;
+    GLfloat vertices[kMaxSprites * 4 * 3];
+    GLfloat texCoords[kMaxSprites * 4 * 2];
+    GLubyte colours[kMaxSprites * 4 * 4];
+
+    SpriteBatch();
+  };
+
+
+  // Recent frame timings for the performance overlay, in milliseconds.
+  struct PerfHistory {
+    double frameTime[kPerfHistory];  // Ring buffer of whole frame times.
+    unsigned int next;
+    unsigned int count;
+    // For the last frame only.
+    double drawTime;
+    double swapTime;
+
+    PerfHistory();
+  };
+
+
   struct DrawingData {
-    GLuint floorTextureID;
-    GLuint playerFrontTextureID[ePowerUpCount];
-    GLuint playerBackTextureID[ePowerUpCount];
-    GLuint particleTextureID;
-    GLuint titleTextureID;
+    TextureCache* textures;
+    CachedTexture* floorTexture;
+    CachedTexture* playerFrontTexture[ePowerUpCount];
+    CachedTexture* playerBackTexture[ePowerUpCount];
+    CachedTexture* particleTexture;
+    CachedTexture* titleTexture;
 
     GLuint collisionQueryID;
     GLuint maxPixelsDrawn;
 
+    // The scene is drawn into this at a fraction of the window resolution,
+    // then scaled up to fill the window.
+    RenderTarget scene;
+    ResolutionScaler scaler;
+    int sceneWidth;
+    int sceneHeight;
+
+    // Measures how long the GPU spends on the scene. If timer queries aren't
+    // supported the scaler gets the frame times from RecordFrameTimes
+    // instead, since waiting for the GPU with glFinish() every frame would
+    // slow down exactly the drivers which need the help.
+    bool hasTimerQuery;
+    bool timerQueryActive;
+    bool timerQueryPending;
+    GLuint timerQueryID;
+
+    // Post-process glow around the atoms. NULL if the shaders aren't supported.
+    BloomData* bloom;
+    BloomQuality bloomQuality;
+
+    // Atoms and effect particles are drawn as quads stretched along their
+    // velocity, none of which write depth. The atoms' unstretched footprints
+    // go in a batch of their own which writes only depth, for the collision
+    // query.
+    SpriteBatch atomSprites;
+    SpriteBatch atomFootprints;
+    SpriteBatch effectSprites;
+    // The simulation step of the last frame drawn, for working out how far
+    // the atoms have moved since.
+    long lastFrameNumber;
+
+    // Uploads textures loaded while the game is running, a bit each frame.
+    TextureStreamer* streamer;
+    // Reloads textures when their files change. NULL if not supported.
+    AssetWatcher* watcher;
+
+    bool showPerfOverlay;
+    PerfHistory perf;
+
     DrawingData();
     ~DrawingData();
   };
@@ -66,28 +195,86 @@ namespace cat {
   // Forward declarations
   //
 
-  GLuint UploadTexture(const char* filename);
-  void DrawQuad(double x, double y, double z, double w, double h, GLuint textureID);
-  void DrawText(double x, double y, const char* text, StringAlignment alignment);
+  void AddStreakSprite(SpriteBatch& batch, const Vec2& pos, const Vec2& delta,
+                       double size, int viewWidth, int viewHeight, float z,
+                       unsigned int colour = 0xFFFFFF, float alpha = 1.0f);
+  void DrawSpriteBatch(const SpriteBatch& batch, GLuint textureID);
+  void ReloadChangedTextures(DrawingData* draw);
+  bool HasExtension(const char* name);
+  void DrawQuad(double x, double y, double z, double w, double h, GLuint textureID,
+                float alpha = 1.0f);
+  void DrawText(const WindowData& win, double x, double y, const char* text, StringAlignment alignment);
+  void DrawPerfGraph(const PerfHistory& perf, float left, float bottom);
+  double PerfPercentile(const PerfHistory& perf, double fraction);
   float StringWidth(void* font, const char* text);
   bool CheckGLError(const char *errMsg);
 
 
+  //
+  // Global variables
+  //
+
+  static Metric* gTextureMemoryMetric = RegisterGauge(
+      "cat_memory_bytes", "Memory in use, by subsystem.", "subsystem=\"textures\"");
+
+
+  //
+  // SpriteBatch public methods
+  //
+
+  SpriteBatch::SpriteBatch() :
+    count(0)
+  {
+    // Every quad uses the same texture coordinates, so fill them in once.
+    const GLfloat kQuadTexCoords[] = { 0, 0,  1, 0,  1, 1,  0, 1 };
+    for (unsigned int i = 0; i < kMaxSprites; ++i)
+      std::copy(kQuadTexCoords, kQuadTexCoords + 8, texCoords + i * 8);
+  }
+
+
+  //
+  // PerfHistory public methods
+  //
+
+  PerfHistory::PerfHistory() :
+    next(0),
+    count(0),
+    drawTime(0),
+    swapTime(0)
+  {
+  }
+
+
   //
   // DrawingData public methods
   //
 
   DrawingData::DrawingData() :
-    floorTextureID(0),
-    particleTextureID(0),
-    titleTextureID(0),
+    textures(NULL),
+    floorTexture(NULL),
+    particleTexture(NULL),
+    titleTexture(NULL),
     collisionQueryID(0),
-    maxPixelsDrawn(0)
+    maxPixelsDrawn(0),
+    scene(),
+    scaler(),
+    sceneWidth(0),
+    sceneHeight(0),
+    hasTimerQuery(false),
+    timerQueryActive(false),
+    timerQueryPending(false),
+    timerQueryID(0),
+    bloom(NULL),
+    bloomQuality(eBloomMedium),
+    atomSprites(),
+    atomFootprints(),
+    effectSprites(),
+    lastFrameNumber(-1),
+    streamer(NULL),
+    watcher(NULL),
+    showPerfOverlay(false),
+    perf()
   {
-    // Load the floor texture.
-    floorTextureID = UploadTexture(ResourcePath("Floor.tga"));
-
-    // Load the player textures.
     const char* frontTexturePaths[] = {
       "Player_Front_NoPowerup.tga",
       "Player_Front_Superposition.tga",
@@ -100,36 +287,79 @@ namespace cat {
       "Player_Back_Entangling.tga",
       "Player_Back_Entanglement.tga"
     };
+
+    const char* paths[3 + ePowerUpCount * 2] = {
+      "Floor.tga",
+      "Particle.tga",
+      "TitleScreen.tga"
+    };
+    unsigned int numPaths = 3;
     for (int p = ePowerUpNone; p < ePowerUpCount; ++p) {
-      playerFrontTextureID[p] = UploadTexture(ResourcePath(frontTexturePaths[p]));
-      playerBackTextureID[p] = UploadTexture(ResourcePath(backTexturePaths[p]));
+      paths[numPaths++] = frontTexturePaths[p];
+      paths[numPaths++] = backTexturePaths[p];
     }
 
-    // Load the particle textures.
-    particleTextureID = UploadTexture(ResourcePath("Particle.tga"));
+    // Textures come out of the prebaked pack where possible; anything else
+    // gets decoded from the source images in parallel.
+    textures = CreateTextureCache(kTextureBudget, kTexturePackName);
+    CachedTexture* loaded[3 + ePowerUpCount * 2];
+    AcquireTextures(textures, paths, numPaths, loaded);
 
-    // Load the title screen texture.
-    titleTextureID = UploadTexture(ResourcePath("TitleScreen.tga"));
+    floorTexture = loaded[0];
+    particleTexture = loaded[1];
+    titleTexture = loaded[2];
+    for (int p = ePowerUpNone; p < ePowerUpCount; ++p) {
+      playerFrontTexture[p] = loaded[3 + p * 2];
+      playerBackTexture[p] = loaded[4 + p * 2];
+    }
 
     // Create a query object which we'll use for collision detection.
     glGenQueries(1, &collisionQueryID);
+
+    // And one for timing the scene, if the driver supports it.
+    hasTimerQuery = HasExtension("GL_ARB_timer_query") || HasExtension("GL_EXT_timer_query");
+    if (hasTimerQuery) {
+      glGenQueries(1, &timerQueryID);
+    }
+    else {
+      scaler.budget = kFallbackSceneBudget;
+      scaler.headroom = kFallbackHeadroom;
+    }
+
+    bloom = CreateBloom(HasExtension("GL_ARB_timer_query"));
+    if (bloom == NULL)
+      fprintf(stderr, "Bloom is not supported, disabling it.\n");
+
+    streamer = CreateTextureStreamer(HasExtension("GL_ARB_pixel_buffer_object"),
+                                     HasExtension("GL_ARB_sync"));
+    SetTextureStreamer(textures, streamer);
+    // A texture reloaded from the source directory which later gets evicted
+    // comes back from the staged copy, until the next build updates that.
+    if (kSourceResourceDir != NULL && access(kSourceResourceDir, R_OK) == 0)
+      watcher = StartAssetWatcher(kSourceResourceDir);
+    else
+      watcher = StartAssetWatcher(ResourceDir());
   }
 
 
   DrawingData::~DrawingData()
   {
-    if (floorTextureID)
-      glDeleteTextures(1, &floorTextureID);
+    ReleaseTexture(textures, floorTexture);
     for (int p = ePowerUpNone; p < ePowerUpCount; ++p) {
-      if (playerFrontTextureID[p])
-        glDeleteTextures(1, &playerFrontTextureID[p]);
-      if (playerBackTextureID[p])
-        glDeleteTextures(1, &playerBackTextureID[p]);
+      ReleaseTexture(textures, playerFrontTexture[p]);
+      ReleaseTexture(textures, playerBackTexture[p]);
     }
-    if (particleTextureID)
-      glDeleteTextures(1, &particleTextureID);
+    ReleaseTexture(textures, particleTexture);
+    ReleaseTexture(textures, titleTexture);
+    DestroyTextureCache(textures);
     if (collisionQueryID)
       glDeleteQueries(1, &collisionQueryID);
+    if (timerQueryID)
+      glDeleteQueries(1, &timerQueryID);
+    StopAssetWatcher(watcher);
+    DestroyTextureStreamer(streamer);
+    DestroyBloom(bloom);
+    DestroyRenderTarget(&scene);
   }
 
 
@@ -139,27 +369,143 @@ namespace cat {
 
   void InitDrawing(GameData* game)
   {
-    glEnable(GL_DEPTH_TEST);
+    ResetStateCache();
+    SetCapability(GL_DEPTH_TEST, true);
     assert(game->draw == NULL);
     game->draw = new DrawingData();
   }
 
 
+  void BeginScene(GameData* game)
+  {
+    PROFILE_ZONE("BeginScene");
+
+    assert(game != NULL);
+    assert(game->draw != NULL);
+
+    DrawingData* draw = game->draw;
+    WindowData& win = game->window;
+
+    if (draw->scene.width != win.width || draw->scene.height != win.height)
+      CreateRenderTarget(&draw->scene, win.width, win.height, true);
+
+    draw->sceneWidth = std::max(1, int(win.width * draw->scaler.scale));
+    draw->sceneHeight = std::max(1, int(win.height * draw->scaler.scale));
+
+    BeginGLStatsFrame();
+    SetGauge(gTextureMemoryMetric, TextureBytesUsed(draw->textures));
+    ReloadChangedTextures(draw);
+    UpdateTextureStreamer(draw->streamer);
+    UseWorldProjection();
+
+    // The overlays drawn after the last scene may have changed these, and the
+    // collision query depends on the atoms being depth tested.
+    BindRenderTarget(&draw->scene);
+    SetViewport(0, 0, draw->sceneWidth, draw->sceneHeight);
+    SetCapability(GL_DEPTH_TEST, true);
+    SetDepthMask(true);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    if (draw->hasTimerQuery && !draw->timerQueryPending) {
+      glBeginQuery(GL_TIME_ELAPSED_EXT, draw->timerQueryID);
+      draw->timerQueryActive = true;
+      draw->timerQueryPending = true;
+    }
+  }
+
+
+  void EndScene(GameData* game)
+  {
+    PROFILE_ZONE("EndScene");
+
+    assert(game != NULL);
+    assert(game->draw != NULL);
+
+    DrawingData* draw = game->draw;
+    WindowData& win = game->window;
+
+    // Work out how long the scene took. Timer query results arrive a frame or
+    // two late; we don't wait for them.
+    double sceneTime = -1;
+    if (draw->hasTimerQuery) {
+      if (draw->timerQueryActive) {
+        glEndQuery(GL_TIME_ELAPSED_EXT);
+        draw->timerQueryActive = false;
+      }
+
+      GLint available = 0;
+      glGetQueryObjectiv(draw->timerQueryID, GL_QUERY_RESULT_AVAILABLE, &available);
+      if (available) {
+        GLuint64EXT nanoseconds = 0;
+        glGetQueryObjectui64vEXT(draw->timerQueryID, GL_QUERY_RESULT, &nanoseconds);
+        sceneTime = nanoseconds / 1000000.0;
+        draw->timerQueryPending = false;
+      }
+    }
+
+    // Pixel counts for the collision query change with the resolution, so
+    // start measuring afresh whenever it changes.
+    if (sceneTime >= 0 && draw->scaler.update(sceneTime))
+      draw->maxPixelsDrawn = 0;
+
+    // Scale the scene up to fill the window.
+    float maxS = float(draw->sceneWidth) / draw->scene.width;
+    float maxT = float(draw->sceneHeight) / draw->scene.height;
+
+    BindRenderTarget(NULL);
+    SetViewport(0, 0, win.width, win.height);
+    UseWorldProjection();
+    SetCapability(GL_DEPTH_TEST, false);
+    SetCapability(GL_BLEND, false);
+    SetCapability(GL_TEXTURE_2D, true);
+    SetTexEnvMode(GL_MODULATE);
+    SetColor(1, 1, 1);
+    BindTexture(draw->scene.colorTextureID);
+
+    CountDrawCalls();
+    glBegin(GL_QUADS);
+      glTexCoord2f(0, 0);
+      glVertex3d(0, 0, kFloorZ);
+
+      glTexCoord2f(maxS, 0);
+      glVertex3d(1, 0, kFloorZ);
+
+      glTexCoord2f(maxS, maxT);
+      glVertex3d(1, 1, kFloorZ);
+
+      glTexCoord2f(0, maxT);
+      glVertex3d(0, 1, kFloorZ);
+    glEnd();
+
+    // Text and other overlays get drawn at full resolution on top.
+    SetCapability(GL_DEPTH_TEST, true);
+    SetDepthMask(true);
+    glClear(GL_DEPTH_BUFFER_BIT);
+  }
+
+
   void DrawPlayArea(GameData* game)
   {
+    PROFILE_ZONE("DrawPlayArea");
+
     assert(game != NULL);
     assert(game->draw != NULL);
 
-    DrawQuad(0, 0, kFloorZ, 1, 1, game->draw->floorTextureID);
+    SetCapability(GL_BLEND, false);
+    DrawQuad(0, 0, kFloorZ, 1, 1, TextureID(game->draw->floorTexture));
   }
 
 
-  void DrawPlayer(GameData* game)
+  void DrawPlayer(GameData* game, const FrameState* frame)
   {
+    PROFILE_ZONE("DrawPlayer");
+
     assert(game != NULL);
     assert(game->draw != NULL);
+    assert(frame != NULL);
 
-    PlayerData& player = game->player;
+    const PlayerData& player = frame->player;
     DrawingData* draw = game->draw;
 
     Vec2 bottomLeft = player.position - player.size / 2.0;
@@ -167,15 +513,16 @@ namespace cat {
     GLuint textureID;
     switch (player.view) {
       case ePlayerFront:
-        textureID = draw->playerFrontTextureID[player.powerUp];
+        textureID = TextureID(draw->playerFrontTexture[player.powerUp]);
         break;
       case ePlayerBack:
-        textureID = draw->playerBackTextureID[player.powerUp];
+        textureID = TextureID(draw->playerBackTexture[player.powerUp]);
         break;
     }
 
     // Keep track of how many pixels are drawn for the player. If this is less
     // than normal it means the player's hit something.
+    SetCapability(GL_BLEND, false);
     glBeginQuery(GL_SAMPLES_PASSED, draw->collisionQueryID);
     DrawQuad(bottomLeft.x, bottomLeft.y, kPlayerZ, player.size.x, player.size.y, textureID);
     glEndQuery(GL_SAMPLES_PASSED);
@@ -184,167 +531,362 @@ namespace cat {
     glGetQueryObjectuiv(draw->collisionQueryID, GL_QUERY_RESULT, &pixelsDrawn);
 
     // On first frame, the player will be unobscured so the value should only
-    // ever go down when a particle obscures part of the player.
+    // ever go down when a particle obscures part of the player. The
+    // simulation thread picks the collision up on its next step.
     if (pixelsDrawn > draw->maxPixelsDrawn)
       draw->maxPixelsDrawn = pixelsDrawn; 
     else if (pixelsDrawn < draw->maxPixelsDrawn)
-      player.collision = true;
+      AtomicMax(&game->collisionFrame, frame->frameNumber);
+
+    // Behind the player, so it can't hide any of their pixels from the query.
+    if (frame->versus) {
+      const PlayerData& opponent = frame->opponent;
+      bottomLeft = opponent.position - opponent.size / 2.0;
+      textureID = (opponent.view == ePlayerBack) ?
+          TextureID(draw->playerBackTexture[opponent.powerUp]) :
+          TextureID(draw->playerFrontTexture[opponent.powerUp]);
+
+      SetCapability(GL_BLEND, true);
+      SetBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+      DrawQuad(bottomLeft.x, bottomLeft.y, kOpponentZ, opponent.size.x, opponent.size.y,
+               textureID, kOpponentAlpha);
+    }
   }
 
 
-  void DrawAtoms(GameData* game)
+  void DrawAtoms(GameData* game, const FrameState* frame)
   {
+    PROFILE_ZONE("DrawAtoms");
+
     assert(game != NULL);
     assert(game->draw != NULL);
+    assert(frame != NULL);
+
+    // Sizes are in pixels, so they have to follow the scene resolution.
+    DrawingData* draw = game->draw;
+    double atomSize = std::min(draw->sceneWidth, draw->sceneHeight) * kAtomSize;
+    if (atomSize < 1)
+      atomSize = 1;
+
+    // Work out how many simulation steps the atoms have moved through since
+    // the last frame we drew. They don't move at all while paused.
+    long steps = frame->frameNumber - draw->lastFrameNumber;
+    if (steps < 1 || draw->lastFrameNumber < 0)
+      steps = 1;
+    else if (steps > kMaxStreakSteps)
+      steps = kMaxStreakSteps;
+    draw->lastFrameNumber = frame->frameNumber;
+    double shutter = (frame->gameState == eGamePaused) ? 0.0 : steps * kShutterFraction;
+
+    SpriteBatch& batch = draw->atomSprites;
+    SpriteBatch& footprints = draw->atomFootprints;
+    batch.count = 0;
+    footprints.count = 0;
+    if (frame->hasLevel) {
+      for (unsigned int i = 0; i < frame->atomCount; ++i) {
+        AddStreakSprite(batch, frame->atomPosition[i], frame->atomVelocity[i] * shutter,
+                        atomSize, draw->sceneWidth, draw->sceneHeight, kAtomZ);
+        AddStreakSprite(footprints, frame->atomPosition[i], Vec2(),
+                        atomSize, draw->sceneWidth, draw->sceneHeight, kAtomZ);
+      }
+    }
+
+    // The streaks are only for show. If they wrote depth, DrawPlayer's
+    // collision query would count hits on where an atom was rather than
+    // where it is, and more so the lower the frame rate. So the depth comes
+    // from each atom's unstretched footprint instead, drawn afterwards so
+    // that it can't hide the streaks.
+    SetCapability(GL_BLEND, true);
+    SetBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    SetDepthMask(false);
+    DrawSpriteBatch(batch, TextureID(draw->particleTexture));
+    SetDepthMask(true);
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    DrawSpriteBatch(footprints, TextureID(draw->particleTexture));
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    // Effect particles fade out over their lifetime. They mustn't write depth
+    // either: a power-up burst starts right on the player, and would cost a
+    // life.
+    SpriteBatch& effectBatch = draw->effectSprites;
+    effectBatch.count = 0;
+    const EffectParticles& effects = frame->effects;
+    for (unsigned int i = 0; i < effects.count; ++i) {
+      Vec2 pos(effects.x[i], effects.y[i]);
+      Vec2 delta(effects.vx[i] * shutter, effects.vy[i] * shutter);
+      float alpha = 1.0f - effects.age[i] / effects.lifetime[i];
+      AddStreakSprite(effectBatch, pos, delta, atomSize * effects.size[i],
+                      draw->sceneWidth, draw->sceneHeight, kAtomZ,
+                      effects.colour[i], alpha);
+    }
+
+    SetDepthMask(false);
+    DrawSpriteBatch(effectBatch, TextureID(draw->particleTexture));
+    SetDepthMask(true);
+  }
+
+
+  void DrawBloom(GameData* game)
+  {
+    PROFILE_ZONE("DrawBloom");
 
-    if (game->currentLevel == game->levels.end())
+    assert(game != NULL);
+    assert(game->draw != NULL);
+
+    DrawingData* draw = game->draw;
+    ApplyBloom(draw->bloom, draw->bloomQuality, draw->scene, draw->sceneWidth, draw->sceneHeight);
+  }
+
+
+  void CycleBloomQuality(GameData* game)
+  {
+    assert(game != NULL);
+    assert(game->draw != NULL);
+
+    DrawingData* draw = game->draw;
+    if (draw->bloom == NULL)
       return;
 
-    Level& level = *game->currentLevel;
-    WindowData& win = game->window;
+    draw->bloomQuality = BloomQuality((draw->bloomQuality + 1) % eBloomQualityCount);
+    fprintf(stderr, "Bloom quality: %s\n", BloomQualityName(draw->bloomQuality));
+  }
 
-    GLfloat atomSize = std::min(win.width, win.height) * kAtomSize;
-    if (atomSize < 1)
-      atomSize = 1;
-    glPointSize(atomSize);
 
-    glEnable(GL_TEXTURE_2D);
-    glEnable(GL_POINT_SPRITE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  void TogglePerfOverlay(GameData* game)
+  {
+    assert(game != NULL);
+    assert(game->draw != NULL);
+
+    game->draw->showPerfOverlay = !game->draw->showPerfOverlay;
+  }
+
 
-    glBindTexture(GL_TEXTURE_2D, game->draw->particleTextureID);
-    glTexEnvi(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_TRUE);
+  void RecordFrameTimes(GameData* game, double frameTime, double drawTime, double swapTime)
+  {
+    assert(game != NULL);
+    assert(game->draw != NULL);
 
-    glBegin(GL_POINTS);
-    for (unsigned int i = 0; i < level.atomCount; ++i)
-      glVertex3d(level.position[i].x, level.position[i].y, kAtomZ);
+    PerfHistory& perf = game->draw->perf;
+    perf.frameTime[perf.next] = frameTime;
+    perf.next = (perf.next + 1) % kPerfHistory;
+    if (perf.count < kPerfHistory)
+      ++perf.count;
+    perf.drawTime = drawTime;
+    perf.swapTime = swapTime;
+
+    DrawingData* draw = game->draw;
+    if (!draw->hasTimerQuery && draw->scaler.update(frameTime))
+      draw->maxPixelsDrawn = 0;
+  }
+
+
+  void DrawPerfOverlay(GameData* game, const FrameState* frame)
+  {
+    PROFILE_ZONE("DrawPerfOverlay");
+
+    assert(game != NULL);
+    assert(game->draw != NULL);
+    assert(frame != NULL);
+
+    DrawingData* draw = game->draw;
+    if (!draw->showPerfOverlay)
+      return;
+
+    const WindowData& win = game->window;
+    const PerfHistory& perf = draw->perf;
+    // These are for the frame before this one, since this one isn't finished.
+    const GLStats& stats = LastFrameGLStats();
+
+    // Below the top line of the HUD.
+    const float kPadding = 6;
+    const float kNumLines = 4;
+    float left = 10;
+    float top = win.height - kCharHeight * 2 - 10;
+    float graphBottom = top - kPadding - kPerfGraphHeight;
+    float bottom = graphBottom - kPadding - kCharHeight * kNumLines;
+
+    // A pale backing so the text and graph show up against the floor.
+    UsePixelProjection(win.width, win.height);
+    SetCapability(GL_DEPTH_TEST, false);
+    SetCapability(GL_TEXTURE_2D, false);
+    SetCapability(GL_BLEND, true);
+    SetBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    SetColor(0.6f, 0.6f, 0.6f, 0.6f);
+    CountDrawCalls();
+    glBegin(GL_QUADS);
+      glVertex3f(left, bottom, kTextZ);
+      glVertex3f(left + kPerfGraphWidth + kPadding * 2, bottom, kTextZ);
+      glVertex3f(left + kPerfGraphWidth + kPadding * 2, top, kTextZ);
+      glVertex3f(left, top, kTextZ);
     glEnd();
 
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glDisable(GL_TEXTURE_2D);
-    glDisable(GL_POINT_SPRITE);
-    glDisable(GL_BLEND);
+    DrawPerfGraph(perf, left + kPadding, graphBottom);
+
+    double lastFrameTime = perf.frameTime[(perf.next + kPerfHistory - 1) % kPerfHistory];
+    double bloomTime = (draw->bloom != NULL) ? BloomTime(draw->bloom) : -1;
+    char msg[1024];
+    snprintf(msg, sizeof(msg),
+             "Frame %1.1lfms   p99 %1.1lfms\n"
+             "Update %1.2lfms   Render %1.2lfms   Swap %1.2lfms\n"
+             "Atoms %u   Draws %u   Binds %u\n"
+             "Bloom %s %1.2lfms   Textures %1.1lfMB",
+             perf.count > 0 ? lastFrameTime : 0.0, PerfPercentile(perf, 0.99),
+             frame->stepTime, perf.drawTime, perf.swapTime,
+             frame->atomCount, stats.drawCalls, stats.textureBinds,
+             BloomQualityName(draw->bloomQuality), bloomTime > 0 ? bloomTime : 0.0,
+             TextureBytesUsed(draw->textures) / (1024.0 * 1024.0));
+    DrawText(win, left + kPadding, graphBottom - kPadding - kCharHeight + 5, msg, eAlignLeft);
+    SetCapability(GL_DEPTH_TEST, true);
   }
 
 
-  void DrawHUD(GameData* game)
+  void DrawHUD(GameData* game, const FrameState* frame)
   {
+    PROFILE_ZONE("DrawHUD");
+
     assert(game != NULL);
     assert(game->draw != NULL);
+    assert(frame != NULL);
 
-    if (game->currentLevel == game->levels.end())
+    if (!frame->hasLevel)
       return;
 
-    Level& level = *game->currentLevel;
     WindowData& win = game->window;
 
     float top = win.height - kCharHeight - 10;
     float bottom = 10 + kCharHeight;
     char msg[1024];
-    double timeElapsed = game->gameTime - game->stateChangeTime;
-    double timeLeft = level.duration - timeElapsed;
+    double timeElapsed = frame->gameTime - frame->stateChangeTime;
+    double timeLeft = frame->levelDuration - timeElapsed;
 
     snprintf(msg, 1024, "Remaining %1.2lfs", timeLeft / 1000.0);
-    DrawText(10, top, msg, eAlignLeft);
+    DrawText(win, 10, top, msg, eAlignLeft);
 
-    snprintf(msg, 1024, "%d lives", game->player.livesRemaining);
-    DrawText(10, top, msg, eAlignRight);
+    if (frame->versus)
+      snprintf(msg, 1024, "%d lives\nOpponent: %d lives",
+               frame->player.livesRemaining, frame->opponent.livesRemaining);
+    else
+      snprintf(msg, 1024, "%d lives", frame->player.livesRemaining);
+    DrawText(win, 10, top, msg, eAlignRight);
 
     //snprintf(msg, 1024, "Superposition: %d\nEntanglement: %d",
-    //         game->player.superpositionsRemaining,
-    //         game->player.entanglementsRemaining);
+    //         frame->player.superpositionsRemaining,
+    //         frame->player.entanglementsRemaining);
     snprintf(msg, 1024, "Superposition: %d",
-             game->player.superpositionsRemaining);
-    DrawText(10, bottom, msg, eAlignLeft);
+             frame->player.superpositionsRemaining);
+    DrawText(win, 10, bottom, msg, eAlignLeft);
   }
 
 
   void DrawTitles(GameData* game)
   {
+    PROFILE_ZONE("DrawTitles");
+
     assert(game != NULL);
     assert(game->draw != NULL);
 
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    DrawQuad(0.1, 0.5, kTextZ, 0.8, 0.3, game->draw->titleTextureID);
-    glDisable(GL_BLEND);
+    SetCapability(GL_BLEND, true);
+    SetBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    DrawQuad(0.1, 0.5, kTextZ, 0.8, 0.3, TextureID(game->draw->titleTexture));
 
     float y = game->window.height / 3.0;
 
-    //DrawText(0, y, "(c) Vilya Harvey, 2011", eAlignCenter);
+    //DrawText(game->window, 0, y, "(c) Vilya Harvey, 2011", eAlignCenter);
     //y -= kCharHeight * 2;
-    DrawText(0, y, "Dedicated to William Harvey and his family", eAlignCenter);
+    DrawText(game->window, 0, y, "Dedicated to William Harvey and his family", eAlignCenter);
     y -= kCharHeight * 2;
-    DrawText(0, y, "Press [space] to start, [esc] to quit", eAlignCenter);
+    DrawText(game->window, 0, y, "Press [space] to start, [esc] to quit", eAlignCenter);
   }
 
 
-  void DrawGameOver(GameData* game)
+  void DrawGameOver(GameData* game, const FrameState* frame)
   {
+    PROFILE_ZONE("DrawGameOver");
+
     assert(game != NULL);
     assert(game->draw != NULL);
+    assert(frame != NULL);
 
     float y = (game->window.height - kCharHeight) / 2.0;
-    DrawText(0, y, "GAME OVER\nPress [space] to try again, [esc] to quit", eAlignCenter);
+    if (!frame->versus) {
+      DrawText(game->window, 0, y, "GAME OVER\nPress [space] to try again, [esc] to quit", eAlignCenter);
+      return;
+    }
+
+    const char* result = "DRAW";
+    if (frame->player.livesRemaining > 0)
+      result = "YOU WIN";
+    else if (frame->opponent.livesRemaining > 0)
+      result = "YOU LOSE";
+    char msg[256];
+    snprintf(msg, 256, "GAME OVER - %s\nPress [esc] to quit", result);
+    DrawText(game->window, 0, y, msg, eAlignCenter);
   }
 
 
   void DrawPause(GameData* game)
   {
+    PROFILE_ZONE("DrawPause");
+
     assert(game != NULL);
     assert(game->draw != NULL);
 
     float y = (game->window.height - kCharHeight) / 2.0;
-    DrawText(0, y, "PAUSED\nPress [space] to continue, [esc] to quit", eAlignCenter);
+    DrawText(game->window, 0, y, "PAUSED\nPress [space] to continue, [esc] to quit", eAlignCenter);
   }
 
 
   void DrawLevelComplete(GameData* game)
   {
+    PROFILE_ZONE("DrawLevelComplete");
+
     assert(game != NULL);
     assert(game->draw != NULL);
 
     float y = (game->window.height - kCharHeight) / 2.0;
-    DrawText(0, y, "Level complete!", eAlignCenter);
+    DrawText(game->window, 0, y, "Level complete!", eAlignCenter);
   }
 
 
-  void DrawLevelCountdown(GameData* game)
+  void DrawLevelCountdown(GameData* game, const FrameState* frame)
   {
+    PROFILE_ZONE("DrawLevelCountdown");
+
     assert(game != NULL);
     assert(game->draw != NULL);
+    assert(frame != NULL);
 
-    if (game->currentLevel == game->levels.end())
+    if (!frame->hasLevel)
       return;
 
-    Level& level = *game->currentLevel;
-    float timeLeft = (game->stateChangeTime + 3000.0 - game->gameTime) / 1000.0;
+    float timeLeft = (frame->stateChangeTime + 3000.0 - frame->gameTime) / 1000.0;
     char timeLeftStr[256];
     snprintf(timeLeftStr, 256, "%d...", int(ceil(timeLeft)));
 
     float y = (game->window.height - kCharHeight * 2) * 2.0 / 3.0;
 
-    DrawText(0, y, level.name.c_str(), eAlignCenter);
+    DrawText(game->window, 0, y, frame->levelName, eAlignCenter);
     y -= kCharHeight;
-    DrawText(0, y, timeLeftStr, eAlignCenter);
+    DrawText(game->window, 0, y, timeLeftStr, eAlignCenter);
   }
 
 
   void DrawVictory(GameData* game)
   {
+    PROFILE_ZONE("DrawVictory");
+
     assert(game != NULL);
     assert(game->draw != NULL);
 
     float y = (game->window.height - kCharHeight * 4) / 2.0;
-    DrawText(0, y, "You win!", eAlignCenter);
+    DrawText(game->window, 0, y, "You win!", eAlignCenter);
     y -= kCharHeight * 2;
-    DrawText(0, y, "CONGRATULATIONS!", eAlignCenter);
+    DrawText(game->window, 0, y, "CONGRATULATIONS!", eAlignCenter);
     y -= kCharHeight * 2;
-    DrawText(0, y, "Dr Schroedinger has opened the box and collapsed your waveform\n"
-                   "into one alive but very annoyed cat. Time for some revenge - let's\n"
-                   "see how HE likes it inside the box!", eAlignCenter);
+    DrawText(game->window, 0, y, "Dr Schroedinger has opened the box and collapsed your waveform\n"
+                                 "into one alive but very annoyed cat. Time for some revenge - let's\n"
+                                 "see how HE likes it inside the box!", eAlignCenter);
   }
 
 
@@ -360,97 +902,234 @@ namespace cat {
   // Internal functions
   //
 
-  GLuint UploadTexture(const char* filename)
+  // Adds a quad of the given size (in pixels) centred on pos, stretched
+  // backwards along delta so that it covers everywhere the sprite has been
+  // since it was at pos - delta. The stretch is worked out in pixel space so
+  // the sprite stays round when the view isn't square.
+  void AddStreakSprite(SpriteBatch& batch, const Vec2& pos, const Vec2& delta,
+                       double size, int viewWidth, int viewHeight, float z,
+                       unsigned int colour, float alpha)
+  {
+    if (batch.count >= kMaxSprites)
+      return;
+
+    Vec2 pixelDelta(delta.x * viewWidth, delta.y * viewHeight);
+    double streakLength = Length(pixelDelta);
+    Vec2 along = (streakLength > 0) ? pixelDelta / streakLength : Vec2(1, 0);
+    Vec2 across(-along.y, along.x);
+
+    Vec2 halfAlong = along * ((size + streakLength) / 2.0);
+    Vec2 halfAcross = across * (size / 2.0);
+    Vec2 centre = pos - delta / 2.0;
+    Vec2 toWorld(1.0 / viewWidth, 1.0 / viewHeight);
+
+    Vec2 corners[4] = {
+      centre + (Vec2() - halfAlong - halfAcross) * toWorld,
+      centre + (halfAlong - halfAcross) * toWorld,
+      centre + (halfAlong + halfAcross) * toWorld,
+      centre + (halfAcross - halfAlong) * toWorld
+    };
+
+    // Textures are premultiplied, so the vertex colour has to be too.
+    GLubyte r = GLubyte(((colour >> 16) & 0xFF) * alpha);
+    GLubyte g = GLubyte(((colour >> 8) & 0xFF) * alpha);
+    GLubyte b = GLubyte((colour & 0xFF) * alpha);
+    GLubyte a = GLubyte(alpha * 255.0f);
+
+    GLfloat* v = batch.vertices + batch.count * 12;
+    GLubyte* rgba = batch.colours + batch.count * 16;
+    for (int c = 0; c < 4; ++c) {
+      *v++ = corners[c].x;
+      *v++ = corners[c].y;
+      *v++ = z;
+      *rgba++ = r;
+      *rgba++ = g;
+      *rgba++ = b;
+      *rgba++ = a;
+    }
+    ++batch.count;
+  }
+
+
+  void DrawSpriteBatch(const SpriteBatch& batch, GLuint textureID)
+  {
+    PROFILE_ZONE("DrawSpriteBatch");
+
+    if (batch.count == 0)
+      return;
+
+    UseWorldProjection();
+    SetCapability(GL_TEXTURE_2D, true);
+    SetTexEnvMode(GL_MODULATE);
+    SetColor(1, 1, 1);
+    BindTexture(textureID);
+    SetClientArrays(true, true, true);
+
+    glVertexPointer(3, GL_FLOAT, 0, batch.vertices);
+    glTexCoordPointer(2, GL_FLOAT, 0, batch.texCoords);
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, batch.colours);
+    CountDrawCalls();
+    glDrawArrays(GL_QUADS, 0, batch.count * 4);
+
+    // GL leaves the current colour undefined after drawing with a colour array.
+    InvalidateColor();
+  }
+
+
+  // Swaps in the new version of any texture whose file has changed. The
+  // texture keeps its ID, so nothing else needs to know, and the upload is
+  // spread over the next few frames.
+  void ReloadChangedTextures(DrawingData* draw)
   {
-    Image* img = new Image(filename);
-    assert(img);
+    PROFILE_ZONE("ReloadChangedTextures");
+
+    char name[1024];
+    Image* image;
+    while ((image = NextChangedAsset(draw->watcher, name, sizeof(name))) != NULL) {
+      // The streamer regenerates the mip chain, which adds about a third.
+      size_t bytes = size_t(image->getWidth()) * image->getHeight() * image->getBytesPerPixel();
+      TextureChanged(draw->textures, name, bytes + bytes / 3);
+
+      CachedTexture* texture = FindTexture(draw->textures, name);
+      if (texture == NULL) {
+        // Not resident; it'll be loaded from the file when it's next needed.
+        delete image;
+        continue;
+      }
+      StreamTexture(draw->streamer, image, TextureID(texture));
+    }
+  }
 
-    img->uploadTexture();
-    GLuint texID = img->getTexID();
 
-    delete img;
-    return texID;
+  bool HasExtension(const char* name)
+  {
+    const char* extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+    if (extensions == NULL)
+      return false;
+
+    size_t len = strlen(name);
+    for (const char* ext = strstr(extensions, name); ext != NULL; ext = strstr(ext + len, name)) {
+      bool startsWord = (ext == extensions || ext[-1] == ' ');
+      bool endsWord = (ext[len] == ' ' || ext[len] == '\0');
+      if (startsWord && endsWord)
+        return true;
+    }
+    return false;
   }
 
 
-  void DrawQuad(double x, double y, double z, double w, double h, GLuint textureID)
+  // Texture coordinates are flipped vertically, to match the orientation of
+  // the images in our resource files.
+  // Textures are premultiplied, so fading one out scales all four channels.
+  void DrawQuad(double x, double y, double z, double w, double h, GLuint textureID,
+                float alpha)
   {
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glEnable(GL_TEXTURE_2D);
-    
-    glMatrixMode(GL_TEXTURE);
-    glPushMatrix();
-    glScalef(1, -1, 1);
+    PROFILE_ZONE("DrawQuad");
+
+    UseWorldProjection();
+    SetCapability(GL_TEXTURE_2D, true);
+    SetTexEnvMode(GL_MODULATE);
+    SetColor(alpha, alpha, alpha, alpha);
+    BindTexture(textureID);
 
+    CountDrawCalls();
     glBegin(GL_QUADS);
-      glTexCoord2f(0, 0);
+      glTexCoord2f(0, 1);
       glVertex3d(x, y, z);
 
-      glTexCoord2f(1, 0);
+      glTexCoord2f(1, 1);
       glVertex3d(x + w, y, z);
 
-      glTexCoord2f(1, 1);
+      glTexCoord2f(1, 0);
       glVertex3d(x + w, y + h, z);
 
-      glTexCoord2f(0, 1);
+      glTexCoord2f(0, 0);
       glVertex3d(x, y + h, z);
     glEnd();
-
-    // Clean-up
-    glDisable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
   }
 
   
-  void DrawText(double x, double y, const char* text, StringAlignment alignment)
+  void DrawText(const WindowData& win, double x, double y, const char* text, StringAlignment alignment)
   {
+    PROFILE_ZONE("DrawText");
+
     void* font = GLUT_BITMAP_HELVETICA_18;
     float xPos = 0;
     float yPos = 0;
 
     switch (alignment) {
       case eAlignRight:
-        x = gGameData->window.width - x - StringWidth(font, text);
+        x = win.width - x - StringWidth(font, text);
         break;
       case eAlignCenter:
-        x = (gGameData->window.width - StringWidth(font, text)) / 2.0f;
+        x = (win.width - StringWidth(font, text)) / 2.0f;
         break;
       default:
         break;
     }
 
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glLoadIdentity();
-    glOrtho(0, gGameData->window.width, 0, gGameData->window.height, 0, 4);
-
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-    glLoadIdentity();
-    glTranslatef(x, y, kTextZ);
+    // Bitmaps get textured like anything else, so make sure they aren't.
+    UsePixelProjection(win.width, win.height);
+    SetCapability(GL_TEXTURE_2D, false);
+    SetColor(0.1, 0.1, 0.1);
 
-    glColor3f(0.1, 0.1, 0.1);
     for (char* ch = const_cast<char*>(text); *ch != '\0'; ++ch) {
-      glRasterPos2f(xPos, yPos);
+      glRasterPos3f(x + xPos, y + yPos, kTextZ);
       switch (*ch) {
         case '\n':
           xPos = 0;
           yPos -= kCharHeight;
           break;
         default:
+          CountDrawCalls();
           glutBitmapCharacter(font, *ch);
           xPos +=glutBitmapWidth(font, *ch);
           break;
       }
     }
-    glColor3f(1, 1, 1);
+  }
+
+
+  // Frame times from oldest to newest, left to right, with a line across at
+  // the time we're aiming for.
+  void DrawPerfGraph(const PerfHistory& perf, float left, float bottom)
+  {
+    const float kScale = kPerfGraphHeight / kPerfGraphMaxTime;
+    const float kStep = kPerfGraphWidth / kPerfGraphFrames;
+
+    SetColor(0.0f, 0.5f, 0.0f);
+    CountDrawCalls();
+    glBegin(GL_LINES);
+      glVertex3f(left, bottom + kPerfTargetTime * kScale, kTextZ);
+      glVertex3f(left + kPerfGraphWidth, bottom + kPerfTargetTime * kScale, kTextZ);
+    glEnd();
+
+    unsigned int count = std::min(perf.count, kPerfGraphFrames);
+    if (count < 2)
+      return;
+
+    SetColor(0.7f, 0.0f, 0.0f);
+    CountDrawCalls();
+    glBegin(GL_LINE_STRIP);
+    for (unsigned int i = 0; i < count; ++i) {
+      unsigned int index = (perf.next + kPerfHistory - count + i) % kPerfHistory;
+      double time = std::min(perf.frameTime[index], kPerfGraphMaxTime);
+      glVertex3f(left + (kPerfGraphFrames - count + i) * kStep, bottom + time * kScale, kTextZ);
+    }
+    glEnd();
+  }
+
 
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
-    glPopMatrix();
+  double PerfPercentile(const PerfHistory& perf, double fraction)
+  {
+    if (perf.count == 0)
+      return 0;
+
+    double times[kPerfHistory];
+    std::copy(perf.frameTime, perf.frameTime + perf.count, times);
+    unsigned int nth = std::min(perf.count - 1, (unsigned int)(perf.count * fraction));
+    std::nth_element(times, times + nth, times + perf.count);
+    return times[nth];
   }
 
 
@@ -8,6 +8,7 @@ namespace cat {
   //
 
   struct DrawingData;
+  struct FrameState;
   struct GameData;
 
 
@@ -20,17 +21,43 @@ namespace cat {
   // the graphics API has been initialised.
   void InitDrawing(GameData* game);
 
+  // Bracket the parts of the frame which make up the game world. These are
+  // drawn offscreen at a resolution which adapts to the measured frame time
+  // and then scaled up to fill the window. Text and other overlays should be
+  // drawn after EndScene so they stay at full resolution.
+  void BeginScene(GameData* game);
+  void EndScene(GameData* game);
+
+  // These are called from the render thread. Anything which changes as the
+  // game runs must be read from the frame snapshot rather than the GameData,
+  // which belongs to the simulation thread.
   void DrawPlayArea(GameData* game);
-  void DrawAtoms(GameData* game);
-  void DrawPlayer(GameData* game);
-  void DrawHUD(GameData* game);
+  void DrawAtoms(GameData* game, const FrameState* frame);
+  void DrawPlayer(GameData* game, const FrameState* frame);
+  // Adds a glow around the bright parts of whatever's been drawn so far.
+  // Call it between BeginScene and EndScene.
+  void DrawBloom(GameData* game);
+  void DrawHUD(GameData* game, const FrameState* frame);
   void DrawTitles(GameData* game);
-  void DrawGameOver(GameData* game);
+  void DrawGameOver(GameData* game, const FrameState* frame);
   void DrawPause(GameData* game);
   void DrawLevelComplete(GameData* game);
-  void DrawLevelCountdown(GameData* game);
+  void DrawLevelCountdown(GameData* game, const FrameState* frame);
   void DrawVictory(GameData* game);
 
+  // Steps through the bloom quality tiers, wrapping back round to off.
+  void CycleBloomQuality(GameData* game);
+
+  // The performance overlay graphs recent frame times and shows where the
+  // last frame's time went. Call RecordFrameTimes once a frame, after the
+  // buffers have been swapped, whether or not the overlay is showing; all
+  // the times are in milliseconds. Without GPU timer queries, the frame
+  // times also drive the adaptive scene resolution. DrawPerfOverlay does
+  // nothing unless the overlay has been switched on.
+  void TogglePerfOverlay(GameData* game);
+  void RecordFrameTimes(GameData* game, double frameTime, double drawTime, double swapTime);
+  void DrawPerfOverlay(GameData* game, const FrameState* frame);
+
   // Callback to notify the drawing system when the window gets resized.
   void WindowResized(GameData* game);
 
@@ -0,0 +1,146 @@
+#include "effects.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace cat {
+
+  //
+  // Types
+  //
+
+  struct EffectParams {
+    unsigned int count;
+    float minSpeed;
+    float maxSpeed;
+    float minLifetime;
+    float maxLifetime;
+    float minSize;
+    float maxSize;
+    float drag;
+    unsigned int colours[3]; // Each particle picks one of these at random.
+  };
+
+
+  //
+  // Constants
+  //
+
+  static const EffectParams kEffectParams[eEffectTypeCount] = {
+    // eEffectLifeLost: a big, hot explosion that hangs around for a second.
+    { 1500, 0.002f, 0.012f, 30.0f, 75.0f, 0.2f, 0.6f, 0.95f,
+      { 0xFF4020, 0xFFA030, 0xFFF0A0 } },
+    // eEffectPowerUp: a fast, tight ring in the power-up colours.
+    { 600, 0.006f, 0.008f, 20.0f, 40.0f, 0.15f, 0.35f, 0.92f,
+      { 0x40C0FF, 0xA0E0FF, 0xFFFFFF } }
+  };
+
+
+  //
+  // EffectParticles public methods
+  //
+
+  EffectParticles::EffectParticles() :
+    count(0),
+    seed(0xCA7EFF)
+  {
+  }
+
+
+  void EffectParticles::emit(EffectType type, const Vec2& pos)
+  {
+    assert(type >= 0 && type < eEffectTypeCount);
+    const EffectParams& params = kEffectParams[type];
+
+    unsigned int n = std::min(params.count, kMaxEffectParticles - count);
+    for (unsigned int i = count; i < count + n; ++i) {
+      float angle = random() * 2.0f * float(M_PI);
+      float speed = params.minSpeed + random() * (params.maxSpeed - params.minSpeed);
+
+      x[i] = pos.x;
+      y[i] = pos.y;
+      vx[i] = cosf(angle) * speed;
+      vy[i] = sinf(angle) * speed;
+      age[i] = 0;
+      lifetime[i] = params.minLifetime + random() * (params.maxLifetime - params.minLifetime);
+      size[i] = params.minSize + random() * (params.maxSize - params.minSize);
+      drag[i] = params.drag;
+      colour[i] = params.colours[int(random() * 3) % 3];
+    }
+    count += n;
+  }
+
+
+  void EffectParticles::update()
+  {
+    // Straight-line loops over each field, so the compiler can vectorise them.
+    for (unsigned int i = 0; i < count; ++i) {
+      x[i] += vx[i];
+      y[i] += vy[i];
+    }
+    for (unsigned int i = 0; i < count; ++i) {
+      vx[i] *= drag[i];
+      vy[i] *= drag[i];
+      age[i] += 1.0f;
+    }
+
+    // Swap-remove the expired particles.
+    unsigned int i = 0;
+    while (i < count) {
+      if (age[i] < lifetime[i]) {
+        ++i;
+        continue;
+      }
+      --count;
+      x[i] = x[count];
+      y[i] = y[count];
+      vx[i] = vx[count];
+      vy[i] = vy[count];
+      age[i] = age[count];
+      lifetime[i] = lifetime[count];
+      size[i] = size[count];
+      drag[i] = drag[count];
+      colour[i] = colour[count];
+    }
+  }
+
+
+  void EffectParticles::clear()
+  {
+    count = 0;
+  }
+
+
+  void EffectParticles::copyTo(EffectParticles* dst) const
+  {
+    assert(dst != NULL && dst != this);
+
+    dst->count = count;
+    memcpy(dst->x, x, count * sizeof(float));
+    memcpy(dst->y, y, count * sizeof(float));
+    memcpy(dst->vx, vx, count * sizeof(float));
+    memcpy(dst->vy, vy, count * sizeof(float));
+    memcpy(dst->age, age, count * sizeof(float));
+    memcpy(dst->lifetime, lifetime, count * sizeof(float));
+    memcpy(dst->size, size, count * sizeof(float));
+    memcpy(dst->drag, drag, count * sizeof(float));
+    memcpy(dst->colour, colour, count * sizeof(unsigned int));
+    dst->seed = seed;
+  }
+
+
+  //
+  // EffectParticles private methods
+  //
+
+  // Returns a random number in [0, 1).
+  float EffectParticles::random()
+  {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) * (1.0f / 16777216.0f);
+  }
+
+} // namespace cat
+
@@ -0,0 +1,72 @@
+#ifndef cat_effects_h
+#define cat_effects_h
+
+#include "vec2.h"
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  static const unsigned int kMaxEffectParticles = 4096;
+
+
+  //
+  // Types
+  //
+
+  enum EffectType {
+    eEffectLifeLost,    // Burst of sparks where the player got hit.
+    eEffectPowerUp,     // Ring of light around the player when a power-up starts.
+
+    eEffectTypeCount    // Sentinel value.
+  };
+
+
+  // A fixed-size pool of short-lived particles, stored as one array per
+  // field. Live particles are always packed into [0, count); dead ones are
+  // removed by moving the last live particle into their slot, so nothing is
+  // ever allocated after construction. Positions and velocities are in the
+  // same units as the atoms: the play area is the unit square and
+  // velocities are per simulation step.
+  struct EffectParticles {
+    unsigned int count;
+    float x[kMaxEffectParticles];
+    float y[kMaxEffectParticles];
+    float vx[kMaxEffectParticles];
+    float vy[kMaxEffectParticles];
+    float age[kMaxEffectParticles];       // In simulation steps.
+    float lifetime[kMaxEffectParticles];  // In simulation steps.
+    float size[kMaxEffectParticles];      // Relative to the size of an atom.
+    float drag[kMaxEffectParticles];      // Velocity multiplier per step.
+    unsigned int colour[kMaxEffectParticles]; // 0xRRGGBB
+    // State for the random number generator, kept separate from the game's
+    // (GameData::randomState, used with erand48) so effects don't change the
+    // sequence of random numbers the game sees.
+    unsigned int seed;
+
+    EffectParticles();
+
+    // Emits a burst of particles of the given type centred on pos. If the
+    // pool fills up, the rest of the burst is dropped.
+    void emit(EffectType type, const Vec2& pos);
+
+    // Advances every particle by one simulation step and removes the ones
+    // which have expired.
+    void update();
+
+    // Removes every particle.
+    void clear();
+
+    // Copies the live particles into dst, which must not be this.
+    void copyTo(EffectParticles* dst) const;
+
+  private:
+    float random();
+  };
+
+} // namespace cat
+
+#endif // cat_effects_h
+
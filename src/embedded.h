@@ -0,0 +1,30 @@
+#ifndef cat_embedded_h
+#define cat_embedded_h
+
+namespace cat {
+
+  //
+  // Types
+  //
+
+  // A file built into the executable. The data is 16 byte aligned.
+  struct EmbeddedFile {
+    const char* name;           // Relative to the resource directory.
+    const unsigned char* begin;
+    const unsigned char* end;
+  };
+
+
+  //
+  // Global variables
+  //
+
+  // Generated at build time by tools/embedassets.sh, from every file in the
+  // staged resource directory.
+  extern const EmbeddedFile kEmbeddedFiles[];
+  extern const unsigned int kNumEmbeddedFiles;
+
+} // namespace cat
+
+#endif // cat_embedded_h
+
@@ -0,0 +1,119 @@
+#include "framestate.h"
+
+#include "atomic.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  static const int kIndexMask = 0x3;
+  static const int kFreshBit = 0x4;
+
+
+  //
+  // FrameState public methods
+  //
+
+  FrameState::FrameState() :
+    frameNumber(-1),
+    stepTime(0),
+    gameState(eGameTitleScreen),
+    gameTime(0),
+    stateChangeTime(0),
+    player(),
+    versus(false),
+    opponent(),
+    hasLevel(false),
+    levelDuration(0),
+    atomCount(0),
+    effects()
+  {
+    levelName[0] = '\0';
+  }
+
+
+  //
+  // FrameStateBuffer public methods
+  //
+
+  FrameStateBuffer::FrameStateBuffer() :
+    _write(0),
+    _read(1),
+    _spare(2)
+  {
+  }
+
+
+  FrameState* FrameStateBuffer::writeBuffer()
+  {
+    return &_buffers[_write];
+  }
+
+
+  void FrameStateBuffer::publish()
+  {
+    int prev = AtomicExchange(&_spare, _write | kFreshBit);
+    _write = prev & kIndexMask;
+  }
+
+
+  const FrameState* FrameStateBuffer::readBuffer()
+  {
+    if (AtomicLoad(&_spare) & kFreshBit) {
+      int prev = AtomicExchange(&_spare, _read);
+      _read = prev & kIndexMask;
+    }
+    return &_buffers[_read];
+  }
+
+
+  bool FrameStateBuffer::hasNewFrame()
+  {
+    return (AtomicLoad(&_spare) & kFreshBit) != 0;
+  }
+
+
+  //
+  // Functions
+  //
+
+  void CaptureFrameState(const GameData* game, FrameState* frame)
+  {
+    assert(game != NULL);
+    assert(frame != NULL);
+
+    frame->frameNumber = game->frameNumber;
+    frame->stepTime = game->stepTime;
+    frame->gameState = game->gameState;
+    frame->gameTime = game->gameTime;
+    frame->stateChangeTime = game->stateChangeTime;
+    frame->player = game->player;
+    frame->versus = game->versus;
+    frame->opponent = game->opponent;
+    game->effects.copyTo(&frame->effects);
+
+    frame->hasLevel = (game->currentLevel != game->levels.end());
+    if (!frame->hasLevel) {
+      frame->levelName[0] = '\0';
+      frame->levelDuration = 0;
+      frame->atomCount = 0;
+      return;
+    }
+
+    const Level& level = *game->currentLevel;
+    strncpy(frame->levelName, level.name.c_str(), kMaxLevelNameLength - 1);
+    frame->levelName[kMaxLevelNameLength - 1] = '\0';
+    frame->levelDuration = level.duration;
+    frame->atomCount = level.atomCount;
+    std::copy(level.position, level.position + level.atomCount, frame->atomPosition);
+    std::copy(level.velocity, level.velocity + level.atomCount, frame->atomVelocity);
+  }
+
+} // namespace cat
+
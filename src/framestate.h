@@ -0,0 +1,92 @@
+#ifndef cat_framestate_h
+#define cat_framestate_h
+
+#include "effects.h"
+#include "gamedata.h"
+#include "level.h"
+#include "vec2.h"
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  static const unsigned int kMaxLevelNameLength = 64;
+
+
+  //
+  // Types
+  //
+
+  // An immutable copy of everything the renderer needs to draw one frame. The
+  // simulation thread fills these in and the render thread consumes them, so
+  // nothing in here may point back into the live GameData.
+  struct FrameState {
+    // Simulation step which produced this frame, and how long it took.
+    long frameNumber;
+    double stepTime;
+    GameState gameState;
+    double gameTime;
+    double stateChangeTime;
+    PlayerData player;
+    // Only used in a versus game.
+    bool versus;
+    PlayerData opponent;
+
+    // Current level, if there is one.
+    bool hasLevel;
+    char levelName[kMaxLevelNameLength];
+    double levelDuration;
+    unsigned int atomCount;
+    Vec2 atomPosition[kMaxAtoms];
+    Vec2 atomVelocity[kMaxAtoms]; // Distance moved per simulation step.
+
+    // Particle effects. These carry on between levels and lives.
+    EffectParticles effects;
+
+    FrameState();
+  };
+
+
+  // Lock-free triple buffer for passing FrameStates from the simulation thread
+  // (the only writer) to the render thread (the only reader). The writer and
+  // the reader each own one buffer; the third is swapped between them. Neither
+  // side ever blocks, and the reader always gets the newest complete frame.
+  class FrameStateBuffer {
+  public:
+    FrameStateBuffer();
+
+    // Writer side. Fill in the buffer returned by writeBuffer(), then call
+    // publish() to make it visible to the reader.
+    FrameState* writeBuffer();
+    void publish();
+
+    // Reader side. Returns the newest published frame. The pointer stays
+    // valid until the next call to readBuffer().
+    const FrameState* readBuffer();
+
+    // True if a frame has been published since the last readBuffer() call.
+    bool hasNewFrame();
+
+  private:
+    FrameState _buffers[3];
+    int _write;
+    int _read;
+    // Index of the spare buffer, with kFreshBit set if it holds a frame the
+    // reader hasn't seen yet.
+    volatile int _spare;
+  };
+
+
+  //
+  // Functions
+  //
+
+  // Copies the parts of the game state that the renderer needs into frame.
+  void CaptureFrameState(const GameData* game, FrameState* frame);
+
+} // namespace cat
+
+#endif // cat_framestate_h
+
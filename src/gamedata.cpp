@@ -1,7 +1,9 @@
 #include "gamedata.h"
 
+#include "framestate.h"
+
+#include <algorithm>
 #include <cassert>
-#include <cstdlib>
 
 namespace cat {
   
@@ -11,6 +13,8 @@ namespace cat {
 
   const float kAtomSize = 0.03;
 
+  const unsigned long kDefaultGameSeed = 0xCA7CA7;
+
 
   //
   // Global variables
@@ -32,7 +36,9 @@ namespace cat {
     view(ePlayerFront),
     superpositionsRemaining(0),
     entanglementsRemaining(0),
-    collision(false)
+    collision(false),
+    spawnPosition(0.5, 0.5),
+    input(0)
   {
   }
 
@@ -43,8 +49,17 @@ namespace cat {
 
   WindowData::WindowData() :
     width(0),
-    height(0)
+    height(0),
+    leftPressed(false),
+    rightPressed(false),
+    upPressed(false),
+    downPressed(false),
+    keysDown(0),
+    anyKeyHit(false),
+    stick(0, 0)
   {
+    std::fill(keyPressed, keyPressed + 256, false);
+    std::fill(keySources, keySources + kNumHeldKeys, 0);
   }
 
 
@@ -52,15 +67,30 @@ namespace cat {
   // GameData public methods
   //
 
-  GameData::GameData() :
+  GameData::GameData(unsigned long seed) :
     gameState(eGameTitleScreen),
     gameTime(0),
     player(),
+    opponent(),
+    versus(false),
+    replaying(false),
     window(),
     draw(NULL),
+    audio(NULL),
+    frames(NULL),
+    frameNumber(0),
+    stepTime(0),
+    collisionCheckFrame(0),
+    collisionFrame(-1),
+    effects(),
     levels(),
-    currentLevel(NULL)
+    currentLevel(levels.end())
   {
+    // Seeded the same way srand48 does it.
+    randomState[0] = 0x330E;
+    randomState[1] = seed & 0xFFFF;
+    randomState[2] = (seed >> 16) & 0xFFFF;
+
     struct {
       int numAtoms;
       double emitFrequency;
@@ -79,7 +109,7 @@ namespace cat {
 
     for (int i = 0; levelParams[i].numAtoms != 0; ++i) {
       levels.push_back(Level());
-      levels.back().randomise(levelParams[i].numAtoms, levelParams[i].emitFrequency,
+      levels.back().randomise(randomState, levelParams[i].numAtoms, levelParams[i].emitFrequency,
                               levelParams[i].maxSpeed, levelParams[i].minSpeed);
     }
   }
@@ -92,8 +122,8 @@ namespace cat {
   void InitGameData()
   {
     assert(gGameData == NULL);
-    srand48(0xCA7CA7);
     gGameData = new GameData();
+    gGameData->frames = new FrameStateBuffer();
   }
 
 } // namespace cat
@@ -1,6 +1,7 @@
 #ifndef cat_gamedata_h
 #define cat_gamedata_h
 
+#include "effects.h"
 #include "level.h"
 #include "vec2.h"
 
@@ -15,7 +16,9 @@ namespace cat {
   struct GameData;
   struct PlayerData;
 
+  struct AudioEngine; // Opaque structure which mixes sound on a background thread; see audio.cpp for details.
   struct DrawingData; // Opaque structure used as a cache for graphics data; see drawing.cpp for details.
+  class FrameStateBuffer; // Hands snapshots from the simulation to the renderer; see framestate.h.
 
 
   //
@@ -24,6 +27,28 @@ namespace cat {
 
   extern const float kAtomSize;
 
+  // Seed for the levels in the interactive game.
+  extern const unsigned long kDefaultGameSeed;
+
+  // Each simulation step is split into this many parts for movement, so a
+  // player can start or stop moving part way through a step.
+  static const int kInputSubsteps = 4;
+  static const int kInputDirectionBits = 4;
+
+  // An analog stick's position is packed into the top of a PlayerInput as a
+  // signed kInputStickBits-bit number for each axis.
+  static const int kInputStickBits = 7;
+  static const int kInputStickMax = (1 << (kInputStickBits - 1)) - 1;
+  static const int kInputStickXShift = 18;
+  static const int kInputStickYShift = kInputStickXShift + kInputStickBits;
+
+  // Keys which can be held down: the character codes plus the arrow keys
+  // (see input.h).
+  static const int kNumHeldKeys = 260;
+  // Devices which can hold keys down independently, one bit each in
+  // WindowData::keySources.
+  static const int kMaxInputSources = 8;
+
 
   //
   // Global variables
@@ -63,6 +88,22 @@ namespace cat {
   };
 
 
+  // Bits for the controls a player used during a step. There's a set of
+  // direction bits for each substep: the ones for substep i are shifted up by
+  // i * kInputDirectionBits. The other controls apply to the whole step. The
+  // bits from kInputStickXShift up hold the analog stick (see InputStick).
+  enum InputBits {
+    eInputLeft          = 1 << 0,
+    eInputRight         = 1 << 1,
+    eInputUp            = 1 << 2,
+    eInputDown          = 1 << 3,
+    eInputDirections    = 0xF,
+    eInputSuperposition = 1 << 16,
+    eInputEntanglement  = 1 << 17
+  };
+  typedef unsigned int PlayerInput;
+
+
   struct PlayerData {
     Vec2 position;
     Vec2 size;
@@ -73,6 +114,10 @@ namespace cat {
     int superpositionsRemaining;
     int entanglementsRemaining;
     bool collision;
+    // Where the player starts each life.
+    Vec2 spawnPosition;
+    // The controls to apply on the next simulation step (see InputBits).
+    PlayerInput input;
 
     PlayerData();
   };
@@ -87,6 +132,18 @@ namespace cat {
     bool rightPressed;
     bool upPressed;
     bool downPressed;
+    // How many entries in keyPressed are set, not counting 'r' (see
+    // AnyKeyPressed). Use SetKey to keep it up to date.
+    int keysDown;
+    // Which input sources are holding each key down, as a bit per source. The
+    // flags above are set if any of them are.
+    unsigned char keySources[kNumHeldKeys];
+    // True if one of the keyPressed keys went down during the last step, even
+    // if it's already been released again.
+    bool anyKeyHit;
+    // Position of a joystick's analog stick, from -1 to 1 on each axis with
+    // up being positive y. Zero if there's no joystick.
+    Vec2 stick;
 
     WindowData();
   };
@@ -100,17 +157,46 @@ namespace cat {
     double gameTime;
     // The time at which the game state changed to its current value.
     double stateChangeTime;
-    // Player state.
+    // Player state. The player is whoever is playing on this machine.
     PlayerData player;
+    // In a versus game, the player on the other machine.
+    PlayerData opponent;
+    bool versus;
+    // True while steps which have already been shown are being run again
+    // (see netplay.cpp), so they don't set off the same effects twice.
+    bool replaying;
     // Data about the game window.
     WindowData window;
     // Cached drawing data.
     DrawingData* draw;
+    // Where sound effects go. NULL for sessions which run without sound.
+    AudioEngine* audio;
+    // Snapshots of the game state, published by the simulation thread for the
+    // render thread to draw.
+    FrameStateBuffer* frames;
+    // Number of simulation steps run so far.
+    long frameNumber;
+    // How long the simulation thread spent on the last step, in milliseconds.
+    double stepTime;
+    // Collisions reported by the renderer for frames older than this are
+    // ignored, either because they've already been handled or because they
+    // happened before the player's current life started.
+    long collisionCheckFrame;
+    // The newest simulation step in which the renderer saw the player collide
+    // with something. Written by the render thread, read by the simulation.
+    volatile long collisionFrame;
+    // Particle effects (explosions, etc.).
+    EffectParticles effects;
     // Levels.
     std::list<Level> levels;
     std::list<Level>::iterator currentLevel;
+    // State for the random number generator (see erand48). Each session has
+    // its own, so sessions on different threads don't disturb each other.
+    unsigned short randomState[3];
 
-    GameData();
+    // Generates a new set of levels from the seed. The same seed always
+    // produces the same levels.
+    explicit GameData(unsigned long seed = kDefaultGameSeed);
   };
 
 
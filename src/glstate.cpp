@@ -0,0 +1,374 @@
+#include "glstate.h"
+
+#include <cstring>
+
+#define GL_GLEXT_PROTOTYPES 1
+#ifdef linux
+#include <GL/gl.h>
+#include <GL/glext.h>
+#else
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+#endif
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  // Capabilities whose state we track. Anything else passes straight through.
+  static const GLenum kTrackedCaps[] = {
+    GL_TEXTURE_2D,
+    GL_BLEND,
+    GL_DEPTH_TEST
+  };
+  static const int kNumTrackedCaps = sizeof(kTrackedCaps) / sizeof(kTrackedCaps[0]);
+
+  // Marks a cached value as unknown, forcing the next call through to GL.
+  static const int kUnknown = -1;
+
+
+  //
+  // Types
+  //
+
+  enum ProjectionMode {
+    eProjectionUnknown,
+    eProjectionWorld,
+    eProjectionPixels
+  };
+
+
+  struct StateCache {
+    int caps[kNumTrackedCaps];
+    int depthMask;
+    int blendSrc;
+    int blendDst;
+    int texEnvMode;
+    bool colorKnown;
+    float color[4];
+    int viewport[4];
+    int vertexArray;
+    int texCoordArray;
+    int colorArray;
+    long texture;
+    long framebuffer;
+    long program;
+    ProjectionMode projection;
+    int projectionWidth;
+    int projectionHeight;
+
+    GLStats current;
+    GLStats last;
+
+    StateCache();
+    void reset();
+  };
+
+
+  //
+  // Global variables
+  //
+
+  static StateCache gState;
+
+
+  //
+  // Forward declarations
+  //
+
+  bool Changed(int& cached, int value);
+  bool Changed(long& cached, long value);
+
+
+  //
+  // GLStats public methods
+  //
+
+  GLStats::GLStats() :
+    stateChanges(0),
+    redundantChanges(0),
+    textureBinds(0),
+    drawCalls(0)
+  {
+  }
+
+
+  //
+  // StateCache public methods
+  //
+
+  StateCache::StateCache() :
+    current(),
+    last()
+  {
+    reset();
+  }
+
+
+  void StateCache::reset()
+  {
+    for (int i = 0; i < kNumTrackedCaps; ++i)
+      caps[i] = kUnknown;
+    depthMask = kUnknown;
+    blendSrc = kUnknown;
+    blendDst = kUnknown;
+    texEnvMode = kUnknown;
+    colorKnown = false;
+    for (int i = 0; i < 4; ++i)
+      viewport[i] = kUnknown;
+    vertexArray = kUnknown;
+    texCoordArray = kUnknown;
+    colorArray = kUnknown;
+    texture = kUnknown;
+    framebuffer = kUnknown;
+    program = kUnknown;
+    projection = eProjectionUnknown;
+    projectionWidth = 0;
+    projectionHeight = 0;
+  }
+
+
+  //
+  // Public functions
+  //
+
+  void ResetStateCache()
+  {
+    gState.reset();
+  }
+
+
+  void SetCapability(unsigned int cap, bool enabled)
+  {
+    bool tracked = false;
+    for (int i = 0; i < kNumTrackedCaps && !tracked; ++i) {
+      if (kTrackedCaps[i] == cap) {
+        if (!Changed(gState.caps[i], enabled ? 1 : 0))
+          return;
+        tracked = true;
+      }
+    }
+    if (!tracked)
+      ++gState.current.stateChanges;
+
+    if (enabled)
+      glEnable(cap);
+    else
+      glDisable(cap);
+  }
+
+
+  void SetDepthMask(bool enabled)
+  {
+    if (Changed(gState.depthMask, enabled ? 1 : 0))
+      glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+  }
+
+
+  void SetBlendFunc(unsigned int src, unsigned int dst)
+  {
+    if (gState.blendSrc == int(src) && gState.blendDst == int(dst)) {
+      ++gState.current.redundantChanges;
+      return;
+    }
+    ++gState.current.stateChanges;
+    gState.blendSrc = src;
+    gState.blendDst = dst;
+    glBlendFunc(src, dst);
+  }
+
+
+  void SetTexEnvMode(int mode)
+  {
+    if (Changed(gState.texEnvMode, mode))
+      glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, mode);
+  }
+
+
+  void SetColor(float r, float g, float b, float a)
+  {
+    float color[4] = { r, g, b, a };
+    if (gState.colorKnown && memcmp(color, gState.color, sizeof(color)) == 0) {
+      ++gState.current.redundantChanges;
+      return;
+    }
+    ++gState.current.stateChanges;
+    memcpy(gState.color, color, sizeof(color));
+    gState.colorKnown = true;
+    glColor4f(r, g, b, a);
+  }
+
+
+  void InvalidateColor()
+  {
+    gState.colorKnown = false;
+  }
+
+
+  void SetViewport(int x, int y, int width, int height)
+  {
+    int* vp = gState.viewport;
+    if (vp[0] == x && vp[1] == y && vp[2] == width && vp[3] == height) {
+      ++gState.current.redundantChanges;
+      return;
+    }
+    ++gState.current.stateChanges;
+    vp[0] = x;
+    vp[1] = y;
+    vp[2] = width;
+    vp[3] = height;
+    glViewport(x, y, width, height);
+  }
+
+
+  void SetClientArrays(bool vertices, bool texCoords, bool colors)
+  {
+    if (Changed(gState.vertexArray, vertices ? 1 : 0)) {
+      if (vertices)
+        glEnableClientState(GL_VERTEX_ARRAY);
+      else
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+    if (Changed(gState.texCoordArray, texCoords ? 1 : 0)) {
+      if (texCoords)
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+      else
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    }
+    if (Changed(gState.colorArray, colors ? 1 : 0)) {
+      if (colors)
+        glEnableClientState(GL_COLOR_ARRAY);
+      else
+        glDisableClientState(GL_COLOR_ARRAY);
+    }
+  }
+
+
+  void BindTexture(unsigned int textureID)
+  {
+    if (Changed(gState.texture, textureID)) {
+      ++gState.current.textureBinds;
+      glBindTexture(GL_TEXTURE_2D, textureID);
+    }
+  }
+
+
+  void BindFramebuffer(unsigned int framebufferID)
+  {
+    if (Changed(gState.framebuffer, framebufferID))
+      glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebufferID);
+  }
+
+
+  void UseProgram(unsigned int programID)
+  {
+    if (Changed(gState.program, programID))
+      glUseProgram(programID);
+  }
+
+
+  void ForgetTexture(unsigned int textureID)
+  {
+    if (gState.texture == long(textureID))
+      gState.texture = 0;
+  }
+
+
+  void ForgetFramebuffer(unsigned int framebufferID)
+  {
+    if (gState.framebuffer == long(framebufferID))
+      gState.framebuffer = 0;
+  }
+
+
+  void UseWorldProjection()
+  {
+    if (gState.projection == eProjectionWorld) {
+      ++gState.current.redundantChanges;
+      return;
+    }
+    ++gState.current.stateChanges;
+    gState.projection = eProjectionWorld;
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0, 1, 0, 1, 0, 4);
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+  }
+
+
+  void UsePixelProjection(int width, int height)
+  {
+    if (gState.projection == eProjectionPixels &&
+        gState.projectionWidth == width && gState.projectionHeight == height) {
+      ++gState.current.redundantChanges;
+      return;
+    }
+    ++gState.current.stateChanges;
+    gState.projection = eProjectionPixels;
+    gState.projectionWidth = width;
+    gState.projectionHeight = height;
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0, width, 0, height, 0, 4);
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+  }
+
+
+  void CountDrawCalls(unsigned int count)
+  {
+    gState.current.drawCalls += count;
+  }
+
+
+  void BeginGLStatsFrame()
+  {
+    gState.last = gState.current;
+    gState.current = GLStats();
+  }
+
+
+  const GLStats& LastFrameGLStats()
+  {
+    return gState.last;
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  // Updates the cached value and returns true if it differs from the new
+  // one; otherwise counts the call as redundant and returns false.
+  bool Changed(int& cached, int value)
+  {
+    if (cached == value) {
+      ++gState.current.redundantChanges;
+      return false;
+    }
+    ++gState.current.stateChanges;
+    cached = value;
+    return true;
+  }
+
+
+  bool Changed(long& cached, long value)
+  {
+    if (cached == value) {
+      ++gState.current.redundantChanges;
+      return false;
+    }
+    ++gState.current.stateChanges;
+    cached = value;
+    return true;
+  }
+
+} // namespace cat
+
@@ -0,0 +1,74 @@
+#ifndef cat_glstate_h
+#define cat_glstate_h
+
+namespace cat {
+
+  //
+  // Types
+  //
+
+  // Per-frame counts of what the drawing code asked the GL to do.
+  struct GLStats {
+    unsigned int stateChanges;      // State changes passed through to GL.
+    unsigned int redundantChanges;  // State changes skipped because nothing would change.
+    unsigned int textureBinds;      // Texture binds passed through to GL.
+    unsigned int drawCalls;
+
+    GLStats();
+  };
+
+
+  //
+  // Functions
+  //
+
+  // All drawing code sets GL state through these functions rather than
+  // calling GL directly. Each one remembers the last value it set and skips
+  // the GL call if the state is already correct. That only works if nothing
+  // else changes the same state behind its back, so callers shouldn't try to
+  // "clean up" after themselves: each draw function just sets whatever state
+  // it needs before drawing.
+  //
+  // These must only be called from the thread which owns the GL context.
+
+  // Forget all cached values, so that the next call of each kind goes
+  // through to GL. Call this after creating the context, or after any code
+  // which changes GL state without going through here.
+  void ResetStateCache();
+
+  void SetCapability(unsigned int cap, bool enabled);
+  void SetDepthMask(bool enabled);
+  void SetBlendFunc(unsigned int src, unsigned int dst);
+  void SetTexEnvMode(int mode);
+  void SetColor(float r, float g, float b, float a = 1.0f);
+  void SetViewport(int x, int y, int width, int height);
+  void SetClientArrays(bool vertices, bool texCoords, bool colors = false);
+  // Call after drawing with a colour array, which leaves the current colour
+  // undefined.
+  void InvalidateColor();
+  void BindTexture(unsigned int textureID);
+  void BindFramebuffer(unsigned int framebufferID);
+  void UseProgram(unsigned int programID);
+
+  // Deleting a bound texture or framebuffer makes GL fall back to binding 0.
+  // Call these just before deleting one so the cache knows about it.
+  void ForgetTexture(unsigned int textureID);
+  void ForgetFramebuffer(unsigned int framebufferID);
+
+  // Projection for the game world, mapping the unit square to the viewport,
+  // with an identity modelview matrix.
+  void UseWorldProjection();
+  // Projection in pixel units, for text, with an identity modelview matrix.
+  void UsePixelProjection(int width, int height);
+
+  void CountDrawCalls(unsigned int count = 1);
+
+  // Call at the start of each frame. The counts for the frame just finished
+  // become available from LastFrameGLStats().
+  void BeginGLStatsFrame();
+  const GLStats& LastFrameGLStats();
+
+} // namespace cat
+
+#endif // cat_glstate_h
+
@@ -1,6 +1,12 @@
 #include "image.h"
 
+#include "glstate.h"
+
+#include <fcntl.h>
 #include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <cstring>
 #include <cstdarg>
 #include <cstdio>
@@ -11,6 +17,13 @@
 #include <OpenGL/gl.h>
 #endif
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
 
 namespace cat {
 
@@ -34,6 +47,183 @@ const char* ImageException::what() const throw()
 }
 
 
+//
+// Internal functions
+//
+
+// Writes count copies of a single pixel to dst. Runs in the RLE data are
+// usually long stretches of transparent or solid colour, so we fill them a
+// whole vector at a time rather than one pixel at a time.
+static void FillRun(unsigned char* dst, const unsigned char* pixel,
+    unsigned int count, unsigned int bytesPerPixel)
+{
+  if (bytesPerPixel == 1) {
+    memset(dst, pixel[0], count);
+    return;
+  }
+
+#ifdef __SSE2__
+  if (bytesPerPixel == 4) {
+    int value;
+    memcpy(&value, pixel, 4);
+    __m128i v = _mm_set1_epi32(value);
+    for (; count >= 4; count -= 4, dst += 16)
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), v);
+  } else if (bytesPerPixel == 3 && count >= 16) {
+    // 16 pixels make exactly three vectors' worth of bytes.
+    unsigned char pattern[48];
+    for (unsigned int i = 0; i < 48; i += 3)
+      memcpy(pattern + i, pixel, 3);
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern + 16));
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern + 32));
+    for (; count >= 16; count -= 16, dst += 48) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), a);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), b);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 32), c);
+    }
+  }
+#endif
+
+  if (count == 0)
+    return;
+
+  // Copy one pixel, then keep doubling the filled span by copying it onto
+  // the end of itself.
+  size_t total = size_t(count) * bytesPerPixel;
+  size_t filled = bytesPerPixel;
+  memcpy(dst, pixel, bytesPerPixel);
+  while (filled < total) {
+    size_t chunk = (filled < total - filled) ? filled : total - filled;
+    memcpy(dst + filled, dst, chunk);
+    filled += chunk;
+  }
+}
+
+
+// Pixel format conversion kernels. Each has an SSE2 version which does 4 or
+// more pixels per iteration, with a scalar loop for the leftovers (or all of
+// them, if SSE2 isn't available).
+
+static void ExpandBGRToBGRA(const unsigned char* src, unsigned char* dst, size_t numPixels)
+{
+  size_t i = 0;
+#ifdef __SSSE3__
+  // pshufb can spread 4 packed pixels out to 4 padded ones in one go. We
+  // load 16 bytes to get 12, so stop while there's still a spare pixel's
+  // worth of input left to overread.
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i alpha = _mm_set1_epi32(0xFF000000);
+  for (; i + 6 <= numPixels; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+    v = _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alpha);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), v);
+  }
+#endif
+  for (; i < numPixels; ++i) {
+    dst[i * 4 + 0] = src[i * 3 + 0];
+    dst[i * 4 + 1] = src[i * 3 + 1];
+    dst[i * 4 + 2] = src[i * 3 + 2];
+    dst[i * 4 + 3] = 0xFF;
+  }
+}
+
+
+static void ExpandAlphaToBGRA(const unsigned char* src, unsigned char* dst, size_t numPixels)
+{
+  size_t i = 0;
+#ifdef __SSE2__
+  // Interleaving the alpha bytes with 0xFF twice gives FF FF FF aa.
+  const __m128i ones = _mm_set1_epi8(-1);
+  for (; i + 16 <= numPixels; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i lo = _mm_unpacklo_epi8(ones, a);
+    __m128i hi = _mm_unpackhi_epi8(ones, a);
+    __m128i* out = reinterpret_cast<__m128i*>(dst + i * 4);
+    _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(ones, lo));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(ones, lo));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(ones, hi));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(ones, hi));
+  }
+#endif
+  for (; i < numPixels; ++i) {
+    dst[i * 4 + 0] = 0xFF;
+    dst[i * 4 + 1] = 0xFF;
+    dst[i * 4 + 2] = 0xFF;
+    dst[i * 4 + 3] = src[i];
+  }
+}
+
+
+static void SwapRedBlue(unsigned char* pixels, size_t numPixels)
+{
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i maskGA = _mm_set1_epi32(0xFF00FF00);
+  for (; i + 4 <= numPixels; i += 4) {
+    __m128i* p = reinterpret_cast<__m128i*>(pixels + i * 4);
+    __m128i v = _mm_loadu_si128(p);
+    __m128i ga = _mm_and_si128(v, maskGA);
+    __m128i rb = _mm_andnot_si128(maskGA, v);
+    rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+    _mm_storeu_si128(p, _mm_or_si128(ga, rb));
+  }
+#endif
+  for (; i < numPixels; ++i) {
+    unsigned char tmp = pixels[i * 4 + 0];
+    pixels[i * 4 + 0] = pixels[i * 4 + 2];
+    pixels[i * 4 + 2] = tmp;
+  }
+}
+
+
+// Exact rounded x / 255 for x in [0, 255 * 255].
+static inline unsigned int DivideBy255(unsigned int x)
+{
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+
+static void PremultiplyAlpha(unsigned char* pixels, size_t numPixels)
+{
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi16(128);
+  const __m128i maskA = _mm_set1_epi32(0xFF000000);
+  for (; i + 4 <= numPixels; i += 4) {
+    __m128i* p = reinterpret_cast<__m128i*>(pixels + i * 4);
+    __m128i v = _mm_loadu_si128(p);
+
+    // Widen to 16 bits per channel and copy each pixel's alpha across all
+    // four of its channels.
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    __m128i alphaLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i alphaHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+    lo = _mm_add_epi16(_mm_mullo_epi16(lo, alphaLo), round);
+    hi = _mm_add_epi16(_mm_mullo_epi16(hi, alphaHi), round);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+    // a * a / 255 isn't a, so put the original alpha back.
+    __m128i result = _mm_packus_epi16(lo, hi);
+    result = _mm_or_si128(_mm_andnot_si128(maskA, result), _mm_and_si128(maskA, v));
+    _mm_storeu_si128(p, result);
+  }
+#endif
+  for (; i < numPixels; ++i) {
+    unsigned char* px = pixels + i * 4;
+    unsigned int a = px[3];
+    px[0] = DivideBy255(px[0] * a);
+    px[1] = DivideBy255(px[1] * a);
+    px[2] = DivideBy255(px[2] * a);
+  }
+}
+
+
 //
 // Image METHODS
 //
@@ -44,7 +234,11 @@ Image::Image(const char *path) throw(ImageException) :
   _bytesPerPixel(0),
   _width(0),
   _height(0),
-  _pixels(NULL)
+  _pixels(NULL),
+  _ownsPixels(true),
+  _mapping(NULL),
+  _mappingSize(0),
+  _premultiplied(false)
 {
   const char *filename = basename(const_cast<char *>(path));
   if (filename == NULL)
@@ -54,25 +248,53 @@ Image::Image(const char *path) throw(ImageException) :
   if (ext == NULL)
     throw ImageException("Unknown image format.");
 
-  FILE *file = fopen(path, "rb");
-  if (file == NULL)
-    throw ImageException("File not found: %s.", filename);
+  mapFile(path);
 
   try {
-    if (strcasecmp(ext, ".bmp") == 0) {
-      loadBMP(file);
-    } else if (strcasecmp(ext, ".tga") == 0) {
-      loadTGA(file);
-    } else {
-      throw ImageException("Unknown image format: %s", ext);
-    }
-    fclose(file);
+    load(ext, static_cast<const unsigned char*>(_mapping), _mappingSize);
+  } catch (ImageException& ex) {
+    freePixels();
+    unmapFile();
+    throw ex;
+  }
+
+  // If the pixels had to be decoded into a buffer of their own, we don't
+  // need the file any more.
+  if (_ownsPixels)
+    unmapFile();
+}
+
+
+Image::Image(const char* name, const unsigned char* data, size_t size) throw(ImageException) :
+  _type(GL_RGB),
+  _texId(0),
+  _bytesPerPixel(0),
+  _width(0),
+  _height(0),
+  _pixels(NULL),
+  _ownsPixels(true),
+  _mapping(NULL),
+  _mappingSize(0),
+  _premultiplied(false)
+{
+  const char *ext = strrchr(name, '.');
+  if (ext == NULL)
+    throw ImageException("Unknown image format.");
+
+  try {
+    load(ext, data, size);
   } catch (ImageException& ex) {
-    fclose(file);
-    if (_pixels != NULL)
-      delete _pixels;
+    freePixels();
     throw ex;
   }
+
+  // The caller's memory may go away, so don't keep pointing into it.
+  if (!_ownsPixels) {
+    size_t numBytes = size_t(_bytesPerPixel) * _width * _height;
+    const unsigned char* src = _pixels;
+    allocatePixels(numBytes);
+    memcpy(_pixels, src, numBytes);
+  }
 }
 
 
@@ -82,10 +304,14 @@ Image::Image(int type, int bytesPerPixel, int width, int height) :
   _bytesPerPixel(bytesPerPixel),
   _width(width),
   _height(height),
-  _pixels(NULL)
+  _pixels(NULL),
+  _ownsPixels(true),
+  _mapping(NULL),
+  _mappingSize(0),
+  _premultiplied(false)
 {
   unsigned int size = _bytesPerPixel * _width * _height;
-  _pixels = new unsigned char[size];
+  allocatePixels(size);
   for (unsigned int i = 0; i < size; ++i)
     _pixels[i] = 0xFF;
 }
@@ -97,17 +323,22 @@ Image::Image(const Image& img) :
   _bytesPerPixel(img._bytesPerPixel),
   _width(img._width),
   _height(img._height),
-  _pixels(NULL)
+  _pixels(NULL),
+  _ownsPixels(true),
+  _mapping(NULL),
+  _mappingSize(0),
+  _premultiplied(img._premultiplied)
 {
   unsigned int size = _bytesPerPixel * _width * _height;
-  _pixels = new unsigned char[size];
+  allocatePixels(size);
   memcpy(_pixels, img._pixels, size);
 }
 
 
 Image::~Image()
 {
-  delete[] _pixels;
+  freePixels();
+  unmapFile();
 }
 
 
@@ -141,6 +372,14 @@ unsigned char* Image::getPixels()
 }
 
 
+int Image::getDataType() const
+{
+  if (_type == GL_BGRA && _bytesPerPixel == 4)
+    return GL_UNSIGNED_INT_8_8_8_8_REV;
+  return GL_UNSIGNED_BYTE;
+}
+
+
 unsigned int Image::getTexID() const
 {
   return _texId;
@@ -172,21 +411,29 @@ void Image::uploadTextureAs(int targetType, unsigned int texId)
   else
     _texId = texId;
 
-  glEnable(GL_TEXTURE_2D);
-  glBindTexture(GL_TEXTURE_2D, _texId);
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  BindTexture(_texId);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, ((_width * _bytesPerPixel) % 4 == 0) ? 4 : 1);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+  SetTexEnvMode(GL_MODULATE);
   glTexImage2D(GL_TEXTURE_2D, 0, targetType,
-      _width, _height, 0, _type, GL_UNSIGNED_BYTE, _pixels);
+      _width, _height, 0, _type, getDataType(), _pixels);
 }
 
 
 unsigned char* Image::takePixels()
 {
+  // The caller expects memory it can delete[], so mapped pixels get copied.
+  if (!_ownsPixels && _pixels != NULL) {
+    size_t numBytes = size_t(_bytesPerPixel) * _width * _height;
+    unsigned char* mappedPixels = _pixels;
+    allocatePixels(numBytes);
+    memcpy(_pixels, mappedPixels, numBytes);
+    unmapFile();
+  }
+
   unsigned char* pixels = _pixels;
   _pixels = NULL;
   return pixels;
@@ -195,20 +442,127 @@ unsigned char* Image::takePixels()
 
 void Image::deletePixels()
 {
-  delete _pixels;
-  _pixels = NULL;
+  freePixels();
+  unmapFile();
+}
+
+
+bool Image::isMapped() const
+{
+  return _pixels != NULL && !_ownsPixels;
+}
+
+
+void Image::convertToBGRA()
+{
+  size_t numPixels = size_t(_width) * _height;
+  if (_type == GL_BGRA)
+    return;
+  if (_type == GL_RGBA) {
+    swapRedBlue();
+    return;
+  }
+
+  unsigned char* src = _pixels;
+  bool srcOwned = _ownsPixels;
+  _pixels = new unsigned char[numPixels * 4];
+  _ownsPixels = true;
+  if (_bytesPerPixel == 3)
+    ExpandBGRToBGRA(src, _pixels, numPixels);
+  else
+    ExpandAlphaToBGRA(src, _pixels, numPixels);
+
+  if (srcOwned)
+    delete[] src;
+  else
+    unmapFile();
+  _type = GL_BGRA;
+  _bytesPerPixel = 4;
+}
+
+
+void Image::swapRedBlue()
+{
+  if (_bytesPerPixel != 4)
+    return;
+  SwapRedBlue(_pixels, size_t(_width) * _height);
+  _type = (_type == GL_BGRA) ? GL_RGBA : GL_BGRA;
+}
+
+
+void Image::premultiplyAlpha()
+{
+  if (_bytesPerPixel != 4 || _premultiplied)
+    return;
+  PremultiplyAlpha(_pixels, size_t(_width) * _height);
+  _premultiplied = true;
+}
+
+
+bool Image::isPremultiplied() const
+{
+  return _premultiplied;
+}
+
+
+void Image::mapFile(const char* path) throw(ImageException)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    throw ImageException("File not found: %s.", path);
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    close(fd);
+    throw ImageException("Unable to read %s.", path);
+  }
+
+  // The mapping is private and writable so callers can modify the pixels
+  // in place; pages only get copied if they actually do.
+  size_t size = size_t(info.st_size);
+  void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    throw ImageException("Unable to map %s into memory.", path);
+
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  _mapping = mapping;
+  _mappingSize = size;
+}
+
+
+void Image::unmapFile()
+{
+  if (_mapping == NULL)
+    return;
+
+  if (!_ownsPixels) {
+    _pixels = NULL;
+    _ownsPixels = true;
+  }
+  munmap(_mapping, _mappingSize);
+  _mapping = NULL;
+  _mappingSize = 0;
+}
+
+
+void Image::load(const char* ext, const unsigned char* data, size_t size) throw(ImageException)
+{
+  if (strcasecmp(ext, ".bmp") == 0)
+    loadBMP(data, size);
+  else if (strcasecmp(ext, ".tga") == 0)
+    loadTGA(data, size);
+  else
+    throw ImageException("Unknown image format: %s", ext);
 }
 
 
-void Image::loadBMP(FILE *file) throw(ImageException)
+void Image::loadBMP(const unsigned char* data, size_t size) throw(ImageException)
 {
   // Read the header data.
-  unsigned char file_header[14];
-  unsigned char info_header[40];
-  if (fread(file_header, sizeof(unsigned char), 14, file) < 14)
-    throw ImageException("Invalid or missing texture data.");
-  if (fread(info_header, sizeof(unsigned char), 40, file) < 40)
+  if (size < 54)
     throw ImageException("Invalid or missing texture data.");
+  const unsigned char* info_header = data + 14;
 
   // TODO: inspect the header data and return suitable errors for unsupported formats.
   _type = GL_BGR;
@@ -222,19 +576,22 @@ void Image::loadBMP(FILE *file) throw(ImageException)
             (unsigned int)info_header[10] << 16 |
             (unsigned int)info_header[11] << 24;
 
-  // Read the texture data.
-  unsigned int numBytes = _width * _height * _bytesPerPixel;
-  _pixels = new unsigned char[numBytes];
-  if (fread(_pixels, sizeof(unsigned char), numBytes, file) < numBytes)
+  // The texture data follows the headers. Note that it's in BGR order,
+  // which GL can take directly, so we use it in place.
+  size_t numBytes = size_t(_width) * _height * _bytesPerPixel;
+  if (numBytes > size - 54)
     throw ImageException("Invalid or missing texture data.");
-  // Note that the data from the file is in BGR order.
+  _pixels = const_cast<unsigned char*>(data + 54);
+  _ownsPixels = false;
 }
 
 
-void Image::loadTGA(FILE *file) throw(ImageException)
+void Image::loadTGA(const unsigned char* data, size_t size) throw(ImageException)
 {
-  unsigned char header[18];
-  fread(header, sizeof(unsigned char), 18, file);
+  if (size < 18)
+    throw ImageException("Missing or invalid TGA header.");
+
+  const unsigned char* header = data;
   if (header[1] != 0) // The colormap byte.
     throw ImageException("Colormap TGA files aren't supported.");
 
@@ -245,17 +602,28 @@ void Image::loadTGA(FILE *file) throw(ImageException)
   if (bitDepth != 32 && bitDepth != 24 && bitDepth != 8)
     throw ImageException("TGA files with a bit depth of %d aren't supported.", bitDepth);
 
+  // The image ID field (if any) sits between the header and the pixels.
+  size_t offset = 18 + header[0];
+  if (offset > size)
+    throw ImageException("Missing or invalid TGA image data.");
+
   unsigned int numPixels = _width * _height;
   _bytesPerPixel = bitDepth / 8;
-  _pixels = new unsigned char[numPixels * _bytesPerPixel];
+  size_t numBytes = size_t(numPixels) * _bytesPerPixel;
   switch (header[2]) { // The image type byte
     case 2: // TrueColor, uncompressed
     case 3: // Monochrome, uncompressed
-      tgaLoadUncompressed(file, numPixels, _bytesPerPixel, _pixels);
+      // These are already laid out the way glTexImage2D wants them, so we
+      // upload straight from the mapped file.
+      if (numBytes > size - offset)
+        throw ImageException("Missing or invalid TGA image data.");
+      _pixels = const_cast<unsigned char*>(data + offset);
+      _ownsPixels = false;
       break;
     case 10: // TrueColor, RLE compressed
     case 11: // Monochrome, RLE compressed
-      tgaLoadRLECompressed(file, numPixels, _bytesPerPixel, _pixels);
+      allocatePixels(numBytes);
+      tgaLoadRLECompressed(data + offset, size - offset, numPixels, _bytesPerPixel, _pixels);
       break;
     // Unsupported image types.
     default:
@@ -271,51 +639,57 @@ void Image::loadTGA(FILE *file) throw(ImageException)
 }
 
 
-void Image::tgaLoadUncompressed(FILE *file, unsigned int numPixels,
-    unsigned int bytesPerPixel, unsigned char *pixels)
+void Image::tgaLoadRLECompressed(const unsigned char* data, size_t size,
+    unsigned int numPixels, unsigned int bytesPerPixel, unsigned char *pixels)
   throw(ImageException)
 {
-  unsigned int numBytes = numPixels * bytesPerPixel;
-  if (fread(pixels, sizeof(unsigned char), numBytes, file) < numBytes)
-    throw ImageException("Missing or invalid TGA image data.");
-}
-
-
-void Image::tgaLoadRLECompressed(FILE *file, unsigned int numPixels,
-    unsigned int bytesPerPixel, unsigned char *pixels)
-  throw(ImageException)
-{
-  const int MAX_BYTES_PER_PIXEL = 4;
-
-  int pixelCount;
-  bool isEncoded;
+  const unsigned char* end = data + size;
 
   unsigned int pixelsRead = 0;
-  unsigned char pixel[MAX_BYTES_PER_PIXEL];
   while (pixelsRead < numPixels) {
-    pixelCount = fgetc(file);
-    if (pixelCount == EOF)
+    if (data >= end)
       throw ImageException("Missing or invalid TGA image data.");
 
-    isEncoded = pixelCount > 127;
+    unsigned int pixelCount = *data++;
+    bool isEncoded = pixelCount > 127;
     pixelCount = (pixelCount & 0x7F) + 1;
+    if (pixelCount > numPixels - pixelsRead)
+      throw ImageException("Invalid TGA image data: run extends past the end of the image.");
+
     if (isEncoded) {
-      if (fread(pixel, sizeof(unsigned char), bytesPerPixel, file) < bytesPerPixel)
+      if (size_t(end - data) < bytesPerPixel)
         throw ImageException("Missing or invalid TGA image data.");
-      for (int i = 0; i < pixelCount; ++i) {
-        memcpy(pixels, pixel, bytesPerPixel);
-        pixels += bytesPerPixel;
-      }
+      FillRun(pixels, data, pixelCount, bytesPerPixel);
+      pixels += pixelCount * bytesPerPixel;
+      data += bytesPerPixel;
     } else {
-      unsigned int numBytes = pixelCount * bytesPerPixel;
-      if (fread(pixels, sizeof(unsigned char), numBytes, file) < numBytes)
+      size_t numBytes = size_t(pixelCount) * bytesPerPixel;
+      if (size_t(end - data) < numBytes)
         throw ImageException("Missing or invalid TGA image data.");
+      memcpy(pixels, data, numBytes);
       pixels += numBytes;
+      data += numBytes;
     }
     pixelsRead += pixelCount;
   }
 }
 
 
+void Image::allocatePixels(size_t numBytes)
+{
+  _pixels = new unsigned char[numBytes];
+  _ownsPixels = true;
+}
+
+
+void Image::freePixels()
+{
+  if (_ownsPixels)
+    delete[] _pixels;
+  _pixels = NULL;
+  _ownsPixels = true;
+}
+
+
 } // namespace cat
 
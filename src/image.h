@@ -1,7 +1,7 @@
 #ifndef cat_image_h
 #define cat_image_h
 
-#include <cstdio>
+#include <cstddef>
 #include <stdexcept>
 
 namespace cat {
@@ -21,6 +21,10 @@ public:
 class Image {
 public:
   Image(const char* path) throw(ImageException);
+  //! Decodes an image file which has already been loaded into memory. name
+  //! is only used to work out the file format. The image doesn't keep any
+  //! pointers into data.
+  Image(const char* name, const unsigned char* data, size_t size) throw(ImageException);
   Image(int type, int bytesPerPixel, int width, int height);
   Image(const Image& img);
   ~Image();
@@ -30,6 +34,10 @@ public:
   unsigned int getWidth() const;
   unsigned int getHeight() const;
   unsigned char* getPixels();
+  //! The GL type to upload the pixels with. Usually GL_UNSIGNED_BYTE, but
+  //! BGRA images use GL_UNSIGNED_INT_8_8_8_8_REV, which is the layout most
+  //! GPUs store textures in natively.
+  int getDataType() const;
 
   unsigned int getTexID() const;
   void uploadTexture(unsigned int texID = 0);
@@ -44,18 +52,41 @@ public:
   //! entire object.
   void deletePixels();
 
+  //! True if the pixels point straight into the memory-mapped file rather
+  //! than into a buffer of their own.
+  bool isMapped() const;
+
+  //! Converts the pixels to 4 bytes per pixel, BGRA order, so that uploads
+  //! don't need any conversion by the driver. BGR images get an opaque alpha
+  //! channel; alpha-only images become white with the same alpha.
+  void convertToBGRA();
+
+  //! Swaps the red and blue channels of a 4 byte per pixel image, converting
+  //! between BGRA and RGBA.
+  void swapRedBlue();
+
+  //! Multiplies the colour channels of a 4 byte per pixel image by its
+  //! alpha. Draw premultiplied images with glBlendFunc(GL_ONE,
+  //! GL_ONE_MINUS_SRC_ALPHA). Does nothing if the image is already
+  //! premultiplied.
+  void premultiplyAlpha();
+  bool isPremultiplied() const;
+
 private:
-  void loadBMP(FILE* file) throw(ImageException);
-  void loadTGA(FILE* file) throw(ImageException);
+  void mapFile(const char* path) throw(ImageException);
+  void unmapFile();
 
-  void tgaLoadUncompressed(FILE* file, unsigned int numPixels,
-      unsigned int bytesPerPixel, unsigned char *pixels)
-    throw(ImageException);
+  void load(const char* ext, const unsigned char* data, size_t size) throw(ImageException);
+  void loadBMP(const unsigned char* data, size_t size) throw(ImageException);
+  void loadTGA(const unsigned char* data, size_t size) throw(ImageException);
 
-  void tgaLoadRLECompressed(FILE* file, unsigned int numPixels,
-      unsigned int bytesPerPixel, unsigned char *pixels)
+  void tgaLoadRLECompressed(const unsigned char* data, size_t size,
+      unsigned int numPixels, unsigned int bytesPerPixel, unsigned char *pixels)
     throw(ImageException);
 
+  void allocatePixels(size_t numBytes);
+  void freePixels();
+
 private:
   int _type;
   unsigned int _texId;
@@ -63,6 +94,10 @@ private:
   unsigned int _width;
   unsigned int _height;
   unsigned char* _pixels;
+  bool _ownsPixels;     // False if _pixels points into _mapping.
+  void* _mapping;       // The image file, mapped copy-on-write.
+  size_t _mappingSize;
+  bool _premultiplied;
 };
 
 
@@ -0,0 +1,328 @@
+#include "input.h"
+
+#include "atomic.h"
+
+#include <cassert>
+#include <cmath>
+
+namespace cat {
+
+  //
+  // Forward declarations
+  //
+
+  PlayerInput HeldDirections(const WindowData& window);
+  PlayerInput HeldButtons(const WindowData& window);
+  PlayerInput DirectionBit(int key);
+  PlayerInput ButtonBit(int key);
+  bool IsAnyKey(int key);
+  int NextQueue(InputQueue* const* queues, int numQueues, double before, InputEvent& event);
+  PlayerInput PackStickAxis(double value);
+  double UnpackStickAxis(PlayerInput input, int shift);
+
+
+  //
+  // InputEvent public methods
+  //
+
+  InputEvent::InputEvent() :
+    time(0),
+    key(0),
+    down(false),
+    value(0)
+  {
+  }
+
+
+  InputEvent::InputEvent(double time, int key, bool down) :
+    time(time),
+    key(key),
+    down(down),
+    value(0)
+  {
+  }
+
+
+  InputEvent::InputEvent(double time, int axis, float value) :
+    time(time),
+    key(axis),
+    down(false),
+    value(value)
+  {
+  }
+
+
+  //
+  // InputQueue public methods
+  //
+
+  InputQueue::InputQueue() :
+    _head(0),
+    _tail(0)
+  {
+  }
+
+
+  bool InputQueue::push(const InputEvent& event)
+  {
+    int tail = _tail;
+    if (tail - AtomicLoad(&_head) >= kInputQueueSize)
+      return false;
+
+    _events[tail & (kInputQueueSize - 1)] = event;
+    AtomicStore(&_tail, tail + 1);
+    return true;
+  }
+
+
+  bool InputQueue::peek(InputEvent& event)
+  {
+    int head = _head;
+    if (head == AtomicLoad(&_tail))
+      return false;
+
+    event = _events[head & (kInputQueueSize - 1)];
+    return true;
+  }
+
+
+  bool InputQueue::pop()
+  {
+    int head = _head;
+    if (head == AtomicLoad(&_tail))
+      return false;
+
+    AtomicStore(&_head, head + 1);
+    return true;
+  }
+
+
+  //
+  // Functions
+  //
+
+  void SetKey(WindowData& window, int key, bool down, int source)
+  {
+    if (key == kAxisX || key == kAxisY)
+      return;
+
+    assert(key >= 0 && key < kNumHeldKeys);
+    assert(source >= 0 && source < kMaxInputSources);
+    unsigned char bit = (unsigned char)(1 << source);
+    if (down)
+      window.keySources[key] |= bit;
+    else
+      window.keySources[key] &= ~bit;
+    bool held = (window.keySources[key] != 0);
+
+    switch (key) {
+      case kKeyLeft:
+        window.leftPressed = held;
+        break;
+      case kKeyRight:
+        window.rightPressed = held;
+        break;
+      case kKeyUp:
+        window.upPressed = held;
+        break;
+      case kKeyDown:
+        window.downPressed = held;
+        break;
+      default:
+        if (window.keyPressed[key] != held) {
+          window.keyPressed[key] = held;
+          if (IsAnyKey(key))
+            window.keysDown += held ? 1 : -1;
+        }
+        break;
+    }
+  }
+
+
+  bool KeyDown(const WindowData& window, int key)
+  {
+    switch (key) {
+      case kKeyLeft:
+        return window.leftPressed;
+      case kKeyRight:
+        return window.rightPressed;
+      case kKeyUp:
+        return window.upPressed;
+      case kKeyDown:
+        return window.downPressed;
+      case kAxisX:
+      case kAxisY:
+        return false;
+      default:
+        assert(key >= 0 && key < 256);
+        return window.keyPressed[key];
+    }
+  }
+
+
+  bool AnyKeyPressed(const WindowData& window)
+  {
+    return window.keysDown > 0 || window.anyKeyHit;
+  }
+
+
+  PlayerInput ConsumeInputEvents(InputQueue* const* queues, int numQueues, WindowData& window,
+                                 double stepStart, double stepEnd)
+  {
+    assert(numQueues <= kMaxInputSources);
+    double substepTime = (stepEnd - stepStart) / kInputSubsteps;
+
+    window.anyKeyHit = false;
+    PlayerInput input = 0;
+    PlayerInput buttonsHit = 0;
+    InputEvent event;
+    for (int i = 0; i < kInputSubsteps; ++i) {
+      double substepEnd = (i == kInputSubsteps - 1) ? stepEnd : stepStart + substepTime * (i + 1);
+
+      PlayerInput directions = HeldDirections(window);
+      int source;
+      while ((source = NextQueue(queues, numQueues, substepEnd, event)) >= 0) {
+        queues[source]->pop();
+        if (event.key == kAxisX) {
+          window.stick.x = event.value;
+          continue;
+        }
+        if (event.key == kAxisY) {
+          window.stick.y = event.value;
+          continue;
+        }
+        if (event.down && !KeyDown(window, event.key)) {
+          directions |= DirectionBit(event.key);
+          buttonsHit |= ButtonBit(event.key);
+          if (IsAnyKey(event.key))
+            window.anyKeyHit = true;
+        }
+        SetKey(window, event.key, event.down, source);
+      }
+      input |= directions << (i * kInputDirectionBits);
+    }
+
+    input |= buttonsHit | HeldButtons(window);
+    return SetInputStick(input, window.stick);
+  }
+
+
+  PlayerInput SetInputStick(PlayerInput input, const Vec2& stick)
+  {
+    const PlayerInput kMask = (1u << kInputStickBits) - 1;
+    input &= ~(kMask << kInputStickXShift | kMask << kInputStickYShift);
+    return input | PackStickAxis(stick.x) << kInputStickXShift |
+                   PackStickAxis(stick.y) << kInputStickYShift;
+  }
+
+
+  Vec2 InputStick(PlayerInput input)
+  {
+    Vec2 stick(UnpackStickAxis(input, kInputStickXShift),
+               UnpackStickAxis(input, kInputStickYShift));
+    // The corners of the square are further out than a stick can go.
+    if (LengthSqr(stick) > 1.0)
+      stick = Unit(stick);
+    return stick;
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  PlayerInput HeldDirections(const WindowData& window)
+  {
+    PlayerInput directions = 0;
+    if (window.leftPressed)
+      directions |= eInputLeft;
+    if (window.rightPressed)
+      directions |= eInputRight;
+    if (window.upPressed)
+      directions |= eInputUp;
+    if (window.downPressed)
+      directions |= eInputDown;
+    return directions;
+  }
+
+
+  PlayerInput HeldButtons(const WindowData& window)
+  {
+    PlayerInput buttons = 0;
+    if (window.keyPressed['s'])
+      buttons |= eInputSuperposition;
+    if (window.keyPressed['d'])
+      buttons |= eInputEntanglement;
+    return buttons;
+  }
+
+
+  PlayerInput DirectionBit(int key)
+  {
+    switch (key) {
+      case kKeyLeft:  return eInputLeft;
+      case kKeyRight: return eInputRight;
+      case kKeyUp:    return eInputUp;
+      case kKeyDown:  return eInputDown;
+      default:        return 0;
+    }
+  }
+
+
+  PlayerInput ButtonBit(int key)
+  {
+    switch (key) {
+      case 's': return eInputSuperposition;
+      case 'd': return eInputEntanglement;
+      default:  return 0;
+    }
+  }
+
+
+  // Whether the key counts towards AnyKeyPressed. Holding 'r' rewinds, so it
+  // mustn't also start a game or unpause one.
+  bool IsAnyKey(int key)
+  {
+    return key < 256 && key != 'r';
+  }
+
+
+  // Finds the queue whose next event is the earliest one before the given
+  // time, copies that event into event and returns the queue's index. Returns
+  // -1 if there isn't one.
+  int NextQueue(InputQueue* const* queues, int numQueues, double before, InputEvent& event)
+  {
+    int next = -1;
+    InputEvent candidate;
+    for (int i = 0; i < numQueues; ++i) {
+      if (queues[i]->peek(candidate) && candidate.time < before &&
+          (next < 0 || candidate.time < event.time)) {
+        next = i;
+        event = candidate;
+      }
+    }
+    return next;
+  }
+
+
+  PlayerInput PackStickAxis(double value)
+  {
+    if (value > 1.0)
+      value = 1.0;
+    else if (value < -1.0)
+      value = -1.0;
+    int packed = int(floor(value * kInputStickMax + 0.5));
+    return PlayerInput(packed) & ((1u << kInputStickBits) - 1);
+  }
+
+
+  double UnpackStickAxis(PlayerInput input, int shift)
+  {
+    const int kSignBit = 1 << (kInputStickBits - 1);
+    int packed = int((input >> shift) & ((1u << kInputStickBits) - 1));
+    packed = (packed ^ kSignBit) - kSignBit;
+    return double(packed) / kInputStickMax;
+  }
+
+} // namespace cat
+
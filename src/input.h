@@ -0,0 +1,104 @@
+#ifndef cat_input_h
+#define cat_input_h
+
+#include "gamedata.h"
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  // Key codes for the arrow keys, following on from the character codes.
+  static const int kKeyLeft = 256;
+  static const int kKeyRight = 257;
+  static const int kKeyUp = 258;
+  static const int kKeyDown = 259;
+
+  // Codes for the axes of a joystick's analog stick.
+  static const int kAxisX = 260;
+  static const int kAxisY = 261;
+
+  // Must be a power of two.
+  static const int kInputQueueSize = 256;
+
+
+  //
+  // Types
+  //
+
+  struct InputEvent {
+    double time;  // When it happened, on the same clock as the simulation's steps.
+    int key;      // A character code, or one of the kKey or kAxis constants above.
+    bool down;    // For keys.
+    float value;  // For axes: the new position, from -1 to 1.
+
+    InputEvent();
+    InputEvent(double time, int key, bool down);
+    InputEvent(double time, int axis, float value);
+  };
+
+
+  // Lock-free queue for passing input events from the thread which reads a
+  // device (the only producer) to the simulation thread (the only consumer).
+  // Neither side ever blocks; if the queue is full, new events are dropped.
+  // Each device gets a queue of its own.
+  class InputQueue {
+  public:
+    InputQueue();
+
+    // Producer side. Returns false if the event was dropped.
+    bool push(const InputEvent& event);
+
+    // Consumer side. Both return false if the queue is empty.
+    bool peek(InputEvent& event);
+    bool pop();
+
+  private:
+    InputEvent _events[kInputQueueSize];
+    // Only the consumer writes _head and only the producer writes _tail.
+    // Both count up forever and are wrapped when used as an index.
+    volatile int _head;
+    volatile int _tail;
+  };
+
+
+  //
+  // Functions
+  //
+
+  // Sets whether a key is held down by the given source (a keyboard, a
+  // joystick, and so on), keeping window.keysDown in step. A key stays down
+  // until every source holding it has released it. Session controllers should
+  // use this rather than setting the flags directly.
+  void SetKey(WindowData& window, int key, bool down, int source = 0);
+  // True if any source is holding the key down.
+  bool KeyDown(const WindowData& window, int key);
+
+  // True if any key other than the arrows or 'r' is held down, or was pressed during
+  // the last step. Doesn't have to look at every key to find out.
+  bool AnyKeyPressed(const WindowData& window);
+
+  // Applies every queued event from before stepEnd to window, in time order
+  // across all the queues, and returns the player's input for a step covering
+  // stepStart to stepEnd. Each substep moves in the directions held at its
+  // start plus any pressed during it, so a tap shorter than a step still
+  // moves the player, and a press near the end of a step only moves them for
+  // the rest of that step. The stick is wherever it was at the end of the
+  // step. Events at or after stepEnd are left queued for the next step.
+  // Each queue is a separate source for SetKey, so releasing a key on one
+  // device doesn't let go of it on another; there can be at most
+  // kMaxInputSources of them.
+  PlayerInput ConsumeInputEvents(InputQueue* const* queues, int numQueues, WindowData& window,
+                                 double stepStart, double stepEnd);
+
+  // Packs a stick position into input, replacing any already there. Values
+  // outside -1 to 1 are clamped.
+  PlayerInput SetInputStick(PlayerInput input, const Vec2& stick);
+  // Unpacks the stick position from input. It's never longer than 1.
+  Vec2 InputStick(PlayerInput input);
+
+} // namespace cat
+
+#endif // cat_input_h
+
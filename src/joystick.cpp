@@ -0,0 +1,368 @@
+#include "joystick.h"
+
+#include "atomic.h"
+#include "input.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef linux
+#include <fcntl.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#endif
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  // How often the joystick thread checks whether it's been asked to stop.
+  static const int kStopCheckMillis = 250;
+
+  // How many /dev/input/eventN devices to look through for a gamepad.
+  static const int kMaxEventDevices = 32;
+
+  // Fraction of each half of an axis's range which counts as centred, for
+  // devices which don't say how much of it is noise.
+  static const float kDefaultDeadZone = 0.1f;
+
+
+  //
+  // Types
+  //
+
+  struct AxisRange {
+    int min;
+    int max;
+    int flat;   // Raw values within this much of the centre count as zero.
+  };
+
+
+  struct Joystick {
+    int fd;
+    InputQueue* queue;
+    pthread_t thread;
+    volatile int stop;
+
+    AxisRange xRange;
+    AxisRange yRange;
+    // Last values sent, so we only send changes.
+    float x;
+    float y;
+    int hatX;
+    int hatY;
+
+    Joystick(int fd, InputQueue* queue);
+    ~Joystick();
+  };
+
+
+  //
+  // Forward declarations
+  //
+
+  int OpenGamepad(const char* device);
+  bool IsGamepad(int fd);
+  bool TestBit(const unsigned long* bits, int bit);
+  AxisRange ReadAxisRange(int fd, int axis);
+  void* JoystickThread(void* arg);
+  void HandleJoystickEvent(Joystick* joystick, double time, int type, int code, int value);
+  void SendAxis(Joystick* joystick, double time, int axis, float value, float& last);
+  void SendHat(Joystick* joystick, double time, int value, int& last, int negativeKey, int positiveKey);
+  float NormaliseAxis(const AxisRange& range, int value);
+  void ReleaseAll(Joystick* joystick, double time);
+  double EventTime(const struct timeval& t);
+
+
+  //
+  // Joystick public methods
+  //
+
+  Joystick::Joystick(int fd, InputQueue* queue) :
+    fd(fd),
+    queue(queue),
+    thread(),
+    stop(0),
+    x(0),
+    y(0),
+    hatX(0),
+    hatY(0)
+  {
+  }
+
+
+  Joystick::~Joystick()
+  {
+    if (fd >= 0)
+      close(fd);
+  }
+
+
+  //
+  // Public functions
+  //
+
+  Joystick* StartJoystick(const char* device, InputQueue* queue)
+  {
+#ifdef linux
+    assert(queue != NULL);
+
+    int fd = OpenGamepad(device);
+    if (fd < 0)
+      return NULL;
+
+    Joystick* joystick = new Joystick(fd, queue);
+    joystick->xRange = ReadAxisRange(fd, ABS_X);
+    joystick->yRange = ReadAxisRange(fd, ABS_Y);
+    if (pthread_create(&joystick->thread, NULL, JoystickThread, joystick) != 0) {
+      delete joystick;
+      return NULL;
+    }
+    return joystick;
+#else
+    return NULL;
+#endif
+  }
+
+
+  void StopJoystick(Joystick* joystick)
+  {
+    if (joystick == NULL)
+      return;
+    AtomicStore(&joystick->stop, 1);
+    pthread_join(joystick->thread, NULL);
+    delete joystick;
+  }
+
+
+  //
+  // Internal functions
+  //
+
+#ifdef linux
+
+  // Returns an open file descriptor for the device, or -1.
+  int OpenGamepad(const char* device)
+  {
+    int fd = -1;
+    if (device != NULL) {
+      fd = open(device, O_RDONLY | O_NONBLOCK);
+      if (fd < 0)
+        fprintf(stderr, "Unable to open joystick %s: %s\n", device, strerror(errno));
+    }
+    else {
+      for (int i = 0; i < kMaxEventDevices && fd < 0; ++i) {
+        char path[32];
+        snprintf(path, sizeof(path), "/dev/input/event%d", i);
+        fd = open(path, O_RDONLY | O_NONBLOCK);
+        if (fd >= 0 && !IsGamepad(fd)) {
+          close(fd);
+          fd = -1;
+        }
+      }
+    }
+
+    // Ask for timestamps from the same clock as gettimeofday, which is what
+    // the keyboard events are stamped with. This is the default anyway, so
+    // it doesn't matter if the device won't let us.
+    if (fd >= 0) {
+      int clock = CLOCK_REALTIME;
+      ioctl(fd, EVIOCSCLOCKID, &clock);
+    }
+    return fd;
+  }
+
+
+  // Anything with a stick and gamepad or joystick buttons will do.
+  bool IsGamepad(int fd)
+  {
+    const int kBitsPerLong = sizeof(unsigned long) * 8;
+    unsigned long absBits[ABS_MAX / kBitsPerLong + 1];
+    unsigned long keyBits[KEY_MAX / kBitsPerLong + 1];
+    memset(absBits, 0, sizeof(absBits));
+    memset(keyBits, 0, sizeof(keyBits));
+
+    if (ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(absBits)), absBits) < 0 ||
+        ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keyBits)), keyBits) < 0)
+      return false;
+
+    return TestBit(absBits, ABS_X) && TestBit(absBits, ABS_Y) &&
+           (TestBit(keyBits, BTN_GAMEPAD) || TestBit(keyBits, BTN_JOYSTICK));
+  }
+
+
+  bool TestBit(const unsigned long* bits, int bit)
+  {
+    const int kBitsPerLong = sizeof(unsigned long) * 8;
+    return (bits[bit / kBitsPerLong] >> (bit % kBitsPerLong)) & 1;
+  }
+
+
+  AxisRange ReadAxisRange(int fd, int axis)
+  {
+    AxisRange range;
+    struct input_absinfo info;
+    if (ioctl(fd, EVIOCGABS(axis), &info) == 0 && info.maximum > info.minimum) {
+      range.min = info.minimum;
+      range.max = info.maximum;
+      range.flat = info.flat;
+    }
+    else {
+      range.min = -32768;
+      range.max = 32767;
+      range.flat = 0;
+    }
+    if (range.flat == 0)
+      range.flat = int((range.max - range.min) / 2 * kDefaultDeadZone);
+    return range;
+  }
+
+
+  void* JoystickThread(void* arg)
+  {
+    Joystick* joystick = static_cast<Joystick*>(arg);
+
+    struct input_event events[64];
+    while (!AtomicLoad(&joystick->stop)) {
+      struct pollfd pfd;
+      pfd.fd = joystick->fd;
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, kStopCheckMillis) <= 0)
+        continue;
+
+      ssize_t len = read(joystick->fd, events, sizeof(events));
+      if (len < 0 && (errno == EAGAIN || errno == EINTR))
+        continue;
+      if (len <= 0) {
+        // Unplugged. Let go of everything so the player doesn't keep moving.
+        fprintf(stderr, "Lost the joystick.\n");
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        ReleaseAll(joystick, EventTime(now));
+        break;
+      }
+
+      for (size_t i = 0; i < size_t(len) / sizeof(struct input_event); ++i) {
+        const struct input_event& ev = events[i];
+        HandleJoystickEvent(joystick, EventTime(ev.time), ev.type, ev.code, ev.value);
+      }
+    }
+    return NULL;
+  }
+
+
+  void HandleJoystickEvent(Joystick* joystick, double time, int type, int code, int value)
+  {
+    if (type == EV_ABS) {
+      switch (code) {
+        case ABS_X:
+          SendAxis(joystick, time, kAxisX, NormaliseAxis(joystick->xRange, value), joystick->x);
+          break;
+        case ABS_Y:
+          // The device has y going down.
+          SendAxis(joystick, time, kAxisY, -NormaliseAxis(joystick->yRange, value), joystick->y);
+          break;
+        case ABS_HAT0X:
+          SendHat(joystick, time, value, joystick->hatX, kKeyLeft, kKeyRight);
+          break;
+        case ABS_HAT0Y:
+          SendHat(joystick, time, value, joystick->hatY, kKeyUp, kKeyDown);
+          break;
+        default:
+          break;
+      }
+    }
+    else if (type == EV_KEY && value != 2) { // 2 is auto-repeat.
+      int key = -1;
+      switch (code) {
+        case BTN_SOUTH:       key = 's';        break;
+        case BTN_EAST:        key = 'd';        break;
+        case BTN_DPAD_LEFT:   key = kKeyLeft;   break;
+        case BTN_DPAD_RIGHT:  key = kKeyRight;  break;
+        case BTN_DPAD_UP:     key = kKeyUp;     break;
+        case BTN_DPAD_DOWN:   key = kKeyDown;   break;
+        default:                                break;
+      }
+      if (key >= 0)
+        joystick->queue->push(InputEvent(time, key, value != 0));
+    }
+  }
+
+
+  void SendAxis(Joystick* joystick, double time, int axis, float value, float& last)
+  {
+    if (value == last)
+      return;
+    if (joystick->queue->push(InputEvent(time, axis, value)))
+      last = value;
+  }
+
+
+  void SendHat(Joystick* joystick, double time, int value, int& last, int negativeKey, int positiveKey)
+  {
+    if (value == last)
+      return;
+    if (last != 0)
+      joystick->queue->push(InputEvent(time, last < 0 ? negativeKey : positiveKey, false));
+    if (value != 0)
+      joystick->queue->push(InputEvent(time, value < 0 ? negativeKey : positiveKey, true));
+    last = value;
+  }
+
+
+  // Maps a raw value to -1..1, with the dead zone in the middle mapping to 0
+  // and the rest of the range scaled to fill the gap it leaves.
+  float NormaliseAxis(const AxisRange& range, int value)
+  {
+    float centre = (range.min + range.max) / 2.0f;
+    float halfRange = (range.max - range.min) / 2.0f;
+    float offset = value - centre;
+    float magnitude = (offset < 0) ? -offset : offset;
+    if (magnitude <= range.flat)
+      return 0.0f;
+
+    float result = (magnitude - range.flat) / (halfRange - range.flat);
+    if (result > 1.0f)
+      result = 1.0f;
+    return (offset < 0) ? -result : result;
+  }
+
+
+  void ReleaseAll(Joystick* joystick, double time)
+  {
+    SendAxis(joystick, time, kAxisX, 0.0f, joystick->x);
+    SendAxis(joystick, time, kAxisY, 0.0f, joystick->y);
+    SendHat(joystick, time, 0, joystick->hatX, kKeyLeft, kKeyRight);
+    SendHat(joystick, time, 0, joystick->hatY, kKeyUp, kKeyDown);
+    const int kButtons[] = { 's', 'd', kKeyLeft, kKeyRight, kKeyUp, kKeyDown };
+    for (size_t i = 0; i < sizeof(kButtons) / sizeof(kButtons[0]); ++i)
+      joystick->queue->push(InputEvent(time, kButtons[i], false));
+  }
+
+
+  // In milliseconds, like Now() in main.cpp.
+  double EventTime(const struct timeval& t)
+  {
+    return t.tv_sec * 1000.0 + t.tv_usec / 1000.0;
+  }
+
+#else
+
+  void* JoystickThread(void* arg)
+  {
+    return NULL;
+  }
+
+#endif
+
+} // namespace cat
+
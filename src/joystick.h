@@ -0,0 +1,33 @@
+#ifndef cat_joystick_h
+#define cat_joystick_h
+
+namespace cat {
+
+  //
+  // Forward type declarations
+  //
+
+  class InputQueue;
+  struct Joystick;  // Opaque; see joystick.cpp for details.
+
+
+  //
+  // Functions
+  //
+
+  // Reads a gamepad on a background thread, so its input doesn't wait on
+  // anything the render thread is doing. Events go into queue, timestamped on
+  // the same clock as the keyboard's: the left stick as kAxisX and kAxisY,
+  // the d-pad as the arrow keys, and the bottom and right face buttons as
+  // 's' and 'd'. The queue must outlive the joystick.
+  //
+  // If device is NULL, the first gamepad found under /dev/input is used.
+  // Returns NULL if joysticks aren't supported on this platform or there
+  // isn't one.
+  Joystick* StartJoystick(const char* device, InputQueue* queue);
+  void StopJoystick(Joystick* joystick);
+
+} // namespace cat
+
+#endif // cat_joystick_h
+
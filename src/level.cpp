@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <sstream>
 
 namespace cat {
@@ -39,7 +40,7 @@ namespace cat {
   }
 
 
-  void Level::randomise(int numAtoms, double emitFrequency, double maxSpeed, double minSpeed)
+  void Level::randomise(unsigned short randomState[3], int numAtoms, double emitFrequency, double maxSpeed, double minSpeed)
   {
     const std::string adjective[] = {
       "Random",
@@ -64,48 +65,48 @@ namespace cat {
     const double kNormalThresh = 0.95;
     const double kSuperpositionThresh = 0.99;
 
-    int adjectiveIndex = int(drand48() * kNumAdjectives) % kNumAdjectives;
-    int nounIndex = int(drand48() * kNumNouns) % kNumNouns;
+    int adjectiveIndex = int(erand48(randomState) * kNumAdjectives) % kNumAdjectives;
+    int nounIndex = int(erand48(randomState) * kNumNouns) % kNumNouns;
     std::ostringstream buf;
     buf << adjective[adjectiveIndex] << " " << noun[nounIndex];
     
     while (numAtoms <= 0)
-      numAtoms = int(drand48() * 64) % 64;
+      numAtoms = int(erand48(randomState) * 64) % 64;
 
     while (emitFrequency <= 0)
-      emitFrequency = drand48() * 1000.0;
+      emitFrequency = erand48(randomState) * 1000.0;
 
     name = buf.str();
     duration = emitFrequency * numAtoms + 5000.0;
     maxAtomCount = 0;
     
     for (int i = 0; i < numAtoms; ++i) {
-      double typeVal = drand48();
+      double typeVal = erand48(randomState);
       AtomType type = eAtomNormal;
       if (typeVal > kNormalThresh)
         type = (typeVal > kSuperpositionThresh) ? eAtomEntanglement : eAtomSuperposition;
 
       // Random emit position along any wall.
-      int wall = int(drand48() * 4) % 4;
-      float angle = (drand48() * 0.9 + 0.05) * M_PI; // in radians, 0 is parallel to +ve x axis, pi/2 is +ve y axis
-      float speed = drand48() * (maxSpeed - minSpeed) + minSpeed;
+      int wall = int(erand48(randomState) * 4) % 4;
+      float angle = (erand48(randomState) * 0.9 + 0.05) * M_PI; // in radians, 0 is parallel to +ve x axis, pi/2 is +ve y axis
+      float speed = erand48(randomState) * (maxSpeed - minSpeed) + minSpeed;
 
       Vec2 pos;
       switch (wall) {
       case 0: // left wall
-        pos = Vec2(0, drand48());
+        pos = Vec2(0, erand48(randomState));
         angle += M_PI_2;
         break;
       case 1: // top wall
-        pos = Vec2(drand48(), 1);
+        pos = Vec2(erand48(randomState), 1);
         angle += M_PI;
         break;
       case 2: // right wall
-        pos = Vec2(1, drand48());
+        pos = Vec2(1, erand48(randomState));
         angle -= M_PI_2;
         break;
       case 3: // bottom wall
-        pos = Vec2(drand48(), 0);
+        pos = Vec2(erand48(randomState), 0);
         break;
       }
 
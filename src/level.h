@@ -45,8 +45,9 @@ namespace cat {
     // Call this repeatedly to add fixed initial atom data.
     void addAtom(AtomType type, double t, const Vec2& pos, const Vec2& vel);
 
-    // Call this once to generate a random level.
-    void randomise(int numAtoms = -1, double emitFrequency = -1.0, double maxSpeed = 0.004, double minSpeed = 0.001);
+    // Call this once to generate a random level. The random numbers come
+    // from randomState (see erand48), which is advanced as they're used.
+    void randomise(unsigned short randomState[3], int numAtoms = -1, double emitFrequency = -1.0, double maxSpeed = 0.004, double minSpeed = 0.001);
 
     // Reset the dynamic data, ready to play the level again.
     void startLevel();
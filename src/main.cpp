@@ -2,10 +2,13 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <libgen.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
+#include <vector>
 
 #ifdef linux
 #include <GL/gl.h>
@@ -17,8 +20,21 @@
 #include <GLUT/glut.h>
 #endif
 
+#include "atomic.h"
+#include "audio.h"
 #include "drawing.h"
+#include "framestate.h"
 #include "gamedata.h"
+#include "glstate.h"
+#include "input.h"
+#include "joystick.h"
+#include "metrics.h"
+#include "netplay.h"
+#include "profiler.h"
+#include "resource.h"
+#include "sessionrunner.h"
+#include "simulation.h"
+#include "snapshot.h"
 
 namespace cat {
 
@@ -29,10 +45,71 @@ namespace cat {
   const char* kGameName = "Schroedinger's Cat: The Game";
   const char* kCopyrightMessage = "(c) Vilya Harvey, 2011";
 
+  // The archive the build packages the game into (see the Makefile), and
+  // where the resources are inside it.
+  static const char* kResourceArchiveName = "SchroedingersCat.zip";
+  static const char* kResourceArchivePrefix = "resource/";
+
   static const int kWindowWidth = 800;
   static const int kWindowHeight = 800;
 
-  static const double kMinFrameTime = 1000.0 / 60.0; // Targetting 60 fps.
+  // Memory for rewinding; enough for several seconds on the busiest level.
+  static const size_t kRewindBufferSize = 512 * 1024;
+
+  // Longest a headless session may run for: half an hour of game time.
+  static const long kMaxSessionSteps = 30 * 60 * 60;
+
+  // How long the render thread waits between checks for a new frame when the
+  // simulation hasn't published one yet.
+  static const double kRenderPollTime = 1.0;
+
+  // A frame which takes longer than this to render gets a trace written out,
+  // at most once per kSlowFrameTraceInterval (which also keeps loading from
+  // counting). 'p' writes one whenever you like.
+  static const double kSlowFrameTime = 100.0;
+  static const double kSlowFrameTraceInterval = 10000.0;
+  static const char* kSlowFrameTraceFile = "trace-slow-frame.json";
+  static const char* kTraceFile = "trace.json";
+
+
+  //
+  // Global variables
+  //
+
+  // Guards the GameData against concurrent modification. The simulation
+  // thread holds it while stepping; the input callbacks (which run on the
+  // GLUT thread) take it before changing anything. Rendering never takes it:
+  // it only reads the snapshots in gGameData->frames.
+  static pthread_mutex_t gSimLock = PTHREAD_MUTEX_INITIALIZER;
+
+  // The connection to the other player, in a versus game.
+  static NetPlay* gNetPlay = NULL;
+
+  // Key presses and releases, from the input callbacks to the simulation
+  // thread. Going through here rather than gSimLock means the simulation
+  // knows when each one happened, and sees taps which are over before the
+  // next step.
+  static InputQueue gInputQueue;
+
+  // The gamepad, if there is one, and its events.
+  static Joystick* gJoystick = NULL;
+  static InputQueue gJoystickQueue;
+
+  static const double kFrameTimeBounds[] = { 5, 10, 1000.0 / 60.0, 20, 1000.0 / 30.0, 50, 100, 250 };
+  static Metric* gFramesMetric = RegisterCounter("cat_frames_total", "Frames rendered.");
+  static Metric* gFrameTimeMetric = RegisterHistogram(
+      "cat_frame_time_milliseconds", "Time from the start of one frame to the start of the next.",
+      kFrameTimeBounds, sizeof(kFrameTimeBounds) / sizeof(kFrameTimeBounds[0]));
+  static Metric* gRewindMemoryMetric = RegisterGauge(
+      "cat_memory_bytes", "Memory in use, by subsystem.", "subsystem=\"rewind\"");
+  static Metric* gFrameStateMemoryMetric = RegisterGauge(
+      "cat_memory_bytes", "Memory in use, by subsystem.", "subsystem=\"frame_states\"");
+
+  static MetricsServer* gMetricsServer = NULL;
+
+  // Set while a trace is being written on a background thread, so that there's
+  // only ever one going at a time.
+  static volatile int gWritingTrace = 0;
 
 
   //
@@ -41,22 +118,30 @@ namespace cat {
 
   void Start();
   void Render();
+  void DrawFrame();
   void Resize(int x, int y);
   void KeyPressed(unsigned char key, int x, int y);
   void KeyReleased(unsigned char key, int x, int y);
   void SpecialKeyPressed(int key, int x, int y);
   void SpecialKeyReleased(int key, int x, int y);
+  int SpecialKeyCode(int key);
   void MainLoop();
 
-  void UpdateAtoms(GameData* game);
-  void UpdatePlayer(GameData* game);
-  void UpdateGameState(GameData* game);
+  // Registered with atexit, since GLUT gives us no other chance to clean up:
+  // finishes the WAV file, if there is one, and removes the metrics socket.
+  void Shutdown();
+
+  void StartSimulationThread();
+  void* SimulationThread(void* arg);
 
-  void StartNewGame(GameData* game);
-  void StartNewLife(GameData* game);
+  // Writes a profile trace to path on a background thread, so that rendering
+  // doesn't stall while it's written. Returns false if one is already being
+  // written.
+  bool StartTraceWriter(const char* path);
+  void* TraceWriterThread(void* arg);
 
-  void SetGameState(GameData* game, GameState state);
-  void SetPowerUp(GameData* game, PowerUp powerUp);
+  // Plays count headless sessions with seeds 1 to count and prints a summary.
+  int RunHeadlessSessions(int count);
 
   // Get the current system time in milliseconds (may include a fraction of a millisecond).
   double Now();
@@ -84,9 +169,13 @@ namespace cat {
     glutKeyboardUpFunc(KeyReleased);
     glutSpecialFunc(SpecialKeyPressed);
     glutSpecialUpFunc(SpecialKeyReleased);
+    glutIgnoreKeyRepeat(1);
     glutIdleFunc(MainLoop);
+    SetProfileThreadName("Render");
 
     InitDrawing(gGameData);
+    gJoystick = StartJoystick(NULL, &gJoystickQueue);
+    StartSimulationThread();
 
     glutMainLoop(); // This doesn't return until the main window closes.
   }
@@ -94,64 +183,105 @@ namespace cat {
 
   void Render()
   {
-    glClearColor(0, 0, 0, 0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    static double lastTraceTime = ProfileTime();
+    static double lastStartTime = -1;
+    double startTime = ProfileTime();
+
+    DrawFrame();
+    double swapStartTime = ProfileTime();
+    {
+      PROFILE_ZONE("glutSwapBuffers");
+      glutSwapBuffers();
+    }
+
+    double endTime = ProfileTime();
+    IncrementCounter(gFramesMetric);
+    if (lastStartTime >= 0) {
+      RecordFrameTimes(gGameData, startTime - lastStartTime, swapStartTime - startTime, endTime - swapStartTime);
+      ObserveHistogram(gFrameTimeMetric, startTime - lastStartTime);
+    }
+    lastStartTime = startTime;
+
+    if (endTime - startTime > kSlowFrameTime && endTime - lastTraceTime > kSlowFrameTraceInterval) {
+      fprintf(stderr, "Slow frame (%1.1lfms)\n", endTime - startTime);
+      StartTraceWriter(kSlowFrameTraceFile);
+      lastTraceTime = endTime;
+    }
+  }
+
 
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrtho(0, 1, 0, 1, 0, 4);
+  void DrawFrame()
+  {
+    PROFILE_ZONE("DrawFrame");
 
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+    const FrameState* frame = gGameData->frames->readBuffer();
 
-    switch (gGameData->gameState) {
+    // The game world, drawn at a resolution which adapts to the frame time.
+    BeginScene(gGameData);
+    switch (frame->gameState) {
     case eGameTitleScreen:
+    case eGameOver:
+    case eGameVictory:
       DrawPlayArea(gGameData);
-      DrawTitles(gGameData);
+      DrawAtoms(gGameData, frame);
+      DrawBloom(gGameData);
       break;
     case eGameStartingLevel:
+    case eGameFinishedLevel:
       DrawPlayArea(gGameData);
-      DrawPlayer(gGameData);
-      DrawLevelCountdown(gGameData);
+      DrawAtoms(gGameData, frame);
+      DrawBloom(gGameData);
+      DrawPlayer(gGameData, frame);
       break;
     case eGamePlaying:
+    case eGamePaused:
       DrawPlayArea(gGameData);
-      DrawAtoms(gGameData);
-      DrawPlayer(gGameData);
-      DrawHUD(gGameData);
+      DrawAtoms(gGameData, frame);
+      DrawBloom(gGameData);
+      DrawPlayer(gGameData, frame);
+      break;
+    }
+    EndScene(gGameData);
+
+    // Text and titles, drawn at full resolution.
+    switch (frame->gameState) {
+    case eGameTitleScreen:
+      DrawTitles(gGameData);
+      break;
+    case eGameStartingLevel:
+      DrawLevelCountdown(gGameData, frame);
+      break;
+    case eGamePlaying:
+      DrawHUD(gGameData, frame);
       break;
     case eGameFinishedLevel:
-      DrawPlayArea(gGameData);
-      DrawPlayer(gGameData);
       DrawLevelComplete(gGameData);
       break;
     case eGameOver:
-      DrawPlayArea(gGameData);
-      DrawGameOver(gGameData);
+      DrawGameOver(gGameData, frame);
       break;
     case eGameVictory:
-      DrawPlayArea(gGameData);
       DrawVictory(gGameData);
       break;
     case eGamePaused:
-      DrawPlayArea(gGameData);
-      DrawAtoms(gGameData);
-      DrawPlayer(gGameData);
-      DrawHUD(gGameData);
+      DrawHUD(gGameData, frame);
       DrawPause(gGameData);
       break;
     }
 
-    glutSwapBuffers();
+    DrawPerfOverlay(gGameData, frame);
   }
 
 
   void Resize(int width, int height)
   {
-    glViewport(0, 0, width, height);
+    SetViewport(0, 0, width, height);
     if (gGameData) {
+      // The simulation thread copies the window into each frame state.
+      pthread_mutex_lock(&gSimLock);
       gGameData->window.width = width;
       gGameData->window.height = height;
+      pthread_mutex_unlock(&gSimLock);
       WindowResized(gGameData);
     }
     glutPostRedisplay();
@@ -163,351 +293,272 @@ namespace cat {
     const unsigned char kEsc = 27;
     const unsigned char kSpace = 32;
 
+    bool handled = false;
+    bool quit = false;
+    bool trace = false;
+    pthread_mutex_lock(&gSimLock);
     switch (key) {
       case kEsc:
-        if (gGameData->gameState == eGamePlaying || gGameData->gameState == eGamePaused)
-          SetGameState(gGameData, eGameOver);
+        if (!gGameData->versus &&
+            (gGameData->gameState == eGamePlaying || gGameData->gameState == eGamePaused))
+          SetGameState(*gGameData, eGameOver);
         else
-          exit(0);
+          quit = true;
+        handled = true;
         break;
 
+      // A versus game can't be paused, since the other player wouldn't know.
       case kSpace:
-        if (gGameData->gameState == eGamePlaying)
-          SetGameState(gGameData, eGamePaused);
-        else if (gGameData->gameState == eGamePaused)
-          SetGameState(gGameData, eGamePlaying);
+        if (!gGameData->versus && gGameData->gameState == eGamePlaying)
+          SetGameState(*gGameData, eGamePaused);
+        else if (!gGameData->versus && gGameData->gameState == eGamePaused)
+          SetGameState(*gGameData, eGamePlaying);
         else
-          gGameData->window.keyPressed[key] = true;
+          break;
+        handled = true;
+        break;
+
+      case 'b':
+        CycleBloomQuality(gGameData);
+        handled = true;
+        break;
+
+      case 'm':
+        SetAudioMuted(gGameData->audio, !AudioMuted(gGameData->audio));
+        handled = true;
+        break;
+
+      case 'o':
+        TogglePerfOverlay(gGameData);
+        handled = true;
+        break;
+
+      case 'p':
+        trace = true;
+        handled = true;
         break;
 
       default:
-        gGameData->window.keyPressed[key] = true;
         break;
     }
+    pthread_mutex_unlock(&gSimLock);
+
+    // Not while holding the lock: Shutdown needs it.
+    if (quit)
+      exit(0);
+
+    // The profiler has its own lock, so this doesn't need gSimLock.
+    if (trace && !StartTraceWriter(kTraceFile))
+      fprintf(stderr, "Still writing the last trace.\n");
+
+    if (!handled)
+      gInputQueue.push(InputEvent(Now(), key, true));
   }
 
 
   void KeyReleased(unsigned char key, int x, int y)
   {
-    gGameData->window.keyPressed[key] = false;
+    gInputQueue.push(InputEvent(Now(), key, false));
   }
 
 
   void SpecialKeyPressed(int key, int x, int y)
   {
-    switch (key) {
-      case GLUT_KEY_LEFT:
-        gGameData->window.leftPressed = true;
-        break;
-      case GLUT_KEY_RIGHT:
-        gGameData->window.rightPressed = true;
-        break;
-      case GLUT_KEY_UP:
-        gGameData->window.upPressed = true;
-        break;
-      case GLUT_KEY_DOWN:
-        gGameData->window.downPressed = true;
-        break;
-      default:
-        break;
-    }
+    int code = SpecialKeyCode(key);
+    if (code >= 0)
+      gInputQueue.push(InputEvent(Now(), code, true));
   }
 
 
   void SpecialKeyReleased(int key, int x, int y)
+  {
+    int code = SpecialKeyCode(key);
+    if (code >= 0)
+      gInputQueue.push(InputEvent(Now(), code, false));
+  }
+
+
+  // Maps a GLUT special key to one of our key codes, or -1 if we don't use it.
+  int SpecialKeyCode(int key)
   {
     switch (key) {
       case GLUT_KEY_LEFT:
-        gGameData->window.leftPressed = false;
-        break;
+        return kKeyLeft;
       case GLUT_KEY_RIGHT:
-        gGameData->window.rightPressed = false;
-        break;
+        return kKeyRight;
       case GLUT_KEY_UP:
-        gGameData->window.upPressed = false;
-        break;
+        return kKeyUp;
       case GLUT_KEY_DOWN:
-        gGameData->window.downPressed = false;
-        break;
+        return kKeyDown;
       default:
-        break;
+        return -1;
     }
   }
 
 
+  // GLUT idle callback. This runs on the render thread, so all it does is
+  // request a redraw whenever the simulation has published a new frame.
   void MainLoop()
   {
-    double frameStartTime = Now();
-
-    switch (gGameData->gameState) {
-    case eGameStartingLevel:
-      UpdatePlayer(gGameData);
-      break;
-    case eGamePlaying:
-      // Calculations for the current frame.
-      UpdateAtoms(gGameData);
-      UpdatePlayer(gGameData);
-      break;
-    case eGameFinishedLevel:
-      UpdatePlayer(gGameData);
-      break;
-    default:
-      break;
-    }
-    UpdateGameState(gGameData);
-
-    glutPostRedisplay();
-
-    double frameEndTime = Now();
-    double frameTime = frameEndTime - frameStartTime;
-    if (frameTime < kMinFrameTime)
-      SleepFor(kMinFrameTime - frameTime);
-
-    if (gGameData->gameState != eGamePaused) {
-      frameEndTime = Now();
-      gGameData->gameTime += (frameEndTime - frameStartTime);
-    }
+    if (gGameData->frames->hasNewFrame())
+      glutPostRedisplay();
+    else
+      SleepFor(kRenderPollTime);
   }
 
 
-  void UpdateAtoms(GameData* game)
+  void StartSimulationThread()
   {
-    assert(game != NULL);
-
-    if (game->currentLevel == game->levels.end())
-      return;
-
-    Level& level = *game->currentLevel;
-    Vec2 bottomLeft(kAtomSize / 2.0, kAtomSize / 2.0);
-    Vec2 topRight(1.0 - kAtomSize / 2.0, 1.0 - kAtomSize / 2.0);
-
-    // Move existing atoms
-    for (unsigned int i = 0; i < level.atomCount; ++i) {
-      Vec2 pos = level.position[i];
-      Vec2 vel = level.velocity[i];
-
-      pos += vel;
-      
-      if (pos.x < bottomLeft.x) {
-        pos.x = bottomLeft.x + (bottomLeft.x - pos.x);
-        vel.x = -vel.x;
-      }
-      else if (pos.x > topRight.x) {
-        pos.x = topRight.x - (pos.x - topRight.x);
-        vel.x = -vel.x;
-      }
-
-      if (pos.y < bottomLeft.y) {
-        pos.y = bottomLeft.y + (bottomLeft.y - pos.y);
-        vel.y = -vel.y;
-      }
-      else if (pos.y > topRight.y) {
-        pos.y = topRight.y - (pos.y - topRight.y);
-        vel.y = -vel.y;
-      }
-
-      level.position[i] = pos;
-      level.velocity[i] = vel;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, SimulationThread, gGameData) != 0) {
+      fprintf(stderr, "Unable to start the simulation thread.\n");
+      exit(1);
     }
-
-    // Emit new atoms
-    double levelTime = game->gameTime - game->stateChangeTime;
-    while (level.atomCount < kMaxAtoms && level.launchTime[level.atomCount] <= levelTime)
-      ++level.atomCount;
+    pthread_detach(thread);
   }
 
 
-  void UpdatePlayer(GameData* game)
+  void Shutdown()
   {
-    assert(game != NULL);
-
-    WindowData& win = game->window;
-    PlayerData& player = game->player;
-
-    // Handle player movement.
-    if (win.leftPressed || win.rightPressed || win.upPressed || win.downPressed) {
-      const double kScale = 0.01;
-      const Vec2 kRadius = player.size / 2.0;
-
-      Vec2 velocity;
-      if (win.leftPressed)
-        velocity.x -= 1;
-      if (win.rightPressed)
-        velocity.x += 1;
-      if (win.upPressed)
-        velocity.y += 1;
-      if (win.downPressed)
-        velocity.y -= 1;
-      velocity = Unit(velocity) * kScale;
-
-      player.position += velocity;
-      player.view = (velocity.y > 0) ? ePlayerBack : ePlayerFront;
-
-      Vec2 bottomLeft = player.position - kRadius;
-      Vec2 topRight = player.position + kRadius;
-
-      if (bottomLeft.x < 0.0)
-        player.position.x = kRadius.x;
-      else if (topRight.x > 1.0)
-        player.position.x = 1.0 - kRadius.x;
-
-      if (bottomLeft.y < 0.0)
-        player.position.y = kRadius.y;
-      else if (topRight.y > 1.0)
-        player.position.y = 1.0 - kRadius.y;
-    }
-
-    // Check whether a power up is expiring.
-    switch (player.powerUp) {
-      case ePowerUpSuperposition:
-      case ePowerUpEntanglement:
-        if (game->gameTime >= player.powerUpExpireTime)
-          player.powerUp = ePowerUpNone;
-        break;
-      case ePowerUpEntangling:
-        if (game->gameTime >= player.powerUpExpireTime)
-          player.powerUp = ePowerUpEntanglement;
-        break;
-      default:
-        break;
-    }
-
-    // Check whether the player is launching a power-up.
-    if (player.powerUp == ePowerUpNone) {
-      if (win.keyPressed['s'] && player.superpositionsRemaining > 0) {
-        SetPowerUp(game, ePowerUpSuperposition);
-        --player.superpositionsRemaining;
-      }
-      else if (win.keyPressed['d'] && player.entanglementsRemaining > 0) {
-        SetPowerUp(game, ePowerUpEntangling);
-        --player.entanglementsRemaining;
-      }
+    AudioEngine* audio = NULL;
+    if (gGameData != NULL) {
+      // The simulation thread can't be using it while we hold the lock.
+      pthread_mutex_lock(&gSimLock);
+      audio = gGameData->audio;
+      gGameData->audio = NULL;
+      pthread_mutex_unlock(&gSimLock);
     }
+    StopAudio(audio);
+    StopMetricsServer(gMetricsServer);
+    gMetricsServer = NULL;
   }
 
 
-  void UpdateGameState(GameData* game)
+  bool StartTraceWriter(const char* path)
   {
-    assert(game != NULL);
-
-    double elapsed = game->gameTime - game->stateChangeTime;
-    bool anyKeyPressed = false;
-    for (int i = 0; i < 256; ++i) {
-      if (game->window.keyPressed[i]) {
-        anyKeyPressed = true;
-        break;
-      }
-    }
-
-    switch (game->gameState) {
-    case eGameTitleScreen:
-      if (anyKeyPressed)
-        StartNewGame(game);
-      break;
-
-    case eGamePaused:
-      if (anyKeyPressed)
-        SetGameState(game, eGamePlaying);
-      break;
-
-    case eGameOver:
-      if (anyKeyPressed)
-        StartNewGame(game);
-      else if (elapsed >= 5000.0)
-        SetGameState(game, eGameTitleScreen);
-      break;
-
-    case eGameVictory:
-      if (anyKeyPressed)
-        StartNewGame(game);
-      else if (elapsed >= 30000.0)
-        SetGameState(game, eGameTitleScreen);
-      break;
-
-    case eGameStartingLevel:
-      if (elapsed >= 3000.0) {
-        game->currentLevel->startLevel();
-        SetGameState(game, eGamePlaying);
-      }
-      break;
-
-    case eGameFinishedLevel:
-      if (elapsed >= 3000.0) {
-        ++game->currentLevel;
-        if (game->currentLevel != game->levels.end())
-          SetGameState(game, eGameStartingLevel);
-        else
-          SetGameState(game, eGameVictory);
-      }
-      break;
-
-    case eGamePlaying:
-      {
-        Level& level = *game->currentLevel;
-        if (elapsed >= level.duration) {
-          SetGameState(game, eGameFinishedLevel);
-          break;
-        }
-
-        PlayerData& player = game->player;
-        if (player.powerUp == ePowerUpSuperposition) {
-          player.collision = false;
-          break;
-        }
-        // TODO: add handling for entanglement.
-        if (player.collision) {
-          --player.livesRemaining;
-          if (player.livesRemaining <= 0)
-            SetGameState(game, eGameOver);
-          else
-            StartNewLife(game);
-        }
-      }
+    if (AtomicExchange(&gWritingTrace, 1) != 0)
+      return false;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, TraceWriterThread, (void*)path) != 0) {
+      fprintf(stderr, "Unable to start a thread to write %s\n", path);
+      AtomicStore(&gWritingTrace, 0);
+      return true;
     }
+    pthread_detach(thread);
+    return true;
   }
 
 
-  void StartNewGame(GameData* game)
+  void* TraceWriterThread(void* arg)
   {
-    SetGameState(game, eGameStartingLevel);
-    game->gameTime = 0;
-
-    game->player.size = Vec2(0.06, 0.06);
-    game->player.livesRemaining = 9;
-    game->player.superpositionsRemaining = 3;
-    game->player.entanglementsRemaining = 1;
-
-    game->currentLevel = game->levels.begin();
-
-    StartNewLife(game);
+    const char* path = (const char*)arg;
+    if (WriteProfileTrace(path))
+      fprintf(stderr, "Wrote a trace to %s\n", path);
+    else
+      fprintf(stderr, "Unable to write a trace to %s\n", path);
+    AtomicStore(&gWritingTrace, 0);
+    return NULL;
   }
 
 
-  void StartNewLife(GameData* game)
+  // Runs the simulation at a fixed rate, independently of how long rendering
+  // takes. Each step publishes a snapshot for the render thread.
+  void* SimulationThread(void* arg)
   {
-    game->player.position = Vec2(0.5, 0.5);
-    game->player.collision = false;
-    SetPowerUp(game, ePowerUpNone);
+    GameData& game = *static_cast<GameData*>(arg);
+    RewindBuffer* rewind = CreateRewindBuffer(kRewindBufferSize);
+    InputQueue* const inputQueues[] = { &gInputQueue, &gJoystickQueue };
+    SetProfileThreadName("Simulation");
+    const int kNumInputQueues = sizeof(inputQueues) / sizeof(inputQueues[0]);
 
-    game->currentLevel->startLevel();
-    SetGameState(game, eGameStartingLevel);
+    double frameStartTime = Now();
+    double inputTime = frameStartTime;
+    // Input from a versus step which had to wait for the peer, to go into the
+    // next step instead.
+    PlayerInput pendingInput = 0;
+    for (;;) {
+      // Holding down 'r' runs the game backwards, one step per frame, for as
+      // far back as the rewind buffer goes. Not in a versus game though: the
+      // other player would have something to say about that.
+      pthread_mutex_lock(&gSimLock);
+      double stepStartTime = Now();
+      // This step's input is whatever happened since the last one started.
+      PlayerInput input = ConsumeInputEvents(inputQueues, kNumInputQueues, game.window,
+                                             inputTime, frameStartTime);
+      input = SetInputStick(pendingInput | input, game.window.stick);
+      pendingInput = 0;
+      inputTime = frameStartTime;
+      bool rewinding = false;
+      if (gNetPlay != NULL) {
+        // The events are gone from the queues already, so hang on to them:
+        // otherwise taps and power-ups pressed during a stall would be lost.
+        if (!StepNetPlay(gNetPlay, game, input))
+          pendingInput = input;
+      }
+      else {
+        rewinding = game.window.keyPressed['r'] && Rewind(rewind, 1, game);
+        if (!rewinding) {
+          game.player.input = input;
+          StepSimulation(game);
+          RecordSnapshot(rewind, game);
+          SetGauge(gRewindMemoryMetric, RewindBytesUsed(rewind));
+        }
+      }
+      game.stepTime = Now() - stepStartTime;
+      CaptureFrameState(&game, game.frames->writeBuffer());
+      game.frames->publish();
+      pthread_mutex_unlock(&gSimLock);
+
+      double frameTime = Now() - frameStartTime;
+      if (frameTime < kSimulationStepTime)
+        SleepFor(kSimulationStepTime - frameTime);
+
+      double frameEndTime = Now();
+      pthread_mutex_lock(&gSimLock);
+      // Both sides of a versus game have to agree on the time, so there it
+      // goes up by a fixed amount each step instead.
+      if (game.gameState != eGamePaused && !rewinding && gNetPlay == NULL)
+        game.gameTime += (frameEndTime - frameStartTime);
+      pthread_mutex_unlock(&gSimLock);
+      frameStartTime = frameEndTime;
+    }
+    DestroyRewindBuffer(rewind);
+    return NULL;
   }
 
 
-  void SetGameState(GameData* game, GameState state)
+  int RunHeadlessSessions(int count)
   {
-    game->gameState = state;
-    game->stateChangeTime = game->gameTime;
-  }
-
+    if (count <= 0) {
+      fprintf(stderr, "The number of sessions must be positive.\n");
+      return 1;
+    }
 
-  void SetPowerUp(GameData* game, PowerUp powerUp)
-  {
-    const double kPowerUpDuration[] = { 0.0, 2000.0, 1000.0, 60000.0 };
-    double duration = kPowerUpDuration[powerUp];
+    std::vector<SessionParams> sessions(count);
+    std::vector<SessionResult> results(count);
+    for (int i = 0; i < count; ++i)
+      sessions[i] = SessionParams(i + 1, kMaxSessionSteps);
+
+    double startTime = Now();
+    RunSessions(&sessions[0], &results[0], count);
+    double elapsed = Now() - startTime;
+
+    int victories = 0;
+    long totalSteps = 0;
+    long totalLevels = 0;
+    for (int i = 0; i < count; ++i) {
+      if (results[i].finalState == eGameVictory)
+        ++victories;
+      totalSteps += results[i].steps;
+      totalLevels += results[i].levelsCompleted;
+    }
 
-    game->player.powerUp = powerUp;
-    game->player.powerUpExpireTime = game->gameTime + duration;
+    printf("%d sessions, %ld steps in %1.1lfs (%1.0lf steps/s)\n",
+           count, totalSteps, elapsed / 1000.0, totalSteps / (elapsed / 1000.0));
+    printf("%d victories, %1.2lf levels completed on average\n",
+           victories, double(totalLevels) / count);
+    return 0;
   }
 
 
@@ -533,9 +584,56 @@ int main(int argc, char** argv)
   printf("%s\n", cat::kGameName);
   printf("%s\n", cat::kCopyrightMessage);
 
-  chdir(dirname(argv[0]));
+  // These can go before any of the other options: --metrics <socket path>
+  // for machines which run unattended, and --wav <path> to record the sound
+  // to a file instead of playing it.
+  char* exePath = argv[0];
+  const char* wavPath = NULL;
+  atexit(cat::Shutdown);
+  for (;;) {
+    if (argc >= 3 && strcmp(argv[1], "--metrics") == 0) {
+      cat::gMetricsServer = cat::StartMetricsServer(argv[2]);
+      if (cat::gMetricsServer == NULL)
+        return 1;
+    }
+    else if (argc >= 3 && strcmp(argv[1], "--wav") == 0) {
+      wavPath = argv[2];
+    }
+    else {
+      break;
+    }
+    argv += 2;
+    argc -= 2;
+  }
+
+  // Batch mode, for evaluating the levels: no window, no resources.
+  if (argc == 3 && strcmp(argv[1], "--sessions") == 0)
+    return cat::RunHeadlessSessions(atoi(argv[2]));
+
+  // Versus mode: one side runs with --host, the other with --join, each
+  // giving its own port and then the other side's address and port.
+  bool host = (argc == 5 && strcmp(argv[1], "--host") == 0);
+  bool join = (argc == 5 && strcmp(argv[1], "--join") == 0);
+  if (host || join) {
+    cat::gNetPlay = cat::StartNetPlay(atoi(argv[2]), argv[3], atoi(argv[4]), host);
+    if (cat::gNetPlay == NULL)
+      return 1;
+  }
+
+  chdir(dirname(exePath));
+
+  // Loose files in the resource dir take priority over either of these, so
+  // they can still be edited and hot reloaded.
+  cat::MountEmbeddedResources();
+  cat::MountResourceArchive(cat::kResourceArchiveName, cat::kResourceArchivePrefix);
 
   cat::InitGameData();
+  cat::SetGauge(cat::gFrameStateMemoryMetric, sizeof(cat::FrameStateBuffer));
+  cat::gGameData->audio = cat::StartAudio(wavPath);
+  if (wavPath != NULL && cat::gGameData->audio == NULL)
+    return 1;
+  if (cat::gNetPlay != NULL)
+    cat::StartVersusGame(cat::gNetPlay, *cat::gGameData);
   cat::Start();
 }
 
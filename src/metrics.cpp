@@ -0,0 +1,555 @@
+#include "metrics.h"
+
+#include "atomic.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  // Each counter takes one slot, and each histogram one per bucket.
+  static const int kMaxMetricSlots = kMaxMetrics * (kMaxHistogramBounds + 1);
+
+  // Threads which can update metrics at the same time without a lock. Any
+  // more than this add straight into gRetired, under gMetricsLock.
+  static const int kMaxMetricShards = 64;
+
+  // How often the server thread checks whether it's been asked to stop.
+  static const int kStopCheckMillis = 250;
+
+  // How long a connection gets to send its request before we just answer.
+  static const int kRequestWaitMillis = 100;
+
+
+  //
+  // Types
+  //
+
+  enum MetricType {
+    eMetricCounter,
+    eMetricGauge,
+    eMetricHistogram
+  };
+
+
+  // Everything in here is fixed at registration, apart from the gauge value.
+  struct Metric {
+    MetricType type;
+    const char* name;
+    const char* help;
+    const char* labels;  // NULL if there aren't any.
+    int index;           // Into gMetrics, and into MetricShard::sums.
+    int slot;            // First of this metric's MetricShard::counts.
+    int numBounds;
+    double bounds[kMaxHistogramBounds];
+    volatile double gauge;
+  };
+
+
+  // One thread's share of the counters and histograms. Only that thread
+  // writes to it, so updates need no atomics; readers add up every shard.
+  struct MetricShard {
+    volatile long counts[kMaxMetricSlots];  // Counter values and histogram buckets.
+    volatile double sums[kMaxMetrics];      // Sum of each histogram's observations.
+    bool inUse;                             // Protected by gMetricsLock.
+  };
+
+
+  struct MetricsServer {
+    std::string path;
+    int fd;
+    pthread_t thread;
+    volatile int stop;
+
+    MetricsServer(const char* path);
+    ~MetricsServer();
+  };
+
+
+  //
+  // Forward declarations
+  //
+
+  Metric* RegisterMetric(MetricType type, const char* name, const char* help, const char* labels,
+                         int numSlots);
+  MetricShard* CurrentShard();
+  void CreateShardKey();
+  void ReleaseShard(void* arg);
+  void AddShard(MetricShard& total, const MetricShard& shard);
+  void WriteMetric(std::string& out, const Metric& metric);
+  void WriteSample(std::string& out, const char* name, const char* suffix, const char* labels,
+                   const char* extraLabel, const char* value);
+  const char* MetricTypeName(MetricType type);
+  void* ServerThread(void* arg);
+  void ServeMetrics(int fd);
+  bool SendAll(int fd, const char* data, size_t size);
+
+
+  //
+  // Global variables
+  //
+
+  // Guards registration, the shard list, and folding shards into gRetired.
+  // Everything in this section is plain data, so it's all set up before any
+  // other file's globals are constructed and they can register metrics.
+  static pthread_mutex_t gMetricsLock = PTHREAD_MUTEX_INITIALIZER;
+  static Metric gMetrics[kMaxMetrics];
+  static volatile int gNumMetrics = 0;
+  static int gNumSlots = 0;
+
+  static pthread_once_t gShardOnce = PTHREAD_ONCE_INIT;
+  static pthread_key_t gShardKey;
+  static MetricShard* gShards[kMaxMetricShards];
+  static int gNumShards = 0;
+  // Totals from threads which have exited, plus updates from threads which
+  // didn't get a shard.
+  static MetricShard gRetired;
+
+
+  //
+  // MetricsServer public methods
+  //
+
+  MetricsServer::MetricsServer(const char* path) :
+    path(path),
+    fd(-1),
+    thread(),
+    stop(0)
+  {
+  }
+
+
+  MetricsServer::~MetricsServer()
+  {
+    if (fd >= 0) {
+      close(fd);
+      unlink(path.c_str());
+    }
+  }
+
+
+  //
+  // Public functions
+  //
+
+  Metric* RegisterCounter(const char* name, const char* help, const char* labels)
+  {
+    return RegisterMetric(eMetricCounter, name, help, labels, 1);
+  }
+
+
+  Metric* RegisterGauge(const char* name, const char* help, const char* labels)
+  {
+    return RegisterMetric(eMetricGauge, name, help, labels, 0);
+  }
+
+
+  Metric* RegisterHistogram(const char* name, const char* help,
+                            const double* bounds, int numBounds, const char* labels)
+  {
+    assert(numBounds > 0 && numBounds <= kMaxHistogramBounds);
+
+    Metric* metric = RegisterMetric(eMetricHistogram, name, help, labels, numBounds + 1);
+    if (metric != NULL) {
+      metric->numBounds = numBounds;
+      std::copy(bounds, bounds + numBounds, metric->bounds);
+    }
+    return metric;
+  }
+
+
+  void IncrementCounter(Metric* metric, long amount)
+  {
+    if (metric == NULL)
+      return;
+
+    MetricShard* shard = CurrentShard();
+    if (shard != NULL) {
+      shard->counts[metric->slot] += amount;
+      return;
+    }
+    pthread_mutex_lock(&gMetricsLock);
+    gRetired.counts[metric->slot] += amount;
+    pthread_mutex_unlock(&gMetricsLock);
+  }
+
+
+  void ObserveHistogram(Metric* metric, double value)
+  {
+    if (metric == NULL)
+      return;
+
+    int bucket = 0;
+    while (bucket < metric->numBounds && value > metric->bounds[bucket])
+      ++bucket;
+
+    MetricShard* shard = CurrentShard();
+    if (shard != NULL) {
+      shard->counts[metric->slot + bucket] += 1;
+      shard->sums[metric->index] += value;
+      return;
+    }
+    pthread_mutex_lock(&gMetricsLock);
+    gRetired.counts[metric->slot + bucket] += 1;
+    gRetired.sums[metric->index] += value;
+    pthread_mutex_unlock(&gMetricsLock);
+  }
+
+
+  void SetGauge(Metric* metric, double value)
+  {
+    if (metric != NULL)
+      metric->gauge = value;
+  }
+
+
+  void WriteMetrics(std::string& out)
+  {
+    out.clear();
+
+    pthread_mutex_lock(&gMetricsLock);
+    int numMetrics = gNumMetrics;
+    for (int i = 0; i < numMetrics; ++i) {
+      // Metrics which share a name go together, under one header.
+      bool seen = false;
+      for (int j = 0; j < i && !seen; ++j)
+        seen = (strcmp(gMetrics[i].name, gMetrics[j].name) == 0);
+      if (seen)
+        continue;
+
+      out += "# HELP ";
+      out += gMetrics[i].name;
+      out += " ";
+      out += gMetrics[i].help;
+      out += "\n# TYPE ";
+      out += gMetrics[i].name;
+      out += " ";
+      out += MetricTypeName(gMetrics[i].type);
+      out += "\n";
+      for (int j = i; j < numMetrics; ++j) {
+        if (strcmp(gMetrics[i].name, gMetrics[j].name) == 0)
+          WriteMetric(out, gMetrics[j]);
+      }
+    }
+    pthread_mutex_unlock(&gMetricsLock);
+  }
+
+
+  MetricsServer* StartMetricsServer(const char* path)
+  {
+    assert(path != NULL);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "Metrics socket path is too long: %s\n", path);
+      return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    // A socket left over from a previous run would stop us binding. Anything
+    // else at that path is left alone, and the bind fails.
+    struct stat info;
+    if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+      unlink(path);
+
+    MetricsServer* server = new MetricsServer(path);
+    server->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->fd < 0 ||
+        bind(server->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(server->fd, 4) != 0) {
+      fprintf(stderr, "Unable to serve metrics on %s: %s\n", path, strerror(errno));
+      delete server;
+      return NULL;
+    }
+    if (pthread_create(&server->thread, NULL, ServerThread, server) != 0) {
+      delete server;
+      return NULL;
+    }
+    return server;
+  }
+
+
+  void StopMetricsServer(MetricsServer* server)
+  {
+    if (server == NULL)
+      return;
+    AtomicStore(&server->stop, 1);
+    pthread_join(server->thread, NULL);
+    delete server;
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  Metric* RegisterMetric(MetricType type, const char* name, const char* help, const char* labels,
+                         int numSlots)
+  {
+    assert(name != NULL);
+    assert(help != NULL);
+
+    Metric* metric = NULL;
+    pthread_mutex_lock(&gMetricsLock);
+    if (gNumMetrics < kMaxMetrics) {
+      metric = &gMetrics[gNumMetrics];
+      metric->type = type;
+      metric->name = name;
+      metric->help = help;
+      metric->labels = labels;
+      metric->index = gNumMetrics;
+      metric->slot = gNumSlots;
+      metric->numBounds = 0;
+      metric->gauge = 0;
+      gNumSlots += numSlots;
+      AtomicStore(&gNumMetrics, gNumMetrics + 1);
+    }
+    pthread_mutex_unlock(&gMetricsLock);
+
+    if (metric == NULL)
+      fprintf(stderr, "Too many metrics; ignoring %s.\n", name);
+    return metric;
+  }
+
+
+  // Returns NULL if every shard is taken.
+  MetricShard* CurrentShard()
+  {
+    pthread_once(&gShardOnce, CreateShardKey);
+    MetricShard* shard = static_cast<MetricShard*>(pthread_getspecific(gShardKey));
+    if (shard != NULL)
+      return shard;
+
+    pthread_mutex_lock(&gMetricsLock);
+    for (int i = 0; i < gNumShards && shard == NULL; ++i) {
+      if (!gShards[i]->inUse)
+        shard = gShards[i];
+    }
+    if (shard == NULL && gNumShards < kMaxMetricShards) {
+      shard = new MetricShard();
+      gShards[gNumShards++] = shard;
+    }
+    if (shard != NULL)
+      shard->inUse = true;
+    pthread_mutex_unlock(&gMetricsLock);
+
+    if (shard != NULL)
+      pthread_setspecific(gShardKey, shard);
+    return shard;
+  }
+
+
+  void CreateShardKey()
+  {
+    pthread_key_create(&gShardKey, ReleaseShard);
+  }
+
+
+  // Called when a thread which has updated something exits. Its totals move
+  // into gRetired, so they still count, and the shard is free for reuse.
+  void ReleaseShard(void* arg)
+  {
+    MetricShard* shard = static_cast<MetricShard*>(arg);
+    pthread_mutex_lock(&gMetricsLock);
+    AddShard(gRetired, *shard);
+    for (int i = 0; i < kMaxMetricSlots; ++i)
+      shard->counts[i] = 0;
+    for (int i = 0; i < kMaxMetrics; ++i)
+      shard->sums[i] = 0;
+    shard->inUse = false;
+    pthread_mutex_unlock(&gMetricsLock);
+  }
+
+
+  void AddShard(MetricShard& total, const MetricShard& shard)
+  {
+    for (int i = 0; i < gNumSlots; ++i)
+      total.counts[i] += shard.counts[i];
+    for (int i = 0; i < gNumMetrics; ++i)
+      total.sums[i] += shard.sums[i];
+  }
+
+
+  // Must be called with gMetricsLock held.
+  void WriteMetric(std::string& out, const Metric& metric)
+  {
+    char value[64];
+    switch (metric.type) {
+      case eMetricCounter: {
+        long count = gRetired.counts[metric.slot];
+        for (int i = 0; i < gNumShards; ++i)
+          count += gShards[i]->counts[metric.slot];
+        snprintf(value, sizeof(value), "%ld", count);
+        WriteSample(out, metric.name, "", metric.labels, NULL, value);
+        break;
+      }
+
+      case eMetricGauge:
+        snprintf(value, sizeof(value), "%.15g", double(metric.gauge));
+        WriteSample(out, metric.name, "", metric.labels, NULL, value);
+        break;
+
+      case eMetricHistogram: {
+        // Prometheus buckets are cumulative.
+        long count = 0;
+        double sum = gRetired.sums[metric.index];
+        for (int i = 0; i < gNumShards; ++i)
+          sum += gShards[i]->sums[metric.index];
+
+        for (int bucket = 0; bucket <= metric.numBounds; ++bucket) {
+          int slot = metric.slot + bucket;
+          count += gRetired.counts[slot];
+          for (int i = 0; i < gNumShards; ++i)
+            count += gShards[i]->counts[slot];
+
+          char le[64];
+          if (bucket < metric.numBounds)
+            snprintf(le, sizeof(le), "le=\"%.15g\"", metric.bounds[bucket]);
+          else
+            snprintf(le, sizeof(le), "le=\"+Inf\"");
+          snprintf(value, sizeof(value), "%ld", count);
+          WriteSample(out, metric.name, "_bucket", metric.labels, le, value);
+        }
+
+        snprintf(value, sizeof(value), "%.15g", sum);
+        WriteSample(out, metric.name, "_sum", metric.labels, NULL, value);
+        snprintf(value, sizeof(value), "%ld", count);
+        WriteSample(out, metric.name, "_count", metric.labels, NULL, value);
+        break;
+      }
+    }
+  }
+
+
+  void WriteSample(std::string& out, const char* name, const char* suffix, const char* labels,
+                   const char* extraLabel, const char* value)
+  {
+    out += name;
+    out += suffix;
+    if (labels != NULL || extraLabel != NULL) {
+      out += "{";
+      if (labels != NULL)
+        out += labels;
+      if (labels != NULL && extraLabel != NULL)
+        out += ",";
+      if (extraLabel != NULL)
+        out += extraLabel;
+      out += "}";
+    }
+    out += " ";
+    out += value;
+    out += "\n";
+  }
+
+
+  const char* MetricTypeName(MetricType type)
+  {
+    switch (type) {
+      case eMetricCounter:   return "counter";
+      case eMetricGauge:     return "gauge";
+      case eMetricHistogram: return "histogram";
+      default:               return "untyped";
+    }
+  }
+
+
+  void* ServerThread(void* arg)
+  {
+    MetricsServer* server = static_cast<MetricsServer*>(arg);
+
+    while (!AtomicLoad(&server->stop)) {
+      struct pollfd pfd;
+      pfd.fd = server->fd;
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, kStopCheckMillis) <= 0)
+        continue;
+
+      int client = accept(server->fd, NULL, NULL);
+      if (client < 0)
+        continue;
+      ServeMetrics(client);
+      close(client);
+    }
+    return NULL;
+  }
+
+
+  void ServeMetrics(int fd)
+  {
+    // Read the request, if there is one, up to the end of its headers.
+    char request[4096];
+    size_t size = 0;
+    for (;;) {
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, kRequestWaitMillis) <= 0)
+        break;
+      ssize_t len = read(fd, request + size, sizeof(request) - 1 - size);
+      if (len <= 0)
+        break;
+      size += len;
+      request[size] = '\0';
+      if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL ||
+          size == sizeof(request) - 1)
+        break;
+    }
+    request[size] = '\0';
+    bool http = (strncmp(request, "GET ", 4) == 0 || strncmp(request, "HEAD ", 5) == 0);
+
+    std::string body;
+    WriteMetrics(body);
+
+    if (http) {
+      char header[256];
+      int headerSize = snprintf(header, sizeof(header),
+                                "HTTP/1.0 200 OK\r\n"
+                                "Content-Type: text/plain; version=0.0.4\r\n"
+                                "Content-Length: %lu\r\n"
+                                "Connection: close\r\n"
+                                "\r\n",
+                                (unsigned long)body.size());
+      if (!SendAll(fd, header, headerSize))
+        return;
+      if (strncmp(request, "HEAD ", 5) == 0)
+        return;
+    }
+    SendAll(fd, body.data(), body.size());
+  }
+
+
+  bool SendAll(int fd, const char* data, size_t size)
+  {
+    while (size > 0) {
+      ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+      if (sent < 0 && errno == EINTR)
+        continue;
+      if (sent <= 0)
+        return false;
+      data += sent;
+      size -= sent;
+    }
+    return true;
+  }
+
+} // namespace cat
+
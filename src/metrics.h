@@ -0,0 +1,71 @@
+#ifndef cat_metrics_h
+#define cat_metrics_h
+
+#include <string>
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  static const int kMaxMetrics = 64;
+  static const int kMaxHistogramBounds = 16;
+
+
+  //
+  // Forward type declarations
+  //
+
+  struct Metric;         // Opaque; see metrics.cpp for details.
+  struct MetricsServer;  // Ditto.
+
+
+  //
+  // Functions
+  //
+
+  // Counters only go up; gauges are set to whatever the current value is;
+  // histograms count observations into buckets with the given upper bounds
+  // (which must be in increasing order), plus one for everything above the
+  // last bound.
+  //
+  // The name is used as is in the output, so it should follow the
+  // Prometheus conventions (e.g. "cat_frames_total"). Several metrics may
+  // share a name if they have different labels, which are written the way
+  // they'd appear between the braces (e.g. "subsystem=\"textures\""), or
+  // NULL for none. All the strings must outlive the metric; in practice
+  // they're always literals.
+  //
+  // Metrics are meant to be registered once, when the program starts, and
+  // can't be removed. These return NULL once there are kMaxMetrics of them,
+  // and all the update functions accept NULL and do nothing with it.
+  Metric* RegisterCounter(const char* name, const char* help, const char* labels = NULL);
+  Metric* RegisterGauge(const char* name, const char* help, const char* labels = NULL);
+  Metric* RegisterHistogram(const char* name, const char* help,
+                            const double* bounds, int numBounds, const char* labels = NULL);
+
+  // Counters and histograms are kept separately for each thread that updates
+  // them and only added up when they're read, so these never take a lock or
+  // contend with other threads (except the first time a thread calls one).
+  void IncrementCounter(Metric* metric, long amount = 1);
+  void ObserveHistogram(Metric* metric, double value);
+  // Last writer wins.
+  void SetGauge(Metric* metric, double value);
+
+  // Current values of every metric, in the Prometheus text format.
+  void WriteMetrics(std::string& out);
+
+  // Serves WriteMetrics over a Unix domain socket at path, on a background
+  // thread. Each connection gets the current values and is then closed; if
+  // it starts with an HTTP request, the values come back as an HTTP
+  // response, so both `curl --unix-socket <path> http://localhost/metrics`
+  // and `nc -U <path>` work. A socket already at path (say, from a previous
+  // run) is replaced. Returns NULL if the socket can't be set up.
+  MetricsServer* StartMetricsServer(const char* path);
+  void StopMetricsServer(MetricsServer* server);
+
+} // namespace cat
+
+#endif // cat_metrics_h
+
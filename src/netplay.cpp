@@ -0,0 +1,342 @@
+#include "netplay.h"
+
+#include "simulation.h"
+#include "snapshot.h"
+
+#include <arpa/inet.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  // The furthest either side may get ahead of the input it has from the
+  // other, and so the most steps a rollback ever has to replay.
+  static const long kMaxRollbackSteps = 8;
+
+  // One snapshot for the start of each step we might have to roll back to.
+  static const long kSnapshotSlots = kMaxRollbackSteps + 1;
+
+  // Inputs are kept for this many steps. Must be comfortably more than
+  // kMaxInputsPerPacket plus kMaxRollbackSteps.
+  static const long kInputHistory = 64;
+
+  // Each packet repeats every input the peer hasn't acknowledged yet, up to
+  // this many, so a lost packet doesn't need resending on its own.
+  static const long kMaxInputsPerPacket = 32;
+
+  static const unsigned int kPacketMagic = 0x4341544E; // "CATN"
+  // Magic, first step, acknowledged step, count; then the inputs.
+  static const size_t kPacketHeaderSize = 13;
+  static const size_t kInputSize = 4;
+  static const size_t kMaxPacketSize = kPacketHeaderSize + kMaxInputsPerPacket * kInputSize;
+
+  // Where each side's player starts.
+  static const Vec2 kHostSpawn(0.3, 0.5);
+  static const Vec2 kGuestSpawn(0.7, 0.5);
+
+
+  //
+  // Types
+  //
+
+  struct NetPlay {
+    int socket;
+    bool host;
+
+    // The next step to run.
+    long frame;
+    // Newest step for which we have the peer's input, and every one before it.
+    long confirmedFrame;
+    // Newest step for which the peer has our input.
+    long peerAckFrame;
+    // Oldest step that was run with a wrong guess at the peer's input, or -1.
+    long rollbackFrame;
+
+    // Both indexed by step, modulo kInputHistory. For steps after
+    // confirmedFrame, remoteInputs holds what we guessed.
+    PlayerInput localInputs[kInputHistory];
+    PlayerInput remoteInputs[kInputHistory];
+
+    // The game as it was at the start of each recent step, indexed by step
+    // modulo kSnapshotSlots.
+    Snapshot* snapshots[kSnapshotSlots];
+
+    NetPlayStats stats;
+
+    NetPlay(int socket, bool host);
+    ~NetPlay();
+  };
+
+
+  //
+  // Forward declarations
+  //
+
+  void RunStep(NetPlay* net, GameData& game, long frame);
+  void ReceiveInputs(NetPlay* net);
+  void SendInputs(NetPlay* net);
+  void WriteUint32(unsigned char* out, unsigned int value);
+  unsigned int ReadUint32(const unsigned char* in);
+
+
+  //
+  // NetPlayStats public methods
+  //
+
+  NetPlayStats::NetPlayStats() :
+    frame(0),
+    confirmedFrame(-1),
+    rollbacks(0),
+    stepsReplayed(0),
+    stalls(0)
+  {
+  }
+
+
+  //
+  // NetPlay public methods
+  //
+
+  NetPlay::NetPlay(int socket, bool host) :
+    socket(socket),
+    host(host),
+    frame(0),
+    confirmedFrame(-1),
+    peerAckFrame(-1),
+    rollbackFrame(-1),
+    stats()
+  {
+    memset(localInputs, 0, sizeof(localInputs));
+    memset(remoteInputs, 0, sizeof(remoteInputs));
+    for (long i = 0; i < kSnapshotSlots; ++i)
+      snapshots[i] = new Snapshot();
+  }
+
+
+  NetPlay::~NetPlay()
+  {
+    for (long i = 0; i < kSnapshotSlots; ++i)
+      delete snapshots[i];
+    close(socket);
+  }
+
+
+  //
+  // Public functions
+  //
+
+  NetPlay* StartNetPlay(unsigned short localPort, const char* peerHost, unsigned short peerPort,
+                        bool host)
+  {
+    assert(peerHost != NULL);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    char port[16];
+    snprintf(port, sizeof(port), "%u", peerPort);
+
+    struct addrinfo* peer = NULL;
+    if (getaddrinfo(peerHost, port, &hints, &peer) != 0 || peer == NULL) {
+      fprintf(stderr, "Unable to find %s.\n", peerHost);
+      return NULL;
+    }
+
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(localPort);
+
+    // Connecting a UDP socket just fixes where sends go to, and filters out
+    // packets from anyone else.
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0 ||
+        bind(sock, (struct sockaddr*)&local, sizeof(local)) != 0 ||
+        connect(sock, peer->ai_addr, peer->ai_addrlen) != 0 ||
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) != 0) {
+      fprintf(stderr, "Unable to set up a connection on port %u: %s\n", localPort, strerror(errno));
+      if (sock >= 0)
+        close(sock);
+      freeaddrinfo(peer);
+      return NULL;
+    }
+    freeaddrinfo(peer);
+
+    return new NetPlay(sock, host);
+  }
+
+
+  void StopNetPlay(NetPlay* net)
+  {
+    delete net;
+  }
+
+
+  void StartVersusGame(NetPlay* net, GameData& game)
+  {
+    assert(net != NULL);
+
+    game.versus = true;
+    game.player.spawnPosition = net->host ? kHostSpawn : kGuestSpawn;
+    game.opponent.spawnPosition = net->host ? kGuestSpawn : kHostSpawn;
+    StartNewGame(game);
+  }
+
+
+  bool StepNetPlay(NetPlay* net, GameData& game, PlayerInput input)
+  {
+    assert(net != NULL);
+    assert(game.versus);
+
+    ReceiveInputs(net);
+
+    if (net->frame - net->confirmedFrame > kMaxRollbackSteps) {
+      ++net->stats.stalls;
+      SendInputs(net);
+      return false;
+    }
+
+    if (net->rollbackFrame >= 0) {
+      ++net->stats.rollbacks;
+      net->stats.stepsReplayed += net->frame - net->rollbackFrame;
+
+      RestoreSnapshot(game, *net->snapshots[net->rollbackFrame % kSnapshotSlots]);
+      game.replaying = true;
+      for (long frame = net->rollbackFrame; frame < net->frame; ++frame)
+        RunStep(net, game, frame);
+      game.replaying = false;
+      net->rollbackFrame = -1;
+    }
+
+    net->localInputs[net->frame % kInputHistory] = input;
+    RunStep(net, game, net->frame);
+    ++net->frame;
+
+    SendInputs(net);
+    return true;
+  }
+
+
+  NetPlayStats GetNetPlayStats(const NetPlay* net)
+  {
+    assert(net != NULL);
+
+    NetPlayStats stats = net->stats;
+    stats.frame = net->frame;
+    stats.confirmedFrame = net->confirmedFrame;
+    return stats;
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  void RunStep(NetPlay* net, GameData& game, long frame)
+  {
+    SaveSnapshot(game, net->snapshots[frame % kSnapshotSlots]);
+
+    // Guess that the peer is still doing whatever they did last.
+    if (frame > net->confirmedFrame) {
+      PlayerInput guess = 0;
+      if (net->confirmedFrame >= 0)
+        guess = net->remoteInputs[net->confirmedFrame % kInputHistory];
+      net->remoteInputs[frame % kInputHistory] = guess;
+    }
+
+    game.player.input = net->localInputs[frame % kInputHistory];
+    game.opponent.input = net->remoteInputs[frame % kInputHistory];
+    StepSimulation(game);
+    game.gameTime += kSimulationStepTime;
+  }
+
+
+  void ReceiveInputs(NetPlay* net)
+  {
+    unsigned char packet[kMaxPacketSize];
+    for (;;) {
+      ssize_t size = recv(net->socket, packet, sizeof(packet), 0);
+      if (size < 0)
+        break;
+      if (size_t(size) < kPacketHeaderSize || ReadUint32(packet) != kPacketMagic)
+        continue;
+
+      long first = long(int(ReadUint32(packet + 4)));
+      long ack = long(int(ReadUint32(packet + 8)));
+      long count = packet[12];
+      if (size_t(size) < kPacketHeaderSize + count * kInputSize || count > kMaxInputsPerPacket)
+        continue;
+
+      if (ack > net->peerAckFrame)
+        net->peerAckFrame = ack;
+
+      // Only take inputs which carry on from the ones we already have; the
+      // next packet will repeat anything after a gap.
+      for (long i = 0; i < count; ++i) {
+        long frame = first + i;
+        if (frame != net->confirmedFrame + 1)
+          continue;
+
+        PlayerInput input = ReadUint32(packet + kPacketHeaderSize + i * kInputSize);
+        PlayerInput& stored = net->remoteInputs[frame % kInputHistory];
+        if (frame < net->frame && stored != input &&
+            (net->rollbackFrame < 0 || frame < net->rollbackFrame))
+          net->rollbackFrame = frame;
+        stored = input;
+        net->confirmedFrame = frame;
+      }
+    }
+  }
+
+
+  void SendInputs(NetPlay* net)
+  {
+    long first = net->peerAckFrame + 1;
+    if (first < net->frame - kMaxInputsPerPacket)
+      first = net->frame - kMaxInputsPerPacket;
+    long count = net->frame - first;
+
+    unsigned char packet[kMaxPacketSize];
+    WriteUint32(packet, kPacketMagic);
+    WriteUint32(packet + 4, (unsigned int)first);
+    WriteUint32(packet + 8, (unsigned int)net->confirmedFrame);
+    packet[12] = (unsigned char)count;
+    for (long i = 0; i < count; ++i)
+      WriteUint32(packet + kPacketHeaderSize + i * kInputSize, net->localInputs[(first + i) % kInputHistory]);
+
+    // If this gets lost, the inputs go out again with the next one.
+    send(net->socket, packet, kPacketHeaderSize + count * kInputSize, 0);
+  }
+
+
+  void WriteUint32(unsigned char* out, unsigned int value)
+  {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+  }
+
+
+  unsigned int ReadUint32(const unsigned char* in)
+  {
+    return (unsigned int)in[0] << 24 | (unsigned int)in[1] << 16 |
+           (unsigned int)in[2] << 8 | (unsigned int)in[3];
+  }
+
+} // namespace cat
+
@@ -0,0 +1,64 @@
+#ifndef cat_netplay_h
+#define cat_netplay_h
+
+#include "gamedata.h"
+
+namespace cat {
+
+  //
+  // Forward type declarations
+  //
+
+  struct NetPlay;  // Opaque; see netplay.cpp for details.
+
+
+  //
+  // Types
+  //
+
+  struct NetPlayStats {
+    long frame;             // Steps simulated so far.
+    long confirmedFrame;    // Newest step we have the peer's real input for.
+    long rollbacks;         // Times a prediction turned out wrong.
+    long stepsReplayed;     // Steps run again because of those.
+    long stalls;            // Steps skipped waiting for the peer to catch up.
+
+    NetPlayStats();
+  };
+
+
+  //
+  // Functions
+  //
+
+  // Sets up a versus game against a peer over UDP. Each side sends its
+  // player's input for every step; while the peer's input for a step hasn't
+  // arrived we guess that they're still holding down the same controls and
+  // carry on. When their real input turns up and the guess was wrong, the
+  // game is wound back to that step and run forward again with the right
+  // input. Either side only gets a limited number of steps ahead of the
+  // other, which bounds how much has to be run again.
+  //
+  // Both peers must be started with the same seed; one of them, and only
+  // one, must be the host. Returns NULL if the socket can't be set up.
+  NetPlay* StartNetPlay(unsigned short localPort, const char* peerHost, unsigned short peerPort,
+                        bool host);
+  void StopNetPlay(NetPlay* net);
+
+  // Turns game into a versus game and starts it. The host's player starts
+  // on the left of the play area, the other one on the right.
+  void StartVersusGame(NetPlay* net, GameData& game);
+
+  // Runs one step with the local player's input, first winding back and
+  // replaying any steps where the peer's input was mispredicted. Advances
+  // gameTime by kSimulationStepTime per step. Returns false, without running
+  // the step, if we're as far ahead of the peer as we're allowed to get; call
+  // it again next frame.
+  bool StepNetPlay(NetPlay* net, GameData& game, PlayerInput input);
+
+  NetPlayStats GetNetPlayStats(const NetPlay* net);
+
+} // namespace cat
+
+#endif // cat_netplay_h
+
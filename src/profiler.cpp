@@ -0,0 +1,263 @@
+#include "profiler.h"
+
+#include "atomic.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+#include <vector>
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  static const unsigned int kMaxProfileThreadName = 64;
+
+
+  //
+  // Types
+  //
+
+  struct ProfileEvent {
+    const char* name;
+    double start;
+    double end;
+  };
+
+
+  // One per thread which has recorded anything. Only the owning thread
+  // writes events and count; everyone else just reads them.
+  struct ProfileThread {
+    int id;
+    char name[kMaxProfileThreadName];
+    bool inUse;  // False once the owning thread has exited. Protected by gProfileLock.
+    volatile long count;  // Events recorded so far, including overwritten ones.
+    ProfileEvent events[kProfileEventsPerThread];
+
+    ProfileThread(int id);
+  };
+
+
+  //
+  // Forward declarations
+  //
+
+  ProfileThread* CurrentProfileThread();
+  void CreateProfileKey();
+  void ReleaseProfileThread(void* arg);
+  void CopyProfileEvents(ProfileThread* thread, std::vector<ProfileEvent>& events);
+  void WriteJSONString(FILE* out, const char* str);
+
+
+  //
+  // Global variables
+  //
+
+  static pthread_once_t gProfileOnce = PTHREAD_ONCE_INIT;
+  static pthread_key_t gProfileKey;
+
+  // Guards gProfileThreads and the inUse and name fields of everything in it.
+  static pthread_mutex_t gProfileLock = PTHREAD_MUTEX_INITIALIZER;
+  // Never shrinks: buffers for threads which have exited get reused.
+  static std::vector<ProfileThread*> gProfileThreads;
+
+
+  //
+  // ProfileZone public methods
+  //
+
+  ProfileZone::ProfileZone(const char* name) :
+    _name(name),
+    _start(ProfileTime())
+  {
+  }
+
+
+  ProfileZone::~ProfileZone()
+  {
+    RecordProfileZone(_name, _start, ProfileTime());
+  }
+
+
+  //
+  // ProfileThread public methods
+  //
+
+  ProfileThread::ProfileThread(int id) :
+    id(id),
+    inUse(true),
+    count(0)
+  {
+    snprintf(name, sizeof(name), "Thread %d", id);
+  }
+
+
+  //
+  // Public functions
+  //
+
+  double ProfileTime()
+  {
+#ifdef linux
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+#else
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000.0 + t.tv_usec / 1000.0;
+#endif
+  }
+
+
+  void SetProfileThreadName(const char* name)
+  {
+    ProfileThread* thread = CurrentProfileThread();
+    pthread_mutex_lock(&gProfileLock);
+    snprintf(thread->name, sizeof(thread->name), "%s", name);
+    pthread_mutex_unlock(&gProfileLock);
+  }
+
+
+  void RecordProfileZone(const char* name, double start, double end)
+  {
+    ProfileThread* thread = CurrentProfileThread();
+
+    long count = thread->count;
+    ProfileEvent& event = thread->events[count & (kProfileEventsPerThread - 1)];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    AtomicStore(&thread->count, count + 1);
+  }
+
+
+  bool WriteProfileTrace(const char* path)
+  {
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+      fprintf(stderr, "Unable to write a trace to %s.\n", path);
+      return false;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    std::vector<ProfileEvent> events;
+
+    pthread_mutex_lock(&gProfileLock);
+    for (size_t i = 0; i < gProfileThreads.size(); ++i) {
+      ProfileThread* thread = gProfileThreads[i];
+
+      fprintf(out, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+              first ? "" : ",\n", thread->id);
+      WriteJSONString(out, thread->name);
+      fprintf(out, "}}");
+      first = false;
+
+      CopyProfileEvents(thread, events);
+      for (size_t j = 0; j < events.size(); ++j) {
+        // Timestamps are in microseconds.
+        fprintf(out, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3lf,\"dur\":%.3lf,\"name\":",
+                thread->id, events[j].start * 1000.0, (events[j].end - events[j].start) * 1000.0);
+        WriteJSONString(out, events[j].name);
+        fprintf(out, "}");
+      }
+    }
+    pthread_mutex_unlock(&gProfileLock);
+
+    fprintf(out, "\n]}\n");
+    bool ok = (ferror(out) == 0);
+    ok = (fclose(out) == 0) && ok;
+    return ok;
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  ProfileThread* CurrentProfileThread()
+  {
+    pthread_once(&gProfileOnce, CreateProfileKey);
+    ProfileThread* thread = static_cast<ProfileThread*>(pthread_getspecific(gProfileKey));
+    if (thread != NULL)
+      return thread;
+
+    pthread_mutex_lock(&gProfileLock);
+    for (size_t i = 0; i < gProfileThreads.size() && thread == NULL; ++i) {
+      if (!gProfileThreads[i]->inUse)
+        thread = gProfileThreads[i];
+    }
+    if (thread != NULL) {
+      // The old thread's events are of no interest once it's gone.
+      thread->inUse = true;
+      thread->count = 0;
+      snprintf(thread->name, sizeof(thread->name), "Thread %d", thread->id);
+    }
+    else {
+      thread = new ProfileThread(int(gProfileThreads.size()) + 1);
+      gProfileThreads.push_back(thread);
+    }
+    pthread_mutex_unlock(&gProfileLock);
+
+    pthread_setspecific(gProfileKey, thread);
+    return thread;
+  }
+
+
+  void CreateProfileKey()
+  {
+    pthread_key_create(&gProfileKey, ReleaseProfileThread);
+  }
+
+
+  // Called when a thread which has recorded something exits.
+  void ReleaseProfileThread(void* arg)
+  {
+    ProfileThread* thread = static_cast<ProfileThread*>(arg);
+    pthread_mutex_lock(&gProfileLock);
+    thread->inUse = false;
+    pthread_mutex_unlock(&gProfileLock);
+  }
+
+
+  // The owning thread may be overwriting the oldest events while we copy
+  // them, so anything it could have reached by the time we're done gets
+  // thrown away.
+  void CopyProfileEvents(ProfileThread* thread, std::vector<ProfileEvent>& events)
+  {
+    events.clear();
+
+    long end = AtomicLoad(&thread->count);
+    long begin = std::max(0L, end - kProfileEventsPerThread);
+    for (long i = begin; i < end; ++i)
+      events.push_back(thread->events[i & (kProfileEventsPerThread - 1)]);
+
+    // The slot after the last one counted may be half written as well.
+    long after = AtomicLoad(&thread->count);
+    long firstValid = std::max(begin, after - kProfileEventsPerThread + 1);
+    if (firstValid > begin)
+      events.erase(events.begin(), events.begin() + std::min(firstValid - begin, end - begin));
+  }
+
+
+  void WriteJSONString(FILE* out, const char* str)
+  {
+    fputc('"', out);
+    for (const char* c = str; *c != '\0'; ++c) {
+      if (*c == '"' || *c == '\\')
+        fprintf(out, "\\%c", *c);
+      else if ((unsigned char)*c < 0x20)
+        fprintf(out, "\\u%04x", (unsigned char)*c);
+      else
+        fputc(*c, out);
+    }
+    fputc('"', out);
+  }
+
+} // namespace cat
+
@@ -0,0 +1,66 @@
+#ifndef cat_profiler_h
+#define cat_profiler_h
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  // How many zones each thread remembers; older ones get overwritten. Must be
+  // a power of two.
+  static const int kProfileEventsPerThread = 16384;
+
+
+  //
+  // Types
+  //
+
+  // Times the scope it's declared in and records it, with the given name, in
+  // the calling thread's ring buffer. The name must be a string literal (or
+  // live at least as long as the program), since only the pointer is kept.
+  // Use PROFILE_ZONE rather than declaring one of these directly.
+  class ProfileZone {
+  public:
+    explicit ProfileZone(const char* name);
+    ~ProfileZone();
+
+  private:
+    const char* _name;
+    double _start;
+  };
+
+
+  //
+  // Functions
+  //
+
+  // A monotonic clock, in milliseconds. Only useful for differences.
+  double ProfileTime();
+
+  // Names the calling thread in traces. The name is copied.
+  void SetProfileThreadName(const char* name);
+
+  // Records a zone on the calling thread. Never blocks (apart from the first
+  // call on each thread) and never allocates (ditto).
+  void RecordProfileZone(const char* name, double start, double end);
+
+  // Writes everything every thread still remembers to path, in the Chrome
+  // trace event format; open it in chrome://tracing or Perfetto. Safe to call
+  // from any thread while the others carry on recording. Returns false if
+  // the file can't be written.
+  bool WriteProfileTrace(const char* path);
+
+} // namespace cat
+
+
+//
+// Macros
+//
+
+#define PROFILE_ZONE(name) cat::ProfileZone PROFILE_ZONE_NAME(__LINE__)(name)
+#define PROFILE_ZONE_NAME(line) PROFILE_ZONE_NAME2(line)
+#define PROFILE_ZONE_NAME2(line) profileZone##line
+
+#endif // cat_profiler_h
+
@@ -0,0 +1,180 @@
+#include "rendertarget.h"
+
+#include "glstate.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+
+#define GL_GLEXT_PROTOTYPES 1
+#ifdef linux
+#include <GL/gl.h>
+#include <GL/glext.h>
+#else
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+#endif
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  // Scales are kept to multiples of this, so that tiny changes in frame time
+  // don't cause the resolution to flicker.
+  static const double kScaleStep = 0.05;
+
+  // Frames to wait after changing the scale before changing it again. This
+  // gives the smoothed frame time a chance to reflect the new scale.
+  static const int kScaleCooldown = 30;
+
+  // Weight given to the newest frame time when smoothing.
+  static const double kSmoothing = 0.1;
+
+  // Default for ResolutionScaler::headroom.
+  static const double kHeadroom = 0.6;
+
+
+  //
+  // RenderTarget public methods
+  //
+
+  RenderTarget::RenderTarget() :
+    framebufferID(0),
+    colorTextureID(0),
+    depthBufferID(0),
+    width(0),
+    height(0)
+  {
+  }
+
+
+  //
+  // ResolutionScaler public methods
+  //
+
+  ResolutionScaler::ResolutionScaler() :
+    scale(1.0),
+    minScale(0.5),
+    maxScale(1.0),
+    budget(12.0),
+    headroom(kHeadroom),
+    smoothedTime(0),
+    cooldown(kScaleCooldown)
+  {
+  }
+
+
+  bool ResolutionScaler::update(double frameTime)
+  {
+    if (smoothedTime <= 0)
+      smoothedTime = frameTime;
+    else
+      smoothedTime += (frameTime - smoothedTime) * kSmoothing;
+
+    if (cooldown > 0) {
+      --cooldown;
+      return false;
+    }
+
+    double newScale = scale;
+    if (smoothedTime > budget) {
+      // Fill cost is proportional to the area, so scale both axes by the
+      // square root of the ratio.
+      newScale = scale * sqrt(budget / smoothedTime);
+      newScale = floor(newScale / kScaleStep) * kScaleStep;
+    }
+    else if (smoothedTime < budget * headroom) {
+      newScale = scale + kScaleStep;
+    }
+
+    if (newScale < minScale)
+      newScale = minScale;
+    if (newScale > maxScale)
+      newScale = maxScale;
+    if (fabs(newScale - scale) < kScaleStep * 0.5)
+      return false;
+
+    // Assume the cost tracks the area until we've measured otherwise.
+    smoothedTime *= (newScale * newScale) / (scale * scale);
+    scale = newScale;
+    cooldown = kScaleCooldown;
+    return true;
+  }
+
+
+  //
+  // Functions
+  //
+
+  bool CreateRenderTarget(RenderTarget* target, int width, int height, bool withDepth)
+  {
+    assert(target != NULL);
+    assert(width > 0 && height > 0);
+
+    if (target->framebufferID == 0)
+      glGenFramebuffersEXT(1, &target->framebufferID);
+    if (target->colorTextureID == 0)
+      glGenTextures(1, &target->colorTextureID);
+    if (withDepth && target->depthBufferID == 0)
+      glGenRenderbuffersEXT(1, &target->depthBufferID);
+
+    target->width = width;
+    target->height = height;
+
+    BindTexture(target->colorTextureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    BindTexture(0);
+
+    BindFramebuffer(target->framebufferID);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+                              GL_TEXTURE_2D, target->colorTextureID, 0);
+    if (target->depthBufferID) {
+      glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, target->depthBufferID);
+      glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, width, height);
+      glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
+      glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+                                   GL_RENDERBUFFER_EXT, target->depthBufferID);
+    }
+
+    GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+    BindFramebuffer(0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE_EXT) {
+      fprintf(stderr, "Render target %dx%d is incomplete (status 0x%x).\n", width, height, status);
+      return false;
+    }
+    return true;
+  }
+
+
+  void DestroyRenderTarget(RenderTarget* target)
+  {
+    assert(target != NULL);
+
+    if (target->framebufferID) {
+      ForgetFramebuffer(target->framebufferID);
+      glDeleteFramebuffersEXT(1, &target->framebufferID);
+    }
+    if (target->colorTextureID) {
+      ForgetTexture(target->colorTextureID);
+      glDeleteTextures(1, &target->colorTextureID);
+    }
+    if (target->depthBufferID)
+      glDeleteRenderbuffersEXT(1, &target->depthBufferID);
+    *target = RenderTarget();
+  }
+
+
+  void BindRenderTarget(const RenderTarget* target)
+  {
+    BindFramebuffer(target ? target->framebufferID : 0);
+  }
+
+} // namespace cat
+
@@ -0,0 +1,64 @@
+#ifndef cat_rendertarget_h
+#define cat_rendertarget_h
+
+namespace cat {
+
+  //
+  // Types
+  //
+
+  // An offscreen framebuffer with a colour texture and, optionally, a depth
+  // buffer. The size is the allocated size; callers are free to render into a
+  // smaller viewport within it.
+  struct RenderTarget {
+    unsigned int framebufferID;
+    unsigned int colorTextureID;
+    unsigned int depthBufferID;
+    int width;
+    int height;
+
+    RenderTarget();
+  };
+
+
+  // Picks a render scale from measured frame times. The scale multiplies the
+  // window size to give the size of the scene viewport; it drops quickly when
+  // frames go over budget and creeps back up when there's headroom.
+  struct ResolutionScaler {
+    double scale;
+    double minScale;
+    double maxScale;
+    // Target time, in milliseconds, for rendering the scene.
+    double budget;
+    // If the smoothed time drops below this fraction of the budget, we try a
+    // higher resolution.
+    double headroom;
+    // Exponentially smoothed frame time, in milliseconds.
+    double smoothedTime;
+    // Number of frames to wait before the scale may change again.
+    int cooldown;
+
+    ResolutionScaler();
+
+    // Feed in the time the last frame took to render. Returns true if the
+    // scale changed.
+    bool update(double frameTime);
+  };
+
+
+  //
+  // Functions
+  //
+
+  // Allocates a framebuffer of the given size. If the target has already been
+  // created, it gets resized. Returns false if the framebuffer is incomplete.
+  bool CreateRenderTarget(RenderTarget* target, int width, int height, bool withDepth);
+  void DestroyRenderTarget(RenderTarget* target);
+
+  // Makes target the current framebuffer. Pass NULL to bind the window.
+  void BindRenderTarget(const RenderTarget* target);
+
+} // namespace cat
+
+#endif // cat_rendertarget_h
+
@@ -1,6 +1,20 @@
 #include "resource.h"
 
+#include "atomic.h"
+#include "embedded.h"
+
+#include <cassert>
+#include <cctype>
 #include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <pthread.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
 
 namespace cat {
 
@@ -14,16 +28,381 @@ namespace cat {
   static const char* kResourcePrefix = "../Resources";
 #endif
 
+  static const unsigned int kZipEndSignature = 0x06054b50;
+  static const unsigned int kZipEntrySignature = 0x02014b50;
+  static const unsigned int kZipLocalSignature = 0x04034b50;
+  static const size_t kZipEndSize = 22;
+  static const size_t kZipMaxCommentSize = 0xFFFF;
+  static const size_t kZipEntrySize = 46;
+  static const size_t kZipLocalSize = 30;
+
+  static const unsigned int kZipStored = 0;
+  static const unsigned int kZipDeflated = 8;
+
+
+  //
+  // Types
+  //
+
+  struct ResourceEntry {
+    std::string name;
+    std::string filePath;
+
+    // Where the data is in a mounted archive, if it's in one. Protected by
+    // gResources.lock, because mounting can happen after registration.
+    const unsigned char* archived;
+    size_t archivedSize;
+    size_t size;
+    unsigned int method;
+
+    ResourceEntry();
+  };
+
+
+  struct ResourceTable {
+    // Entries are only ever appended, and an entry is complete before count
+    // goes up, so readers don't need the lock to look one up by ID.
+    ResourceEntry entries[kMaxResources];
+    volatile int count;
+
+    // Everything below is protected by lock.
+    std::map<std::string, ResourceID> ids;
+    pthread_mutex_t lock;
+
+    ResourceTable();
+  };
+
+
+  //
+  // Global variables
+  //
+
+  static ResourceTable gResources;
+
+
+  //
+  // Forward declarations
+  //
+
+  std::string ResourceKey(const char* path);
+  const ResourceEntry* LookupResource(ResourceID resource);
+  unsigned int ReadU16(const unsigned char* p);
+  unsigned int ReadU32(const unsigned char* p);
+
+
+  //
+  // ResourceData public methods
+  //
+
+  ResourceData::ResourceData() :
+    bytes(NULL),
+    size(0),
+    buffer(NULL)
+  {
+  }
+
+
+  //
+  // ResourceEntry public methods
+  //
+
+  ResourceEntry::ResourceEntry() :
+    name(),
+    filePath(),
+    archived(NULL),
+    archivedSize(0),
+    size(0),
+    method(kZipStored)
+  {
+  }
+
+
+  //
+  // ResourceTable public methods
+  //
+
+  ResourceTable::ResourceTable() :
+    count(0),
+    ids()
+  {
+    pthread_mutex_init(&lock, NULL);
+  }
+
 
   //
-  // Functions
+  // Public functions
   //
 
+  ResourceID RegisterResource(const char* path)
+  {
+    assert(path != NULL);
+
+    std::string key = ResourceKey(path);
+    ResourceID id = kNoResource;
+
+    pthread_mutex_lock(&gResources.lock);
+    std::map<std::string, ResourceID>::iterator it = gResources.ids.find(key);
+    if (it != gResources.ids.end()) {
+      id = it->second;
+    } else if (gResources.count < int(kMaxResources)) {
+      int index = gResources.count;
+      ResourceEntry& entry = gResources.entries[index];
+      entry.name = path;
+      entry.filePath = std::string(kResourcePrefix) + "/" + path;
+      id = ResourceID(index + 1);
+      gResources.ids[key] = id;
+      AtomicStore(&gResources.count, index + 1);
+    } else {
+      fprintf(stderr, "Too many resources, unable to register %s.\n", path);
+    }
+    pthread_mutex_unlock(&gResources.lock);
+
+    return id;
+  }
+
+
+  const char* ResourceName(ResourceID resource)
+  {
+    const ResourceEntry* entry = LookupResource(resource);
+    return (entry != NULL) ? entry->name.c_str() : NULL;
+  }
+
+
+  const char* ResourceFilePath(ResourceID resource)
+  {
+    const ResourceEntry* entry = LookupResource(resource);
+    return (entry != NULL) ? entry->filePath.c_str() : NULL;
+  }
+
+
   const char* ResourcePath(const char* path)
   {
-    static char buf[4096];
-    snprintf(buf, 4096, "%s/%s", kResourcePrefix, path);
-    return buf;
+    return ResourceFilePath(RegisterResource(path));
+  }
+
+
+  const char* ResourceDir()
+  {
+    return kResourcePrefix;
+  }
+
+
+  bool MountResourceArchive(const char* zipPath, const char* prefix)
+  {
+    assert(zipPath != NULL);
+    assert(prefix != NULL);
+
+    int fd = open(zipPath, O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || size_t(info.st_size) < kZipEndSize) {
+      close(fd);
+      return false;
+    }
+
+    // The mapping lives as long as the program does, since the resources we
+    // register keep pointing into it.
+    size_t size = info.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+      return false;
+    const unsigned char* zip = static_cast<const unsigned char*>(mapping);
+
+    // The end of central directory record is at the very end, unless
+    // there's an archive comment after it.
+    const unsigned char* end = NULL;
+    size_t searchStart = (size > kZipEndSize + kZipMaxCommentSize) ? size - kZipEndSize - kZipMaxCommentSize : 0;
+    for (size_t pos = size - kZipEndSize + 1; pos-- > searchStart; ) {
+      if (ReadU32(zip + pos) == kZipEndSignature) {
+        end = zip + pos;
+        break;
+      }
+    }
+    if (end == NULL) {
+      fprintf(stderr, "%s is not a zip file.\n", zipPath);
+      munmap(mapping, size);
+      return false;
+    }
+
+    unsigned int numEntries = ReadU16(end + 10);
+    size_t dirOffset = ReadU32(end + 16);
+    size_t prefixLength = strlen(prefix);
+
+    size_t entryOffset = dirOffset;
+    for (unsigned int i = 0; i < numEntries; ++i) {
+      if (entryOffset > size || size - entryOffset < kZipEntrySize)
+        break;
+      const unsigned char* entry = zip + entryOffset;
+      if (ReadU32(entry) != kZipEntrySignature)
+        break;
+
+      unsigned int method = ReadU16(entry + 10);
+      size_t compressedSize = ReadU32(entry + 20);
+      size_t uncompressedSize = ReadU32(entry + 24);
+      unsigned int nameLength = ReadU16(entry + 28);
+      unsigned int extraLength = ReadU16(entry + 30);
+      unsigned int commentLength = ReadU16(entry + 32);
+      size_t localOffset = ReadU32(entry + 42);
+      // A truncated or corrupt archive could claim more than is left.
+      size_t entryLength = kZipEntrySize + nameLength + extraLength + commentLength;
+      if (entryLength > size - entryOffset)
+        break;
+      std::string name(reinterpret_cast<const char*>(entry + kZipEntrySize), nameLength);
+      entryOffset += entryLength;
+
+      // Skip directories, anything outside the prefix and anything we can't
+      // decompress.
+      if (name.size() <= prefixLength || name.compare(0, prefixLength, prefix) != 0 ||
+          name[name.size() - 1] == '/')
+        continue;
+      if (method != kZipStored && method != kZipDeflated)
+        continue;
+
+      // The local header can have a different amount of extra data from the
+      // central directory's copy, so we have to look at it to find the data.
+      const unsigned char* local = zip + localOffset;
+      if (localOffset + kZipLocalSize > size || ReadU32(local) != kZipLocalSignature)
+        continue;
+      size_t dataOffset = localOffset + kZipLocalSize + ReadU16(local + 26) + ReadU16(local + 28);
+      if (dataOffset > size || compressedSize > size - dataOffset)
+        continue;
+
+      ResourceID id = RegisterResource(name.c_str() + prefixLength);
+      if (id == kNoResource)
+        continue;
+
+      pthread_mutex_lock(&gResources.lock);
+      ResourceEntry& resource = gResources.entries[id - 1];
+      if (resource.archived != NULL) {
+        pthread_mutex_unlock(&gResources.lock);
+        continue;
+      }
+      resource.archived = zip + dataOffset;
+      resource.archivedSize = compressedSize;
+      resource.size = uncompressedSize;
+      resource.method = method;
+      pthread_mutex_unlock(&gResources.lock);
+    }
+
+    return true;
+  }
+
+
+  void MountEmbeddedResources()
+  {
+    for (unsigned int i = 0; i < kNumEmbeddedFiles; ++i) {
+      const EmbeddedFile& file = kEmbeddedFiles[i];
+      ResourceID id = RegisterResource(file.name);
+      if (id == kNoResource)
+        continue;
+
+      pthread_mutex_lock(&gResources.lock);
+      ResourceEntry& resource = gResources.entries[id - 1];
+      if (resource.archived != NULL) {
+        pthread_mutex_unlock(&gResources.lock);
+        continue;
+      }
+      resource.archived = file.begin;
+      resource.archivedSize = file.end - file.begin;
+      resource.size = resource.archivedSize;
+      resource.method = kZipStored;
+      pthread_mutex_unlock(&gResources.lock);
+    }
+  }
+
+
+  bool ReadArchivedResource(ResourceID resource, ResourceData* data)
+  {
+    assert(data != NULL);
+    if (LookupResource(resource) == NULL)
+      return false;
+
+    const ResourceEntry& entry = gResources.entries[resource - 1];
+    pthread_mutex_lock(&gResources.lock);
+    const unsigned char* archived = entry.archived;
+    size_t archivedSize = entry.archivedSize;
+    size_t size = entry.size;
+    unsigned int method = entry.method;
+    pthread_mutex_unlock(&gResources.lock);
+
+    if (archived == NULL)
+      return false;
+
+    if (method == kZipStored) {
+      data->bytes = archived;
+      data->size = archivedSize;
+      data->buffer = NULL;
+      return true;
+    }
+
+    // Raw deflate data, with no zlib header.
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+      return false;
+
+    unsigned char* buffer = new unsigned char[size > 0 ? size : 1];
+    stream.next_in = const_cast<Bytef*>(archived);
+    stream.avail_in = archivedSize;
+    stream.next_out = buffer;
+    stream.avail_out = size;
+    int status = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+
+    if (status != Z_STREAM_END || stream.total_out != size) {
+      fprintf(stderr, "Unable to decompress %s.\n", entry.name.c_str());
+      delete[] buffer;
+      return false;
+    }
+
+    data->bytes = buffer;
+    data->size = size;
+    data->buffer = buffer;
+    return true;
+  }
+
+
+  void ReleaseResourceData(ResourceData* data)
+  {
+    assert(data != NULL);
+    delete[] data->buffer;
+    *data = ResourceData();
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  std::string ResourceKey(const char* path)
+  {
+    std::string key(path);
+    for (std::string::iterator ch = key.begin(); ch != key.end(); ++ch)
+      *ch = tolower((unsigned char)*ch);
+    return key;
+  }
+
+
+  const ResourceEntry* LookupResource(ResourceID resource)
+  {
+    if (resource == kNoResource || int(resource) > AtomicLoad(&gResources.count))
+      return NULL;
+    return &gResources.entries[resource - 1];
+  }
+
+
+  unsigned int ReadU16(const unsigned char* p)
+  {
+    return p[0] | (p[1] << 8);
+  }
+
+
+  unsigned int ReadU32(const unsigned char* p)
+  {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
   }
 
 } // namespace cat
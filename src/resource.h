@@ -1,15 +1,79 @@
 #ifndef cat_resource_h
 #define cat_resource_h
 
+#include <cstddef>
+
 namespace cat {
 
+  //
+  // Constants
+  //
+
+  // Room for every resource the game knows about. Registering more than this
+  // fails.
+  static const unsigned int kMaxResources = 1024;
+
+
+  //
+  // Types
+  //
+
+  // A compact handle for a resource path. 0 is never a valid handle.
+  typedef unsigned int ResourceID;
+  static const ResourceID kNoResource = 0;
+
+
+  // The contents of a resource in memory, from ReadArchivedResource.
+  struct ResourceData {
+    const unsigned char* bytes;
+    size_t size;
+    unsigned char* buffer;  // Non-NULL if we had to decompress.
+
+    ResourceData();
+  };
+
+
   //
   // Functions
   //
 
-  // Not threadsafe, for now. Also, path should be a relative path assuming
-  // that the resource/ dir is the current dir.
+  // All of these are safe to call from any thread. Paths are relative to the
+  // resource directory.
+
+  // Interns path and returns its handle. Registering the same path again
+  // (ignoring case) returns the same handle. Returns kNoResource if the
+  // table is full.
+  ResourceID RegisterResource(const char* path);
+
+  // The path as first registered. Never allocates or formats anything, and
+  // the result stays valid for the life of the program.
+  const char* ResourceName(ResourceID resource);
+  // Where the resource lives on disk. Same guarantees as ResourceName.
+  const char* ResourceFilePath(ResourceID resource);
+
+  // Shorthand for ResourceFilePath(RegisterResource(path)).
   const char* ResourcePath(const char* path);
+  // The resource directory itself.
+  const char* ResourceDir();
+
+  // Makes the files under prefix in a zip archive available as resources.
+  // The archive's central directory is read from a memory mapping, and
+  // stored (uncompressed) files are used straight from the mapping, so
+  // mounting is cheap. If more than one mounted archive contains the same
+  // resource, the one mounted first wins. Returns false if the archive
+  // can't be read.
+  bool MountResourceArchive(const char* zipPath, const char* prefix);
+
+  // Makes the files built into the executable (see embedded.h) available as
+  // resources, as though they were in an archive. Embedded files are always
+  // used in place.
+  void MountEmbeddedResources();
+
+  // Gets the contents of a resource from a mounted archive, decompressing
+  // it if necessary. Returns false if no mounted archive contains it. Call
+  // ReleaseResourceData when done with the data.
+  bool ReadArchivedResource(ResourceID resource, ResourceData* data);
+  void ReleaseResourceData(ResourceData* data);
 
 } // namespace cat
 
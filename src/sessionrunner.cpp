@@ -0,0 +1,185 @@
+#include "sessionrunner.h"
+
+#include "atomic.h"
+#include "simulation.h"
+
+#include <cassert>
+#include <iterator>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+namespace cat {
+
+  //
+  // Types
+  //
+
+  struct RunnerState {
+    const SessionParams* sessions;
+    SessionResult* results;
+    unsigned int count;
+    volatile int nextSession;
+
+    RunnerState(const SessionParams* sessions, SessionResult* results, unsigned int count);
+  };
+
+
+  //
+  // Forward declarations
+  //
+
+  void* RunnerThread(void* arg);
+  void RunSession(const SessionParams& params, SessionResult& result);
+  unsigned int NumRunnerThreads(unsigned int count, unsigned int requested);
+
+
+  //
+  // SessionParams public methods
+  //
+
+  SessionParams::SessionParams() :
+    seed(kDefaultGameSeed),
+    maxSteps(0),
+    controller(NULL),
+    context(NULL)
+  {
+  }
+
+
+  SessionParams::SessionParams(unsigned long seed, long maxSteps,
+                               SessionController controller, void* context) :
+    seed(seed),
+    maxSteps(maxSteps),
+    controller(controller),
+    context(context)
+  {
+  }
+
+
+  //
+  // SessionResult public methods
+  //
+
+  SessionResult::SessionResult() :
+    finalState(eGameTitleScreen),
+    levelsCompleted(0),
+    livesRemaining(0),
+    steps(0),
+    gameTime(0)
+  {
+  }
+
+
+  //
+  // RunnerState public methods
+  //
+
+  RunnerState::RunnerState(const SessionParams* sessions, SessionResult* results, unsigned int count) :
+    sessions(sessions),
+    results(results),
+    count(count),
+    nextSession(0)
+  {
+  }
+
+
+  //
+  // Public functions
+  //
+
+  void RunSessions(const SessionParams* sessions, SessionResult* results,
+                   unsigned int count, unsigned int numThreads)
+  {
+    assert((sessions != NULL && results != NULL) || count == 0);
+    if (count == 0)
+      return;
+
+    RunnerState state(sessions, results, count);
+
+    std::vector<pthread_t> threads;
+    numThreads = NumRunnerThreads(count, numThreads);
+    for (unsigned int i = 0; i < numThreads; ++i) {
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, RunnerThread, &state) == 0)
+        threads.push_back(thread);
+    }
+    // If we couldn't start any threads, run the sessions ourselves.
+    if (threads.empty())
+      RunnerThread(&state);
+
+    for (unsigned int i = 0; i < threads.size(); ++i)
+      pthread_join(threads[i], NULL);
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  void* RunnerThread(void* arg)
+  {
+    RunnerState* state = static_cast<RunnerState*>(arg);
+
+    for (;;) {
+      unsigned int index = (unsigned int)AtomicFetchAdd(&state->nextSession, 1);
+      if (index >= state->count)
+        break;
+      RunSession(state->sessions[index], state->results[index]);
+    }
+    return NULL;
+  }
+
+
+  // Mirrors what SimulationThread and the renderer do for the interactive
+  // game, with a fixed time step and CPU collision checks.
+  void RunSession(const SessionParams& params, SessionResult& result)
+  {
+    // A GameData is too big to live on a worker's stack.
+    GameData* game = new GameData(params.seed);
+    StartNewGame(*game);
+
+    long steps = 0;
+    while (steps < params.maxSteps) {
+      if (params.controller != NULL)
+        params.controller(*game, params.context);
+      game->player.input = ReadPlayerInput(game->window);
+
+      StepSimulation(*game);
+      ++steps;
+      if (game->gameState == eGameOver || game->gameState == eGameVictory)
+        break;
+
+      // The renderer only tests for collisions while the player is visible,
+      // and the next step picks them up, so do the same here.
+      if (game->gameState != eGameTitleScreen && PlayerHitAtom(*game, game->player))
+        game->collisionFrame = game->frameNumber;
+
+      if (game->gameState != eGamePaused)
+        game->gameTime += kSimulationStepTime;
+    }
+
+    result.finalState = game->gameState;
+    result.levelsCompleted = int(std::distance(game->levels.begin(), game->currentLevel));
+    result.livesRemaining = game->player.livesRemaining;
+    result.steps = steps;
+    result.gameTime = game->gameTime;
+
+    delete game;
+  }
+
+
+  unsigned int NumRunnerThreads(unsigned int count, unsigned int requested)
+  {
+    unsigned int numThreads = requested;
+    if (numThreads == 0) {
+      long numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+      numThreads = (numCPUs > 0) ? (unsigned int)numCPUs : 1;
+    }
+    if (numThreads > count)
+      numThreads = count;
+    return numThreads;
+  }
+
+} // namespace cat
+
@@ -0,0 +1,59 @@
+#ifndef cat_sessionrunner_h
+#define cat_sessionrunner_h
+
+#include "gamedata.h"
+
+namespace cat {
+
+  //
+  // Types
+  //
+
+  // Called before every step of a session to set its input, i.e. the key
+  // state in game.window (use SetKey from input.h). This is where a bot plugs
+  // in. It runs on a worker thread, so it must only touch the game it's given
+  // and its own context.
+  typedef void (*SessionController)(GameData& game, void* context);
+
+
+  struct SessionParams {
+    unsigned long seed;             // Chooses the levels; see GameData.
+    long maxSteps;                  // The session stops here if the game hasn't ended by then.
+    SessionController controller;   // If NULL, the player just stands still.
+    void* context;                  // Passed to the controller.
+
+    SessionParams();
+    SessionParams(unsigned long seed, long maxSteps,
+                  SessionController controller = NULL, void* context = NULL);
+  };
+
+
+  struct SessionResult {
+    GameState finalState;   // eGameOver or eGameVictory, unless the session ran out of steps.
+    int levelsCompleted;
+    int livesRemaining;
+    long steps;
+    double gameTime;        // In milliseconds.
+
+    SessionResult();
+  };
+
+
+  //
+  // Functions
+  //
+
+  // Plays each session from the start of a new game until it's won, lost or
+  // out of steps, without a window or GL context, and writes the outcome of
+  // sessions[i] to results[i]. Sessions are handed out to numThreads worker
+  // threads (0 means one per CPU) and the call returns once they've all
+  // finished. Game time advances by kSimulationStepTime per step and
+  // collisions come from PlayerHitAtom, so a session's result depends only on
+  // its parameters, not on which thread ran it or how busy the machine was.
+  void RunSessions(const SessionParams* sessions, SessionResult* results,
+                   unsigned int count, unsigned int numThreads = 0);
+
+} // namespace cat
+
+#endif // cat_sessionrunner_h
+
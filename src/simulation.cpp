@@ -0,0 +1,458 @@
+#include "simulation.h"
+
+#include "atomic.h"
+#include "audio.h"
+#include "input.h"
+#include "metrics.h"
+#include "profiler.h"
+
+namespace cat {
+
+  //
+  // Forward declarations
+  //
+
+  void UpdatePlayers(GameData& game);
+  void UpdateVersusLives(GameData& game, PlayerData& player);
+  void ResetPlayer(PlayerData& player);
+  void EmitEffect(GameData& game, EffectType type, const Vec2& pos);
+  void EmitSound(GameData& game, SoundType sound, const Vec2& pos);
+
+
+  //
+  // Global variables
+  //
+
+  static Metric* gStepsMetric = RegisterCounter(
+      "cat_simulation_steps_total", "Simulation steps run, including replayed ones.");
+  static Metric* gAtomsUpdatedMetric = RegisterCounter(
+      "cat_atoms_updated_total", "Atom moves calculated.");
+  static Metric* gCollisionsMetric = RegisterCounter(
+      "cat_collisions_total", "Hits which cost a player a life.");
+
+
+  //
+  // Functions
+  //
+
+  void StepSimulation(GameData& game)
+  {
+    PROFILE_ZONE("StepSimulation");
+
+    ++game.frameNumber;
+    IncrementCounter(gStepsMetric);
+
+    if (game.versus) {
+      // Both machines have to agree on every collision, so they can't come
+      // from the renderer.
+      game.player.collision = PlayerHitAtom(game, game.player);
+      game.opponent.collision = PlayerHitAtom(game, game.opponent);
+    }
+    else {
+      // Pick up any new collision the renderer has seen during the current life.
+      long collisionFrame = AtomicLoad(&game.collisionFrame);
+      if (collisionFrame >= game.collisionCheckFrame) {
+        game.player.collision = true;
+        game.collisionCheckFrame = collisionFrame + 1;
+      }
+    }
+
+    if (game.gameState != eGamePaused && !game.replaying)
+      game.effects.update();
+
+    switch (game.gameState) {
+    case eGameStartingLevel:
+      UpdatePlayers(game);
+      break;
+    case eGamePlaying:
+      // Calculations for the current frame.
+      UpdateAtoms(game);
+      UpdatePlayers(game);
+      break;
+    case eGameFinishedLevel:
+      UpdatePlayers(game);
+      break;
+    default:
+      break;
+    }
+    UpdateGameState(game);
+  }
+
+
+  void UpdateAtoms(GameData& game)
+  {
+    PROFILE_ZONE("UpdateAtoms");
+
+    if (game.currentLevel == game.levels.end())
+      return;
+
+    Level& level = *game.currentLevel;
+    Vec2 bottomLeft(kAtomSize / 2.0, kAtomSize / 2.0);
+    Vec2 topRight(1.0 - kAtomSize / 2.0, 1.0 - kAtomSize / 2.0);
+    IncrementCounter(gAtomsUpdatedMetric, level.atomCount);
+
+    // Move existing atoms
+    for (unsigned int i = 0; i < level.atomCount; ++i) {
+      Vec2 pos = level.position[i];
+      Vec2 vel = level.velocity[i];
+
+      pos += vel;
+      
+      if (pos.x < bottomLeft.x) {
+        pos.x = bottomLeft.x + (bottomLeft.x - pos.x);
+        vel.x = -vel.x;
+      }
+      else if (pos.x > topRight.x) {
+        pos.x = topRight.x - (pos.x - topRight.x);
+        vel.x = -vel.x;
+      }
+
+      if (pos.y < bottomLeft.y) {
+        pos.y = bottomLeft.y + (bottomLeft.y - pos.y);
+        vel.y = -vel.y;
+      }
+      else if (pos.y > topRight.y) {
+        pos.y = topRight.y - (pos.y - topRight.y);
+        vel.y = -vel.y;
+      }
+
+      level.position[i] = pos;
+      level.velocity[i] = vel;
+    }
+
+    // Emit new atoms
+    double levelTime = game.gameTime - game.stateChangeTime;
+    while (level.atomCount < kMaxAtoms && level.launchTime[level.atomCount] <= levelTime)
+      ++level.atomCount;
+  }
+
+
+  void UpdatePlayer(GameData& game, PlayerData& player)
+  {
+    PROFILE_ZONE("UpdatePlayer");
+
+    PlayerInput input = player.input;
+    Vec2 stick = InputStick(input);
+
+    // Handle player movement, a substep at a time. The keys move the player
+    // at full speed; the stick moves them at up to full speed, depending on
+    // how far it's pushed.
+    for (int i = 0; i < kInputSubsteps; ++i) {
+      PlayerInput directions = (input >> (i * kInputDirectionBits)) & eInputDirections;
+      if (directions == 0 && stick.x == 0 && stick.y == 0)
+        continue;
+
+      const double kScale = 0.01 / kInputSubsteps;
+      const Vec2 kRadius = player.size / 2.0;
+
+      Vec2 velocity;
+      if (directions != 0) {
+        if (directions & eInputLeft)
+          velocity.x -= 1;
+        if (directions & eInputRight)
+          velocity.x += 1;
+        if (directions & eInputUp)
+          velocity.y += 1;
+        if (directions & eInputDown)
+          velocity.y -= 1;
+        velocity = Unit(velocity) * kScale;
+      }
+      else {
+        velocity = stick * kScale;
+      }
+
+      player.position += velocity;
+      player.view = (velocity.y > 0) ? ePlayerBack : ePlayerFront;
+
+      Vec2 bottomLeft = player.position - kRadius;
+      Vec2 topRight = player.position + kRadius;
+
+      if (bottomLeft.x < 0.0)
+        player.position.x = kRadius.x;
+      else if (topRight.x > 1.0)
+        player.position.x = 1.0 - kRadius.x;
+
+      if (bottomLeft.y < 0.0)
+        player.position.y = kRadius.y;
+      else if (topRight.y > 1.0)
+        player.position.y = 1.0 - kRadius.y;
+    }
+
+    // Check whether a power up is expiring.
+    switch (player.powerUp) {
+      case ePowerUpSuperposition:
+      case ePowerUpEntanglement:
+        if (game.gameTime >= player.powerUpExpireTime)
+          player.powerUp = ePowerUpNone;
+        break;
+      case ePowerUpEntangling:
+        if (game.gameTime >= player.powerUpExpireTime)
+          player.powerUp = ePowerUpEntanglement;
+        break;
+      default:
+        break;
+    }
+
+    // Check whether the player is launching a power-up.
+    if (player.powerUp == ePowerUpNone) {
+      if ((input & eInputSuperposition) && player.superpositionsRemaining > 0) {
+        SetPowerUp(game, player, ePowerUpSuperposition);
+        --player.superpositionsRemaining;
+        EmitEffect(game, eEffectPowerUp, player.position);
+        EmitSound(game, eSoundPowerUp, player.position);
+      }
+      else if ((input & eInputEntanglement) && player.entanglementsRemaining > 0) {
+        SetPowerUp(game, player, ePowerUpEntangling);
+        --player.entanglementsRemaining;
+        EmitEffect(game, eEffectPowerUp, player.position);
+        EmitSound(game, eSoundPowerUp, player.position);
+      }
+    }
+  }
+
+
+  void UpdateGameState(GameData& game)
+  {
+    double elapsed = game.gameTime - game.stateChangeTime;
+    // The keyboard only belongs to one of the players in a versus game, so it
+    // can't be allowed to change anything there.
+    bool anyKeyPressed = !game.versus && AnyKeyPressed(game.window);
+
+    switch (game.gameState) {
+    case eGameTitleScreen:
+      if (anyKeyPressed)
+        StartNewGame(game);
+      break;
+
+    case eGamePaused:
+      if (anyKeyPressed)
+        SetGameState(game, eGamePlaying);
+      break;
+
+    case eGameOver:
+      if (game.versus)
+        break;
+      if (anyKeyPressed)
+        StartNewGame(game);
+      else if (elapsed >= 5000.0)
+        SetGameState(game, eGameTitleScreen);
+      break;
+
+    case eGameVictory:
+      if (game.versus)
+        break;
+      if (anyKeyPressed)
+        StartNewGame(game);
+      else if (elapsed >= 30000.0)
+        SetGameState(game, eGameTitleScreen);
+      break;
+
+    case eGameStartingLevel:
+      if (elapsed >= 3000.0) {
+        game.currentLevel->startLevel();
+        SetGameState(game, eGamePlaying);
+      }
+      break;
+
+    case eGameFinishedLevel:
+      if (elapsed >= 3000.0) {
+        ++game.currentLevel;
+        if (game.currentLevel != game.levels.end())
+          SetGameState(game, eGameStartingLevel);
+        else
+          SetGameState(game, eGameVictory);
+      }
+      break;
+
+    case eGamePlaying:
+      {
+        Level& level = *game.currentLevel;
+        if (elapsed >= level.duration) {
+          EmitSound(game, eSoundLevelComplete, Vec2(0.5, 0.5));
+          SetGameState(game, eGameFinishedLevel);
+          break;
+        }
+
+        if (game.versus) {
+          UpdateVersusLives(game, game.player);
+          UpdateVersusLives(game, game.opponent);
+          if (game.player.livesRemaining <= 0 || game.opponent.livesRemaining <= 0) {
+            EmitSound(game, eSoundGameOver, Vec2(0.5, 0.5));
+            SetGameState(game, eGameOver);
+          }
+          break;
+        }
+
+        PlayerData& player = game.player;
+        if (player.powerUp == ePowerUpSuperposition) {
+          player.collision = false;
+          break;
+        }
+        // TODO: add handling for entanglement.
+        if (player.collision) {
+          EmitEffect(game, eEffectLifeLost, player.position);
+          IncrementCounter(gCollisionsMetric);
+          --player.livesRemaining;
+          if (player.livesRemaining <= 0) {
+            EmitSound(game, eSoundGameOver, player.position);
+            SetGameState(game, eGameOver);
+          }
+          else {
+            EmitSound(game, eSoundLifeLost, player.position);
+            StartNewLife(game);
+          }
+        }
+      }
+    }
+  }
+
+
+  void StartNewGame(GameData& game)
+  {
+    SetGameState(game, eGameStartingLevel);
+    game.gameTime = 0;
+
+    ResetPlayer(game.player);
+    if (game.versus)
+      ResetPlayer(game.opponent);
+
+    game.currentLevel = game.levels.begin();
+    game.effects.clear();
+
+    StartNewLife(game);
+  }
+
+
+  void StartNewLife(GameData& game)
+  {
+    game.player.position = game.player.spawnPosition;
+    game.player.collision = false;
+    game.collisionCheckFrame = game.frameNumber;
+    SetPowerUp(game, game.player, ePowerUpNone);
+    if (game.versus) {
+      game.opponent.position = game.opponent.spawnPosition;
+      game.opponent.collision = false;
+      SetPowerUp(game, game.opponent, ePowerUpNone);
+    }
+
+    game.currentLevel->startLevel();
+    SetGameState(game, eGameStartingLevel);
+  }
+
+
+  void SetGameState(GameData& game, GameState state)
+  {
+    game.gameState = state;
+    game.stateChangeTime = game.gameTime;
+  }
+
+
+  void SetPowerUp(GameData& game, PlayerData& player, PowerUp powerUp)
+  {
+    const double kPowerUpDuration[] = { 0.0, 2000.0, 1000.0, 60000.0 };
+    double duration = kPowerUpDuration[powerUp];
+
+    player.powerUp = powerUp;
+    player.powerUpExpireTime = game.gameTime + duration;
+  }
+
+
+  PlayerInput ReadPlayerInput(const WindowData& window)
+  {
+    PlayerInput directions = 0;
+    if (window.leftPressed)
+      directions |= eInputLeft;
+    if (window.rightPressed)
+      directions |= eInputRight;
+    if (window.upPressed)
+      directions |= eInputUp;
+    if (window.downPressed)
+      directions |= eInputDown;
+
+    // The keys are held for the whole step.
+    PlayerInput input = SetInputStick(0, window.stick);
+    for (int i = 0; i < kInputSubsteps; ++i)
+      input |= directions << (i * kInputDirectionBits);
+    if (window.keyPressed['s'])
+      input |= eInputSuperposition;
+    if (window.keyPressed['d'])
+      input |= eInputEntanglement;
+    return input;
+  }
+
+
+  bool PlayerHitAtom(const GameData& game, const PlayerData& player)
+  {
+    if (game.currentLevel == game.levels.end())
+      return false;
+
+    const Level& level = *game.currentLevel;
+
+    double radius = (player.size.x + kAtomSize) / 2.0;
+    double radiusSqr = radius * radius;
+    for (unsigned int i = 0; i < level.atomCount; ++i) {
+      if (LengthSqr(level.position[i] - player.position) < radiusSqr)
+        return true;
+    }
+    return false;
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  void UpdatePlayers(GameData& game)
+  {
+    UpdatePlayer(game, game.player);
+    if (game.versus)
+      UpdatePlayer(game, game.opponent);
+  }
+
+
+  // In a versus game a hit costs a life but doesn't restart the level, since
+  // that would be unfair on the other player. Instead the player goes back
+  // to where they started, with a moment of invulnerability.
+  void UpdateVersusLives(GameData& game, PlayerData& player)
+  {
+    if (player.powerUp == ePowerUpSuperposition || !player.collision) {
+      player.collision = false;
+      return;
+    }
+
+    EmitEffect(game, eEffectLifeLost, player.position);
+    EmitSound(game, eSoundLifeLost, player.position);
+    if (!game.replaying)
+      IncrementCounter(gCollisionsMetric);
+    --player.livesRemaining;
+    player.position = player.spawnPosition;
+    player.collision = false;
+    SetPowerUp(game, player, ePowerUpSuperposition);
+  }
+
+
+  void ResetPlayer(PlayerData& player)
+  {
+    player.size = Vec2(0.06, 0.06);
+    player.livesRemaining = 9;
+    player.superpositionsRemaining = 3;
+    player.entanglementsRemaining = 1;
+  }
+
+
+  void EmitEffect(GameData& game, EffectType type, const Vec2& pos)
+  {
+    if (!game.replaying)
+      game.effects.emit(type, pos);
+  }
+
+
+  // Sounds are panned to follow whatever made them across the play area.
+  void EmitSound(GameData& game, SoundType sound, const Vec2& pos)
+  {
+    if (!game.replaying)
+      PlaySound(game.audio, sound, float(pos.x * 2.0 - 1.0));
+  }
+
+} // namespace cat
+
@@ -0,0 +1,56 @@
+#ifndef cat_simulation_h
+#define cat_simulation_h
+
+#include "gamedata.h"
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  // Length of one simulation step, in milliseconds of game time.
+  static const double kSimulationStepTime = 1000.0 / 60.0; // Targetting 60 fps.
+
+
+  //
+  // Functions
+  //
+
+  // Everything in here works only on the GameData it's given, so any number
+  // of independent sessions can be stepped at once, provided each one is only
+  // touched by a single thread at a time. None of these advance gameTime:
+  // that's up to the caller, since the interactive game pauses it and a
+  // headless session just adds kSimulationStepTime per step.
+
+  // Runs a single step of the game logic.
+  void StepSimulation(GameData& game);
+
+  void UpdateAtoms(GameData& game);
+  // Moves the player according to player.input and deals with power-ups.
+  void UpdatePlayer(GameData& game, PlayerData& player);
+  void UpdateGameState(GameData& game);
+
+  void StartNewGame(GameData& game);
+  void StartNewLife(GameData& game);
+
+  void SetGameState(GameData& game, GameState state);
+  void SetPowerUp(GameData& game, PlayerData& player, PowerUp powerUp);
+
+  // The player's input for a step comes from their PlayerData rather than
+  // straight from the keyboard, so that steps can be replayed. This fills it
+  // in from the keys currently held down, as if they'd been held for the
+  // whole step; the interactive game uses ConsumeInputEvents (see input.h)
+  // instead, which knows when during the step each key went down.
+  PlayerInput ReadPlayerInput(const WindowData& window);
+
+  // Checks whether the player currently overlaps any atom. The single player
+  // game gets collisions from the renderer (see DrawPlayer), which tests the
+  // actual sprite pixels; this treats the player and the atoms as circles,
+  // for sessions which run without a renderer and for versus games.
+  bool PlayerHitAtom(const GameData& game, const PlayerData& player);
+
+} // namespace cat
+
+#endif // cat_simulation_h
+
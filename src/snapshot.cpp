@@ -0,0 +1,447 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <deque>
+#include <iterator>
+
+namespace cat {
+
+  //
+  // Types
+  //
+
+  struct SnapshotPlayer {
+    int livesRemaining;
+    int powerUp;
+    int view;
+    int superpositionsRemaining;
+    int entanglementsRemaining;
+    int collision;
+    double powerUpExpireTime;
+    double position[2];
+    double size[2];
+  };
+
+
+  // The start of every snapshot. The atoms follow it: all the positions,
+  // then all the velocities, so that the velocities (which rarely change)
+  // make long runs of zeros in the deltas.
+  struct SnapshotHeader {
+    int gameState;
+    int levelIndex;
+    unsigned int atomCount;
+    double gameTime;
+    double stateChangeTime;
+    SnapshotPlayer player;
+    SnapshotPlayer opponent;
+  };
+
+  // Fails to compile if the header outgrows the space reserved for it.
+  typedef char SnapshotHeaderFits[(sizeof(SnapshotHeader) <= kSnapshotHeaderSize) ? 1 : -1];
+
+
+  struct RewindEntry {
+    size_t size;        // Bytes the delta takes up in the ring.
+    size_t olderSize;   // Size of the snapshot the delta leads back to.
+  };
+
+
+  struct RewindBuffer {
+    // Deltas are written into the ring back to back, wrapping round at the end.
+    unsigned char* ring;
+    size_t capacity;
+    size_t head;        // Where the next delta goes.
+    size_t used;        // Bytes of the ring in use.
+    std::deque<RewindEntry> entries; // Oldest first.
+
+    Snapshot* newest;
+    bool hasNewest;
+    Snapshot* incoming;
+    unsigned char* delta;   // The raw XOR of two snapshots.
+    unsigned char* scratch; // An encoded delta.
+
+    RewindBuffer(size_t capacity);
+    ~RewindBuffer();
+  };
+
+
+  //
+  // Constants
+  //
+
+  // Comfortably more than an encoded delta can ever need.
+  static const size_t kMaxEncodedDeltaSize = kMaxSnapshotSize * 2;
+
+  // A literal run ends at the first run of at least this many zero bytes.
+  static const size_t kMinZeroRun = 3;
+
+
+  //
+  // Forward declarations
+  //
+
+  void SavePlayer(const PlayerData& player, SnapshotPlayer* saved);
+  void RestorePlayer(const SnapshotPlayer& saved, PlayerData& player);
+  size_t EncodeDelta(const Snapshot& a, const Snapshot& b, unsigned char* delta, unsigned char* out);
+  void ApplyDelta(const unsigned char* in, size_t size, Snapshot* snapshot, size_t newSize);
+  unsigned char* WriteVarint(unsigned char* out, size_t value);
+  const unsigned char* ReadVarint(const unsigned char* in, size_t* value);
+  void WriteRing(RewindBuffer* buffer, const unsigned char* src, size_t size);
+  void ReadRing(const RewindBuffer* buffer, size_t start, size_t size, unsigned char* dst);
+
+
+  //
+  // Snapshot public methods
+  //
+
+  Snapshot::Snapshot() :
+    size(0)
+  {
+  }
+
+
+  //
+  // RewindBuffer public methods
+  //
+
+  RewindBuffer::RewindBuffer(size_t capacity) :
+    ring(new unsigned char[capacity]),
+    capacity(capacity),
+    head(0),
+    used(0),
+    entries(),
+    newest(new Snapshot()),
+    hasNewest(false),
+    incoming(new Snapshot()),
+    delta(new unsigned char[kMaxSnapshotSize]),
+    scratch(new unsigned char[kMaxEncodedDeltaSize])
+  {
+  }
+
+
+  RewindBuffer::~RewindBuffer()
+  {
+    delete[] scratch;
+    delete[] delta;
+    delete incoming;
+    delete newest;
+    delete[] ring;
+  }
+
+
+  //
+  // Public functions
+  //
+
+  void SaveSnapshot(const GameData& game, Snapshot* snapshot)
+  {
+    assert(snapshot != NULL);
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.gameState = game.gameState;
+    header.levelIndex = int(std::distance(game.levels.begin(),
+                                          std::list<Level>::const_iterator(game.currentLevel)));
+    header.gameTime = game.gameTime;
+    header.stateChangeTime = game.stateChangeTime;
+    SavePlayer(game.player, &header.player);
+    if (game.versus)
+      SavePlayer(game.opponent, &header.opponent);
+
+    unsigned char* out = snapshot->data + sizeof(SnapshotHeader);
+    if (game.currentLevel != game.levels.end()) {
+      const Level& level = *game.currentLevel;
+      size_t atomBytes = level.atomCount * sizeof(Vec2);
+      header.atomCount = level.atomCount;
+      memcpy(out, level.position, atomBytes);
+      memcpy(out + atomBytes, level.velocity, atomBytes);
+      out += atomBytes * 2;
+    }
+
+    memcpy(snapshot->data, &header, sizeof(header));
+    snapshot->size = out - snapshot->data;
+  }
+
+
+  void RestoreSnapshot(GameData& game, const Snapshot& snapshot)
+  {
+    assert(snapshot.size >= sizeof(SnapshotHeader));
+
+    SnapshotHeader header;
+    memcpy(&header, snapshot.data, sizeof(header));
+    assert(header.levelIndex >= 0 && size_t(header.levelIndex) <= game.levels.size());
+
+    game.gameState = GameState(header.gameState);
+    game.gameTime = header.gameTime;
+    game.stateChangeTime = header.stateChangeTime;
+    RestorePlayer(header.player, game.player);
+    if (game.versus)
+      RestorePlayer(header.opponent, game.opponent);
+
+    game.currentLevel = game.levels.begin();
+    std::advance(game.currentLevel, header.levelIndex);
+    if (game.currentLevel != game.levels.end()) {
+      Level& level = *game.currentLevel;
+      size_t atomBytes = header.atomCount * sizeof(Vec2);
+      const unsigned char* in = snapshot.data + sizeof(SnapshotHeader);
+      assert(snapshot.size == sizeof(SnapshotHeader) + atomBytes * 2);
+
+      // Atoms which weren't in play yet have to start from their launch
+      // positions again when they are.
+      if (level.atomCount > header.atomCount) {
+        std::copy(level.launchPosition + header.atomCount, level.launchPosition + level.atomCount,
+                  level.position + header.atomCount);
+        std::copy(level.launchVelocity + header.atomCount, level.launchVelocity + level.atomCount,
+                  level.velocity + header.atomCount);
+      }
+      level.atomCount = header.atomCount;
+      // Vec2 is just a pair of doubles, whatever the compiler thinks.
+      memcpy(static_cast<void*>(level.position), in, atomBytes);
+      memcpy(static_cast<void*>(level.velocity), in + atomBytes, atomBytes);
+
+      // Likewise for any later levels we'd already got to.
+      std::list<Level>::iterator later = game.currentLevel;
+      for (++later; later != game.levels.end(); ++later)
+        later->startLevel();
+    }
+
+    // Anything the renderer saw before now was drawn from the old state.
+    game.collisionCheckFrame = game.frameNumber + 1;
+  }
+
+
+  RewindBuffer* CreateRewindBuffer(size_t capacity)
+  {
+    assert(capacity > 0);
+    return new RewindBuffer(capacity);
+  }
+
+
+  void DestroyRewindBuffer(RewindBuffer* buffer)
+  {
+    delete buffer;
+  }
+
+
+  void RecordSnapshot(RewindBuffer* buffer, const GameData& game)
+  {
+    assert(buffer != NULL);
+
+    SaveSnapshot(game, buffer->incoming);
+    if (buffer->hasNewest) {
+      // What it takes to get from the new snapshot back to the previous one.
+      size_t size = EncodeDelta(*buffer->incoming, *buffer->newest, buffer->delta, buffer->scratch);
+      if (size + sizeof(RewindEntry) > buffer->capacity) {
+        buffer->entries.clear();
+        buffer->head = 0;
+        buffer->used = 0;
+      }
+      else {
+        // The entries count against the capacity too, otherwise a long run
+        // of identical steps (e.g. while paused) would grow without limit.
+        while (buffer->used + size + (buffer->entries.size() + 1) * sizeof(RewindEntry) > buffer->capacity) {
+          buffer->used -= buffer->entries.front().size;
+          buffer->entries.pop_front();
+        }
+        WriteRing(buffer, buffer->scratch, size);
+        RewindEntry entry = { size, buffer->newest->size };
+        buffer->entries.push_back(entry);
+      }
+    }
+
+    std::swap(buffer->newest, buffer->incoming);
+    buffer->hasNewest = true;
+  }
+
+
+  bool Rewind(RewindBuffer* buffer, unsigned int steps, GameData& game)
+  {
+    assert(buffer != NULL);
+
+    if (!buffer->hasNewest || steps > buffer->entries.size())
+      return false;
+
+    for (unsigned int i = 0; i < steps; ++i) {
+      const RewindEntry& entry = buffer->entries.back();
+      size_t start = (buffer->head + buffer->capacity - entry.size) % buffer->capacity;
+      ReadRing(buffer, start, entry.size, buffer->scratch);
+      ApplyDelta(buffer->scratch, entry.size, buffer->newest, entry.olderSize);
+
+      buffer->head = start;
+      buffer->used -= entry.size;
+      buffer->entries.pop_back();
+    }
+
+    RestoreSnapshot(game, *buffer->newest);
+    return true;
+  }
+
+
+  unsigned int RewindStepsAvailable(const RewindBuffer* buffer)
+  {
+    assert(buffer != NULL);
+    return buffer->hasNewest ? (unsigned int)buffer->entries.size() : 0;
+  }
+
+
+  void ClearRewindBuffer(RewindBuffer* buffer)
+  {
+    assert(buffer != NULL);
+
+    buffer->entries.clear();
+    buffer->head = 0;
+    buffer->used = 0;
+    buffer->hasNewest = false;
+  }
+
+
+  size_t RewindBytesUsed(const RewindBuffer* buffer)
+  {
+    assert(buffer != NULL);
+    return buffer->used + buffer->entries.size() * sizeof(RewindEntry) +
+           (buffer->hasNewest ? buffer->newest->size : 0);
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  void SavePlayer(const PlayerData& player, SnapshotPlayer* saved)
+  {
+    saved->livesRemaining = player.livesRemaining;
+    saved->powerUp = player.powerUp;
+    saved->view = player.view;
+    saved->superpositionsRemaining = player.superpositionsRemaining;
+    saved->entanglementsRemaining = player.entanglementsRemaining;
+    saved->collision = player.collision ? 1 : 0;
+    saved->powerUpExpireTime = player.powerUpExpireTime;
+    saved->position[0] = player.position.x;
+    saved->position[1] = player.position.y;
+    saved->size[0] = player.size.x;
+    saved->size[1] = player.size.y;
+  }
+
+
+  void RestorePlayer(const SnapshotPlayer& saved, PlayerData& player)
+  {
+    player.livesRemaining = saved.livesRemaining;
+    player.powerUp = PowerUp(saved.powerUp);
+    player.view = PlayerView(saved.view);
+    player.superpositionsRemaining = saved.superpositionsRemaining;
+    player.entanglementsRemaining = saved.entanglementsRemaining;
+    player.collision = (saved.collision != 0);
+    player.powerUpExpireTime = saved.powerUpExpireTime;
+    player.position = Vec2(saved.position[0], saved.position[1]);
+    player.size = Vec2(saved.size[0], saved.size[1]);
+  }
+
+
+  // Encodes the XOR of a and b, where the shorter one is treated as if it
+  // were padded out with zeros. The encoding is a series of (zero run length,
+  // literal run length, literal bytes) triples, with any trailing zeros left
+  // off. Returns the number of bytes written to out.
+  size_t EncodeDelta(const Snapshot& a, const Snapshot& b, unsigned char* delta, unsigned char* out)
+  {
+    const Snapshot& shorter = (a.size < b.size) ? a : b;
+    const Snapshot& longer = (a.size < b.size) ? b : a;
+    size_t n = longer.size;
+
+    for (size_t i = 0; i < shorter.size; ++i)
+      delta[i] = a.data[i] ^ b.data[i];
+    memcpy(delta + shorter.size, longer.data + shorter.size, n - shorter.size);
+
+    unsigned char* start = out;
+    size_t i = 0;
+    for (;;) {
+      size_t zeroStart = i;
+      while (i < n && delta[i] == 0)
+        ++i;
+      if (i == n)
+        break;
+
+      size_t literalStart = i;
+      size_t zeros = 0;
+      while (i < n && zeros < kMinZeroRun) {
+        zeros = (delta[i] == 0) ? zeros + 1 : 0;
+        ++i;
+      }
+      i -= zeros;
+
+      out = WriteVarint(out, literalStart - zeroStart);
+      out = WriteVarint(out, i - literalStart);
+      memcpy(out, delta + literalStart, i - literalStart);
+      out += i - literalStart;
+    }
+    return out - start;
+  }
+
+
+  // XORs an encoded delta into snapshot, which then becomes newSize bytes
+  // long.
+  void ApplyDelta(const unsigned char* in, size_t size, Snapshot* snapshot, size_t newSize)
+  {
+    if (newSize > snapshot->size)
+      memset(snapshot->data + snapshot->size, 0, newSize - snapshot->size);
+
+    const unsigned char* end = in + size;
+    unsigned char* out = snapshot->data;
+    while (in < end) {
+      size_t zeros, literals;
+      in = ReadVarint(in, &zeros);
+      in = ReadVarint(in, &literals);
+      out += zeros;
+      for (size_t i = 0; i < literals; ++i)
+        out[i] ^= in[i];
+      out += literals;
+      in += literals;
+    }
+    snapshot->size = newSize;
+  }
+
+
+  unsigned char* WriteVarint(unsigned char* out, size_t value)
+  {
+    while (value >= 0x80) {
+      *out++ = (unsigned char)(value | 0x80);
+      value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+    return out;
+  }
+
+
+  const unsigned char* ReadVarint(const unsigned char* in, size_t* value)
+  {
+    size_t result = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+      result |= size_t(*in++ & 0x7F) << shift;
+      shift += 7;
+    }
+    *value = result | (size_t(*in++) << shift);
+    return in;
+  }
+
+
+  void WriteRing(RewindBuffer* buffer, const unsigned char* src, size_t size)
+  {
+    size_t first = std::min(size, buffer->capacity - buffer->head);
+    memcpy(buffer->ring + buffer->head, src, first);
+    memcpy(buffer->ring, src + first, size - first);
+    buffer->head = (buffer->head + size) % buffer->capacity;
+    buffer->used += size;
+  }
+
+
+  void ReadRing(const RewindBuffer* buffer, size_t start, size_t size, unsigned char* dst)
+  {
+    size_t first = std::min(size, buffer->capacity - start);
+    memcpy(dst, buffer->ring + start, first);
+    memcpy(dst + first, buffer->ring, size - first);
+  }
+
+} // namespace cat
+
@@ -0,0 +1,76 @@
+#ifndef cat_snapshot_h
+#define cat_snapshot_h
+
+#include "gamedata.h"
+#include "level.h"
+
+#include <cstddef>
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  // Space reserved at the start of a snapshot for everything except the atoms.
+  static const size_t kSnapshotHeaderSize = 256;
+  // Big enough for a snapshot of a level with every atom in play.
+  static const size_t kMaxSnapshotSize = kSnapshotHeaderSize + kMaxAtoms * 2 * sizeof(Vec2);
+
+
+  //
+  // Forward declarations
+  //
+
+  struct RewindBuffer; // Opaque; see snapshot.cpp.
+
+
+  //
+  // Types
+  //
+
+  // The part of a GameData which changes as the game runs: the game state and
+  // timers, the player (and opponent, in a versus game), and the atoms in the
+  // current level. The levels themselves, the window and the particle effects
+  // aren't included, so a snapshot can only be restored into a GameData with
+  // the same seed.
+  struct Snapshot {
+    size_t size;
+    unsigned char data[kMaxSnapshotSize];
+
+    Snapshot();
+  };
+
+
+  //
+  // Functions
+  //
+
+  void SaveSnapshot(const GameData& game, Snapshot* snapshot);
+  // Any collisions the renderer has reported for frames before the restore
+  // are ignored.
+  void RestoreSnapshot(GameData& game, const Snapshot& snapshot);
+
+  // A history of recent snapshots in a fixed amount of memory. The newest is
+  // kept whole; each older one is stored as the XOR of it with the one after,
+  // with the runs of zero bytes squeezed out. When the buffer fills up the
+  // oldest snapshots are dropped.
+  RewindBuffer* CreateRewindBuffer(size_t capacity);
+  void DestroyRewindBuffer(RewindBuffer* buffer);
+
+  // Call once per simulation step.
+  void RecordSnapshot(RewindBuffer* buffer, const GameData& game);
+  // Restores the game to the state it was in the given number of recorded
+  // steps before the newest one, and forgets everything after that. Returns
+  // false, without changing anything, if the buffer doesn't go back that far.
+  bool Rewind(RewindBuffer* buffer, unsigned int steps, GameData& game);
+  // How many steps you can rewind by.
+  unsigned int RewindStepsAvailable(const RewindBuffer* buffer);
+  void ClearRewindBuffer(RewindBuffer* buffer);
+  // Includes the newest snapshot, but not the fixed overheads.
+  size_t RewindBytesUsed(const RewindBuffer* buffer);
+
+} // namespace cat
+
+#endif // cat_snapshot_h
+
@@ -0,0 +1,386 @@
+#include "texturecache.h"
+
+#include "assetpack.h"
+#include "glstate.h"
+#include "image.h"
+#include "resource.h"
+#include "textureloader.h"
+#include "texturestream.h"
+
+#include <cassert>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+#ifdef linux
+#include <GL/gl.h>
+#else
+#include <OpenGL/gl.h>
+#endif
+
+namespace cat {
+
+  //
+  // Types
+  //
+
+  typedef std::list<CachedTexture*> TextureList;
+
+
+  struct CachedTexture {
+    ResourceID resource;
+    unsigned int textureID;
+    size_t bytes;
+    unsigned int refCount;
+    bool isUnused;              // True if the texture is in the unused list.
+    TextureList::iterator unusedPos;
+
+    CachedTexture();
+  };
+
+
+  typedef std::map<ResourceID, CachedTexture*> TextureMap;
+
+
+  struct TextureCache {
+    TextureMap textures;
+    // Unreferenced textures, most recently released first.
+    TextureList unused;
+    size_t budget;
+    size_t bytesUsed;
+    AssetPack* pack;
+    ResourceData packData;  // If the pack came from an archive.
+    // Textures whose images have changed since the pack was baked.
+    std::set<ResourceID> stale;
+    TextureStreamer* streamer;
+
+    TextureCache(size_t budget, const char* packName);
+    ~TextureCache();
+  };
+
+
+  //
+  // Forward declarations
+  //
+
+  CachedTexture* InsertTexture(TextureCache* cache, ResourceID resource,
+                               unsigned int textureID, size_t bytes);
+  void AddReference(TextureCache* cache, CachedTexture* texture);
+  void EvictTextures(TextureCache* cache);
+  void DeleteTexture(TextureCache* cache, CachedTexture* texture);
+
+
+  //
+  // CachedTexture public methods
+  //
+
+  CachedTexture::CachedTexture() :
+    resource(kNoResource),
+    textureID(0),
+    bytes(0),
+    refCount(0),
+    isUnused(false),
+    unusedPos()
+  {
+  }
+
+
+  //
+  // TextureCache public methods
+  //
+
+  TextureCache::TextureCache(size_t budget, const char* packName) :
+    textures(),
+    unused(),
+    budget(budget),
+    bytesUsed(0),
+    pack(NULL),
+    packData(),
+    stale(),
+    streamer(NULL)
+  {
+    if (packName == NULL)
+      return;
+
+    ResourceID packID = RegisterResource(packName);
+    pack = OpenAssetPack(ResourceFilePath(packID));
+    if (pack == NULL && ReadArchivedResource(packID, &packData)) {
+      pack = OpenAssetPackInMemory(packData.bytes, packData.size);
+      if (pack == NULL)
+        ReleaseResourceData(&packData);
+    }
+  }
+
+
+  TextureCache::~TextureCache()
+  {
+    for (TextureMap::iterator it = textures.begin(); it != textures.end(); ++it) {
+      CachedTexture* texture = it->second;
+      if (texture->refCount > 0)
+        fprintf(stderr, "Texture %s is still referenced.\n", ResourceName(texture->resource));
+      DeleteTexture(this, texture);
+    }
+    CloseAssetPack(pack);
+    ReleaseResourceData(&packData);
+  }
+
+
+  //
+  // Public functions
+  //
+
+  TextureCache* CreateTextureCache(size_t budget, const char* packName)
+  {
+    return new TextureCache(budget, packName);
+  }
+
+
+  void DestroyTextureCache(TextureCache* cache)
+  {
+    delete cache;
+  }
+
+
+  void AcquireTextures(TextureCache* cache, const char* const* paths,
+                       unsigned int count, CachedTexture** textures)
+  {
+    assert(cache != NULL);
+    assert(paths != NULL || count == 0);
+    assert(textures != NULL || count == 0);
+
+    // Intern every path first, so that there's nothing to undo if one fails.
+    std::vector<ResourceID> resources(count, kNoResource);
+    for (unsigned int i = 0; i < count; ++i) {
+      resources[i] = RegisterResource(paths[i]);
+      if (resources[i] == kNoResource)
+        throw ImageException("Unable to register %s as a resource.", paths[i]);
+    }
+
+    // Anything resident just gets another reference. Anything in the pack can
+    // be uploaded straight away. The rest have to be decoded, which we do all
+    // at once so it can happen in parallel.
+    std::vector<TextureRequest> requests;
+    std::vector<unsigned int> requestIndex;
+    std::vector<unsigned int> requestIDs;
+    requests.reserve(count);
+    requestIndex.reserve(count);
+    requestIDs.reserve(count);
+
+    for (unsigned int i = 0; i < count; ++i) {
+      ResourceID resource = resources[i];
+      TextureMap::iterator it = cache->textures.find(resource);
+      if (it != cache->textures.end()) {
+        textures[i] = it->second;
+        AddReference(cache, textures[i]);
+        continue;
+      }
+
+      const PackedTexture* packed = NULL;
+      if (cache->stale.count(resource) == 0)
+        packed = FindPackedTexture(cache->pack, paths[i]);
+      if (packed != NULL) {
+        size_t bytes = 0;
+        for (unsigned int l = 0; l < packed->numLevels; ++l)
+          bytes += size_t(packed->levels[l].width) * packed->levels[l].height * 4;
+        textures[i] = InsertTexture(cache, resource, UploadPackedTexture(cache->pack, packed), bytes);
+        AddReference(cache, textures[i]);
+        continue;
+      }
+
+      // The same path may be asked for twice in one batch; only load it once.
+      textures[i] = NULL;
+      bool alreadyRequested = false;
+      for (unsigned int r = 0; r < requestIndex.size() && !alreadyRequested; ++r)
+        alreadyRequested = (resources[requestIndex[r]] == resource);
+      if (alreadyRequested)
+        continue;
+
+      requests.push_back(TextureRequest(resource, NULL));
+      requestIndex.push_back(i);
+    }
+
+    if (!requests.empty()) {
+      requestIDs.resize(requests.size(), 0);
+      for (unsigned int r = 0; r < requests.size(); ++r)
+        requests[r].textureID = &requestIDs[r];
+
+      try {
+        LoadTextures(&requests[0], requests.size());
+      } catch (ImageException& ex) {
+        // Release everything we did get, including any textures which did
+        // upload in this batch.
+        for (unsigned int r = 0; r < requests.size(); ++r) {
+          if (requestIDs[r] != 0)
+            glDeleteTextures(1, &requestIDs[r]);
+        }
+        for (unsigned int i = 0; i < count; ++i) {
+          ReleaseTexture(cache, textures[i]);
+          textures[i] = NULL;
+        }
+        throw ex;
+      }
+
+      for (unsigned int r = 0; r < requests.size(); ++r) {
+        unsigned int i = requestIndex[r];
+        textures[i] = InsertTexture(cache, resources[i], requestIDs[r], requests[r].bytes);
+        AddReference(cache, textures[i]);
+      }
+    }
+
+    // Fill in the duplicates.
+    for (unsigned int i = 0; i < count; ++i) {
+      if (textures[i] == NULL) {
+        textures[i] = cache->textures[resources[i]];
+        AddReference(cache, textures[i]);
+      }
+    }
+
+    EvictTextures(cache);
+  }
+
+
+  CachedTexture* AcquireTexture(TextureCache* cache, const char* path)
+  {
+    CachedTexture* texture = NULL;
+    AcquireTextures(cache, &path, 1, &texture);
+    return texture;
+  }
+
+
+  void ReleaseTexture(TextureCache* cache, CachedTexture* texture)
+  {
+    assert(cache != NULL);
+    if (texture == NULL)
+      return;
+
+    assert(texture->refCount > 0);
+    if (--texture->refCount > 0)
+      return;
+
+    cache->unused.push_front(texture);
+    texture->unusedPos = cache->unused.begin();
+    texture->isUnused = true;
+    EvictTextures(cache);
+  }
+
+
+  CachedTexture* FindTexture(TextureCache* cache, const char* path)
+  {
+    assert(cache != NULL);
+    TextureMap::iterator it = cache->textures.find(RegisterResource(path));
+    return (it != cache->textures.end()) ? it->second : NULL;
+  }
+
+
+  void TextureChanged(TextureCache* cache, const char* path, size_t bytes)
+  {
+    assert(cache != NULL);
+
+    ResourceID resource = RegisterResource(path);
+    cache->stale.insert(resource);
+
+    TextureMap::iterator it = cache->textures.find(resource);
+    if (it != cache->textures.end()) {
+      CachedTexture* texture = it->second;
+      cache->bytesUsed = cache->bytesUsed - texture->bytes + bytes;
+      texture->bytes = bytes;
+      EvictTextures(cache);
+    }
+  }
+
+
+  unsigned int TextureID(const CachedTexture* texture)
+  {
+    return (texture != NULL) ? texture->textureID : 0;
+  }
+
+
+  const char* TexturePath(const CachedTexture* texture)
+  {
+    assert(texture != NULL);
+    return ResourceName(texture->resource);
+  }
+
+
+  void SetTextureStreamer(TextureCache* cache, TextureStreamer* streamer)
+  {
+    assert(cache != NULL);
+    cache->streamer = streamer;
+  }
+
+
+  void SetTextureBudget(TextureCache* cache, size_t budget)
+  {
+    assert(cache != NULL);
+    cache->budget = budget;
+    EvictTextures(cache);
+  }
+
+
+  size_t TextureBudget(const TextureCache* cache)
+  {
+    assert(cache != NULL);
+    return cache->budget;
+  }
+
+
+  size_t TextureBytesUsed(const TextureCache* cache)
+  {
+    assert(cache != NULL);
+    return cache->bytesUsed;
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  CachedTexture* InsertTexture(TextureCache* cache, ResourceID resource,
+                               unsigned int textureID, size_t bytes)
+  {
+    CachedTexture* texture = new CachedTexture();
+    cache->textures.insert(std::make_pair(resource, texture));
+    texture->resource = resource;
+    texture->textureID = textureID;
+    texture->bytes = bytes;
+    cache->bytesUsed += bytes;
+    return texture;
+  }
+
+
+  void AddReference(TextureCache* cache, CachedTexture* texture)
+  {
+    if (texture->isUnused) {
+      cache->unused.erase(texture->unusedPos);
+      texture->isUnused = false;
+    }
+    ++texture->refCount;
+  }
+
+
+  void EvictTextures(TextureCache* cache)
+  {
+    while (cache->bytesUsed > cache->budget && !cache->unused.empty()) {
+      CachedTexture* texture = cache->unused.back();
+      cache->unused.pop_back();
+
+      cache->bytesUsed -= texture->bytes;
+      cache->textures.erase(texture->resource);
+      DeleteTexture(cache, texture);
+    }
+  }
+
+
+  void DeleteTexture(TextureCache* cache, CachedTexture* texture)
+  {
+    if (cache->streamer != NULL)
+      CancelStreamedTexture(cache->streamer, texture->textureID);
+    ForgetTexture(texture->textureID);
+    glDeleteTextures(1, &texture->textureID);
+    delete texture;
+  }
+
+} // namespace cat
+
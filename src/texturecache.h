@@ -0,0 +1,77 @@
+#ifndef cat_texturecache_h
+#define cat_texturecache_h
+
+#include <cstddef>
+
+namespace cat {
+
+  //
+  // Forward type declarations
+  //
+
+  struct CachedTexture;   // Opaque; see texturecache.cpp for details.
+  struct TextureCache;    // Opaque; see texturecache.cpp for details.
+  struct TextureStreamer;
+
+
+  //
+  // Functions
+  //
+
+  // Keeps one copy of each texture, keyed by its interned resource path (see
+  // resource.h, so case is ignored), and counts references to it. Textures nobody references any more
+  // stay resident in case they're wanted again, until the total size of all
+  // textures goes over the budget; then the least recently released ones are
+  // deleted to make room. Textures which are still referenced are never
+  // evicted, so the budget can be exceeded if everything is in use.
+  //
+  // All of these must be called on the thread which owns the GL context.
+
+  // packName is the resource path of a baked asset pack (see assetpack.h) to
+  // load textures from; it can be a file or in a mounted archive. Anything
+  // not in the pack, or everything if there's no pack, is loaded from the
+  // images instead. budget is in bytes.
+  TextureCache* CreateTextureCache(size_t budget, const char* packName);
+  // Every texture must have been released first.
+  void DestroyTextureCache(TextureCache* cache);
+
+  // Returns a reference to the texture for each of the given resource paths,
+  // loading any which aren't resident. Missing textures are loaded in
+  // parallel. Throws an ImageException if any of them fail to load, after
+  // releasing the ones which succeeded.
+  void AcquireTextures(TextureCache* cache, const char* const* paths,
+                       unsigned int count, CachedTexture** textures);
+  CachedTexture* AcquireTexture(TextureCache* cache, const char* path);
+
+  // Drops a reference from AcquireTexture(s). Passing NULL is fine.
+  void ReleaseTexture(TextureCache* cache, CachedTexture* texture);
+
+  // Returns the resident texture for path, or NULL if it isn't resident.
+  // Doesn't add a reference.
+  CachedTexture* FindTexture(TextureCache* cache, const char* path);
+
+  // Call when the image file behind path has changed. The pack's copy is now
+  // out of date, so from here on the texture always gets loaded from the
+  // file. If the texture is resident, its size is updated to bytes; the
+  // caller is responsible for replacing its contents.
+  void TextureChanged(TextureCache* cache, const char* path, size_t bytes);
+
+  unsigned int TextureID(const CachedTexture* texture);
+  // The resource path, as first registered.
+  const char* TexturePath(const CachedTexture* texture);
+
+  // The streamer which replaces the contents of changed textures, if any.
+  // Uploads still pending for a texture get cancelled before it's deleted.
+  // The streamer must outlive the cache.
+  void SetTextureStreamer(TextureCache* cache, TextureStreamer* streamer);
+
+  // Changes the budget, evicting textures straight away if necessary.
+  void SetTextureBudget(TextureCache* cache, size_t budget);
+  size_t TextureBudget(const TextureCache* cache);
+  // Estimated video memory used by every resident texture.
+  size_t TextureBytesUsed(const TextureCache* cache);
+
+} // namespace cat
+
+#endif // cat_texturecache_h
+
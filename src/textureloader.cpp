@@ -0,0 +1,269 @@
+#include "textureloader.h"
+
+#include "image.h"
+#include "metrics.h"
+#include "profiler.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  // Decoding is mostly memory bound, so there's little point going wider
+  // than this even on machines with lots of cores.
+  static const unsigned int kMaxLoaderThreads = 8;
+
+
+  //
+  // Types
+  //
+
+  struct LoadJob {
+    Image* image;
+    bool failed;
+    char error[1024];
+
+    LoadJob();
+  };
+
+
+  // Shared between the calling thread and the workers. Everything in here
+  // is protected by lock.
+  struct LoaderState {
+    TextureRequest* requests;
+    unsigned int count;
+    std::vector<LoadJob> jobs;
+
+    unsigned int nextJob;             // Next request for a worker to decode.
+    std::vector<unsigned int> ready;  // Decoded requests awaiting upload.
+
+    pthread_mutex_t lock;
+    pthread_cond_t readyChanged;
+
+    LoaderState(TextureRequest* requests, unsigned int count);
+    ~LoaderState();
+  };
+
+
+  //
+  // Forward declarations
+  //
+
+  void* LoaderThread(void* arg);
+  Image* LoadImage(ResourceID resource) throw(ImageException);
+  unsigned int NumLoaderThreads(unsigned int count);
+
+
+  //
+  // Global variables
+  //
+
+  static const double kLoadTimeBounds[] = { 1, 2, 5, 10, 20, 50, 100, 250, 500, 1000 };
+  static Metric* gLoadTimeMetric = RegisterHistogram(
+      "cat_image_load_milliseconds", "Time to read, decode and convert each texture image.",
+      kLoadTimeBounds, sizeof(kLoadTimeBounds) / sizeof(kLoadTimeBounds[0]));
+
+
+  //
+  // TextureRequest public methods
+  //
+
+  TextureRequest::TextureRequest() :
+    resource(kNoResource),
+    textureID(NULL),
+    bytes(0)
+  {
+  }
+
+
+  TextureRequest::TextureRequest(ResourceID resource, unsigned int* textureID) :
+    resource(resource),
+    textureID(textureID),
+    bytes(0)
+  {
+  }
+
+
+  //
+  // LoadJob public methods
+  //
+
+  LoadJob::LoadJob() :
+    image(NULL),
+    failed(false)
+  {
+    error[0] = '\0';
+  }
+
+
+  //
+  // LoaderState public methods
+  //
+
+  LoaderState::LoaderState(TextureRequest* requests, unsigned int count) :
+    requests(requests),
+    count(count),
+    jobs(count),
+    nextJob(0),
+    ready()
+  {
+    ready.reserve(count);
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&readyChanged, NULL);
+  }
+
+
+  LoaderState::~LoaderState()
+  {
+    pthread_cond_destroy(&readyChanged);
+    pthread_mutex_destroy(&lock);
+  }
+
+
+  //
+  // Public functions
+  //
+
+  void LoadTextures(TextureRequest* requests, unsigned int count)
+  {
+    PROFILE_ZONE("LoadTextures");
+
+    assert(requests != NULL || count == 0);
+    if (count == 0)
+      return;
+
+    LoaderState state(requests, count);
+
+    std::vector<pthread_t> threads;
+    unsigned int numThreads = NumLoaderThreads(count);
+    for (unsigned int i = 0; i < numThreads; ++i) {
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, LoaderThread, &state) == 0)
+        threads.push_back(thread);
+    }
+    // If we couldn't start any threads, do the decoding ourselves.
+    if (threads.empty())
+      LoaderThread(&state);
+
+    // Upload each image as soon as a worker finishes with it.
+    const char* firstError = NULL;
+    for (unsigned int uploaded = 0; uploaded < count; ++uploaded) {
+      pthread_mutex_lock(&state.lock);
+      while (state.ready.size() <= uploaded)
+        pthread_cond_wait(&state.readyChanged, &state.lock);
+      unsigned int index = state.ready[uploaded];
+      pthread_mutex_unlock(&state.lock);
+
+      LoadJob& job = state.jobs[index];
+      if (job.failed) {
+        if (firstError == NULL)
+          firstError = job.error;
+        continue;
+      }
+
+      job.image->uploadTexture();
+      *requests[index].textureID = job.image->getTexID();
+      requests[index].bytes = size_t(job.image->getWidth()) * job.image->getHeight() *
+                              job.image->getBytesPerPixel();
+      delete job.image;
+      job.image = NULL;
+    }
+
+    for (unsigned int i = 0; i < threads.size(); ++i)
+      pthread_join(threads[i], NULL);
+
+    if (firstError != NULL)
+      throw ImageException("%s", firstError);
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  void* LoaderThread(void* arg)
+  {
+    LoaderState* state = static_cast<LoaderState*>(arg);
+    SetProfileThreadName("Texture loader");
+
+    for (;;) {
+      pthread_mutex_lock(&state->lock);
+      unsigned int index = state->nextJob;
+      if (index < state->count)
+        ++state->nextJob;
+      pthread_mutex_unlock(&state->lock);
+
+      if (index >= state->count)
+        break;
+
+      LoadJob& job = state->jobs[index];
+      try {
+        double startTime = ProfileTime();
+        job.image = LoadImage(state->requests[index].resource);
+        // Get the pixels into the layout the GPU wants while we're still
+        // off the GL thread.
+        job.image->convertToBGRA();
+        job.image->premultiplyAlpha();
+        ObserveHistogram(gLoadTimeMetric, ProfileTime() - startTime);
+      } catch (ImageException& ex) {
+        job.failed = true;
+        snprintf(job.error, sizeof(job.error), "%s", ex.what());
+      }
+
+      pthread_mutex_lock(&state->lock);
+      state->ready.push_back(index);
+      pthread_cond_signal(&state->readyChanged);
+      pthread_mutex_unlock(&state->lock);
+    }
+    return NULL;
+  }
+
+
+  // Loose files take priority, so they can override what's in an archive.
+  Image* LoadImage(ResourceID resource) throw(ImageException)
+  {
+    PROFILE_ZONE("LoadImage");
+
+    const char* path = ResourceFilePath(resource);
+    if (path == NULL)
+      throw ImageException("Unknown resource %u.", resource);
+    if (access(path, R_OK) == 0)
+      return new Image(path);
+
+    ResourceData data;
+    if (!ReadArchivedResource(resource, &data))
+      throw ImageException("File not found: %s.", path);
+
+    Image* image = NULL;
+    try {
+      image = new Image(ResourceName(resource), data.bytes, data.size);
+    } catch (ImageException& ex) {
+      ReleaseResourceData(&data);
+      throw ex;
+    }
+    ReleaseResourceData(&data);
+    return image;
+  }
+
+
+  unsigned int NumLoaderThreads(unsigned int count)
+  {
+    long numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int numThreads = (numCPUs > 0) ? (unsigned int)numCPUs : 1;
+    if (numThreads > kMaxLoaderThreads)
+      numThreads = kMaxLoaderThreads;
+    if (numThreads > count)
+      numThreads = count;
+    return numThreads;
+  }
+
+} // namespace cat
+
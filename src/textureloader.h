@@ -0,0 +1,40 @@
+#ifndef cat_textureloader_h
+#define cat_textureloader_h
+
+#include "resource.h"
+
+#include <cstddef>
+
+namespace cat {
+
+  //
+  // Types
+  //
+
+  struct TextureRequest {
+    ResourceID resource;
+    unsigned int* textureID;  // Receives the ID of the uploaded texture.
+    size_t bytes;             // Receives the size of the uploaded texture.
+
+    TextureRequest();
+    TextureRequest(ResourceID resource, unsigned int* textureID);
+  };
+
+
+  //
+  // Functions
+  //
+
+  // Reads every requested image from its file, or from a mounted archive if
+  // there's no file, then decodes it on a pool of worker threads, converts it
+  // to premultiplied BGRA and uploads each one as soon as it's ready.
+  // Decoding runs in parallel; the uploads all happen on the calling thread,
+  // which must own the GL context. Returns once every texture is uploaded. If
+  // any image fails to load, the rest are still uploaded and then the first
+  // failure is rethrown as an ImageException.
+  void LoadTextures(TextureRequest* requests, unsigned int count);
+
+} // namespace cat
+
+#endif // cat_textureloader_h
+
@@ -0,0 +1,321 @@
+#include "texturestream.h"
+
+#include "glstate.h"
+#include "image.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <list>
+
+#define GL_GLEXT_PROTOTYPES 1
+#ifdef linux
+#include <GL/gl.h>
+#include <GL/glext.h>
+#else
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+#endif
+
+namespace cat {
+
+  //
+  // Constants
+  //
+
+  static const unsigned int kNumStagingBuffers = 4;
+  static const unsigned int kStagingBufferSize = 256 * 1024;
+
+  // Upper limit on how much we upload in a single frame. At 60fps this is
+  // about 60MB/s, which is plenty for the game's art while staying well
+  // clear of the bandwidth the frame itself needs.
+  static const unsigned int kBytesPerFrame = 1024 * 1024;
+
+
+  //
+  // Types
+  //
+
+  struct StreamJob {
+    Image* image;
+    GLuint textureID;
+    unsigned int rowBytes;
+    unsigned int rowsPerSlice;
+    unsigned int nextRow;
+    GLenum format;
+    GLenum dataType;
+  };
+
+
+  struct StagingBuffer {
+    GLuint bufferID;
+    GLsync fence;   // Set once the buffer has been handed to GL.
+  };
+
+
+  struct TextureStreamer {
+    bool usePBOs;
+    bool useFences;
+    StagingBuffer buffers[kNumStagingBuffers];
+    unsigned int nextBuffer;
+    std::list<StreamJob> jobs;  // Uploaded in order, oldest first.
+
+    TextureStreamer(bool usePBOs, bool useFences);
+    ~TextureStreamer();
+  };
+
+
+  //
+  // Forward declarations
+  //
+
+  bool UploadSlice(TextureStreamer* streamer, StreamJob& job);
+  void FinishJob(StreamJob& job);
+
+
+  //
+  // TextureStreamer public methods
+  //
+
+  TextureStreamer::TextureStreamer(bool usePBOs, bool useFences) :
+    usePBOs(usePBOs),
+    useFences(usePBOs && useFences),
+    nextBuffer(0),
+    jobs()
+  {
+    for (unsigned int i = 0; i < kNumStagingBuffers; ++i) {
+      buffers[i].bufferID = 0;
+      buffers[i].fence = 0;
+      if (usePBOs) {
+        glGenBuffers(1, &buffers[i].bufferID);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i].bufferID);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, kStagingBufferSize, NULL, GL_STREAM_DRAW);
+      }
+    }
+    if (usePBOs)
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+
+  TextureStreamer::~TextureStreamer()
+  {
+    for (std::list<StreamJob>::iterator job = jobs.begin(); job != jobs.end(); ++job)
+      delete job->image;
+
+    for (unsigned int i = 0; i < kNumStagingBuffers; ++i) {
+      if (buffers[i].fence)
+        glDeleteSync(buffers[i].fence);
+      if (buffers[i].bufferID)
+        glDeleteBuffers(1, &buffers[i].bufferID);
+    }
+  }
+
+
+  //
+  // Public functions
+  //
+
+  TextureStreamer* CreateTextureStreamer(bool usePBOs, bool useFences)
+  {
+    return new TextureStreamer(usePBOs, useFences);
+  }
+
+
+  void DestroyTextureStreamer(TextureStreamer* streamer)
+  {
+    delete streamer;
+  }
+
+
+  unsigned int StreamTexture(TextureStreamer* streamer, Image* image, unsigned int textureID)
+  {
+    assert(streamer != NULL);
+    assert(image != NULL);
+
+    // Sized formats, since that's what the driver reports back for the
+    // existing texture below; comparing against unsized ones would never
+    // match, and every reload would reallocate.
+    GLenum internalFormat;
+    switch (image->getType()) {
+      case GL_BGR:
+        internalFormat = GL_RGB8;
+        break;
+      case GL_BGRA:
+        internalFormat = GL_RGBA8;
+        break;
+      case GL_ALPHA:
+        internalFormat = GL_ALPHA8;
+        break;
+      default:
+        internalFormat = image->getType();
+        break;
+    }
+
+    // Anything still queued for this texture is now out of date.
+    if (textureID != 0)
+      CancelStreamedTexture(streamer, textureID);
+
+    GLint oldWidth = 0, oldHeight = 0, oldFormat = 0;
+    if (textureID == 0) {
+      glGenTextures(1, &textureID);
+      BindTexture(textureID);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    } else {
+      BindTexture(textureID);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &oldWidth);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &oldHeight);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &oldFormat);
+    }
+
+    // Only the top level gets streamed, so stop sampling the others until
+    // they've been regenerated from it.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    // Reallocating would throw away the old contents, so only do it if the
+    // new image doesn't fit.
+    if (oldWidth != GLint(image->getWidth()) || oldHeight != GLint(image->getHeight()) ||
+        oldFormat != GLint(internalFormat)) {
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image->getWidth(), image->getHeight(),
+                   0, image->getType(), image->getDataType(), NULL);
+    }
+
+    StreamJob job;
+    job.image = image;
+    job.textureID = textureID;
+    job.rowBytes = image->getWidth() * image->getBytesPerPixel();
+    job.rowsPerSlice = (job.rowBytes > 0) ? kStagingBufferSize / job.rowBytes : 0;
+    if (job.rowsPerSlice == 0)
+      job.rowsPerSlice = 1;
+    job.nextRow = 0;
+    job.format = image->getType();
+    job.dataType = image->getDataType();
+    streamer->jobs.push_back(job);
+
+    return textureID;
+  }
+
+
+  void UpdateTextureStreamer(TextureStreamer* streamer)
+  {
+    assert(streamer != NULL);
+
+    unsigned int bytesUploaded = 0;
+    while (!streamer->jobs.empty() && bytesUploaded < kBytesPerFrame) {
+      StreamJob& job = streamer->jobs.front();
+      unsigned int rows = std::min(job.rowsPerSlice, job.image->getHeight() - job.nextRow);
+      if (!UploadSlice(streamer, job))
+        break;
+      bytesUploaded += rows * job.rowBytes;
+
+      if (job.nextRow >= job.image->getHeight()) {
+        FinishJob(job);
+        streamer->jobs.pop_front();
+      }
+    }
+
+    if (streamer->usePBOs)
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+
+  bool IsTextureStreaming(const TextureStreamer* streamer, unsigned int textureID)
+  {
+    assert(streamer != NULL);
+    for (std::list<StreamJob>::const_iterator job = streamer->jobs.begin(); job != streamer->jobs.end(); ++job) {
+      if (job->textureID == textureID)
+        return true;
+    }
+    return false;
+  }
+
+
+  void CancelStreamedTexture(TextureStreamer* streamer, unsigned int textureID)
+  {
+    assert(streamer != NULL);
+    for (std::list<StreamJob>::iterator job = streamer->jobs.begin(); job != streamer->jobs.end(); ) {
+      if (job->textureID == textureID) {
+        delete job->image;
+        job = streamer->jobs.erase(job);
+      } else {
+        ++job;
+      }
+    }
+  }
+
+
+  //
+  // Internal functions
+  //
+
+  // Uploads the next slice of job's image. Returns false, without uploading
+  // anything, if the next staging buffer is still in use by the GPU.
+  bool UploadSlice(TextureStreamer* streamer, StreamJob& job)
+  {
+    PROFILE_ZONE("UploadSlice");
+
+    unsigned int rows = std::min(job.rowsPerSlice, job.image->getHeight() - job.nextRow);
+    size_t numBytes = size_t(rows) * job.rowBytes;
+    const unsigned char* src = job.image->getPixels() + size_t(job.nextRow) * job.rowBytes;
+    const void* pixels = src;
+
+    if (streamer->usePBOs) {
+      StagingBuffer& buffer = streamer->buffers[streamer->nextBuffer];
+      if (buffer.fence) {
+        // Don't wait: if the GPU is still busy we'll try again next frame.
+        GLenum status = glClientWaitSync(buffer.fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+          return false;
+        glDeleteSync(buffer.fence);
+        buffer.fence = 0;
+      }
+
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.bufferID);
+      // Without fences we can't tell whether the GPU is done with the buffer,
+      // so orphan the old storage to keep mapping from waiting on it. With
+      // them we already know it's free, and the same storage can be reused.
+      if (!streamer->useFences)
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, kStagingBufferSize, NULL, GL_STREAM_DRAW);
+      void* dst = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+      if (dst == NULL) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      } else {
+        memcpy(dst, src, numBytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        pixels = NULL; // i.e. offset 0 into the bound buffer.
+      }
+      streamer->nextBuffer = (streamer->nextBuffer + 1) % kNumStagingBuffers;
+    }
+
+    BindTexture(job.textureID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, (job.rowBytes % 4 == 0) ? 4 : 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, job.nextRow, job.image->getWidth(), rows,
+                    job.format, job.dataType, pixels);
+
+    if (streamer->useFences && pixels == NULL) {
+      StagingBuffer& buffer = streamer->buffers[(streamer->nextBuffer + kNumStagingBuffers - 1) % kNumStagingBuffers];
+      buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    job.nextRow += rows;
+    return true;
+  }
+
+
+  void FinishJob(StreamJob& job)
+  {
+    BindTexture(job.textureID);
+    glGenerateMipmapEXT(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+    delete job.image;
+    job.image = NULL;
+  }
+
+} // namespace cat
+
@@ -0,0 +1,54 @@
+#ifndef cat_texturestream_h
+#define cat_texturestream_h
+
+namespace cat {
+
+  //
+  // Forward type declarations
+  //
+
+  class Image;
+  struct TextureStreamer; // Opaque; see texturestream.cpp for details.
+
+
+  //
+  // Functions
+  //
+
+  // Uploads textures a slice at a time, a few slices per frame, so loading
+  // big images while the game is running never stalls the render thread.
+  // Slices are staged through a small ring of pixel buffer objects; each one
+  // gets a fence, and a buffer is only refilled once its fence says the GPU
+  // has finished reading from it.
+  //
+  // All of these must be called on the thread which owns the GL context.
+
+  // Pass false for usePBOs if GL_ARB_pixel_buffer_object isn't available, in
+  // which case slices are copied straight from the image. Pass false for
+  // useFences if GL_ARB_sync isn't available, in which case we rely on the
+  // driver orphaning the buffers instead.
+  TextureStreamer* CreateTextureStreamer(bool usePBOs, bool useFences);
+  void DestroyTextureStreamer(TextureStreamer* streamer);
+
+  // Queues image for upload and takes ownership of it. If textureID is 0, a
+  // new texture is created; otherwise the pixels replace the contents of that
+  // texture, which keeps its old contents until the new ones arrive. Returns
+  // the texture's ID.
+  unsigned int StreamTexture(TextureStreamer* streamer, Image* image,
+                             unsigned int textureID = 0);
+
+  // Does this frame's share of the uploading. Call once per frame.
+  void UpdateTextureStreamer(TextureStreamer* streamer);
+
+  // True if textureID still has pixels waiting to be uploaded.
+  bool IsTextureStreaming(const TextureStreamer* streamer, unsigned int textureID);
+
+  // Throws away anything still waiting to be uploaded to textureID. Must be
+  // called before the texture is deleted, or the rest of its slices would go
+  // into whatever texture gets the ID next.
+  void CancelStreamedTexture(TextureStreamer* streamer, unsigned int textureID);
+
+} // namespace cat
+
+#endif // cat_texturestream_h
+
@@ -41,8 +41,8 @@ namespace cat {
   double Dot(const Vec2& a, const Vec2& b);
   Vec2 Reflect(const Vec2& in, const Vec2& normal);
 
-  double LengthSqr(const Vec2* in);
-  double Length(const Vec2* in);
+  double LengthSqr(const Vec2& in);
+  double Length(const Vec2& in);
   Vec2 Unit(const Vec2& in);
 
 
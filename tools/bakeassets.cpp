@@ -0,0 +1,46 @@
+// Bakes a set of images into an asset pack which the game can map straight
+// into memory and upload without any processing. See assetpack.h for the
+// format.
+//
+// Usage: bakeassets <output-pack> <image> [<image> ...]
+
+#include "assetpack.h"
+#include "image.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace cat;
+
+
+int main(int argc, char** argv)
+{
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s <output-pack> <image> [<image> ...]\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<const char*> names;
+  std::vector<Image*> images;
+  int status = 0;
+  for (int i = 2; i < argc; ++i) {
+    const char* name = strrchr(argv[i], '/');
+    name = (name != NULL) ? name + 1 : argv[i];
+    try {
+      images.push_back(new Image(argv[i]));
+      names.push_back(name);
+    } catch (ImageException& ex) {
+      fprintf(stderr, "%s: %s\n", argv[i], ex.what());
+      status = 1;
+    }
+  }
+
+  if (status == 0 && !WriteAssetPack(argv[1], &names[0], &images[0], images.size()))
+    status = 1;
+
+  for (unsigned int i = 0; i < images.size(); ++i)
+    delete images[i];
+  return status;
+}
+
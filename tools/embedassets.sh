@@ -0,0 +1,63 @@
+#!/bin/bash
+#
+# Generates a C++ source file which builds the given files into the
+# executable with .incbin, along with the table in src/embedded.h.
+
+if [ $# -lt 1 ]; then
+  echo "Usage: $0 <output-cpp> [<file> ...]"
+  exit 1
+fi
+
+output=$1
+shift
+
+{
+  echo "// Generated by $0. Do not edit."
+  echo
+  echo '#include "embedded.h"'
+  echo
+  echo '#include <cstddef>'
+  echo
+  echo '#if defined(__APPLE__)'
+  echo '#define CAT_EMBED_SECTION ".const_data"'
+  echo '#define CAT_EMBED_SYMBOL(name) "_" name'
+  echo '#else'
+  echo '#define CAT_EMBED_SECTION ".section .rodata"'
+  echo '#define CAT_EMBED_SYMBOL(name) name'
+  echo '#endif'
+  echo
+  echo '// The extra byte after each file means the end label never coincides'
+  echo '// with the start of the next one.'
+  echo '#define CAT_EMBED(name, path) \'
+  echo '  __asm__(CAT_EMBED_SECTION "\n" \'
+  echo '          ".balign 16\n" \'
+  echo '          CAT_EMBED_SYMBOL(#name) ":\n" \'
+  echo '          ".incbin \"" path "\"\n" \'
+  echo '          CAT_EMBED_SYMBOL(#name "_end") ":\n" \'
+  echo '          ".byte 0\n" \'
+  echo '          ".text\n")'
+  echo
+
+  i=0
+  for file in "$@"; do
+    echo "extern \"C\" const unsigned char cat_embedded_$i[];"
+    echo "extern \"C\" const unsigned char cat_embedded_${i}_end[];"
+    echo "CAT_EMBED(cat_embedded_$i, \"$file\");"
+    echo
+    i=$((i + 1))
+  done
+
+  echo 'namespace cat {'
+  echo
+  echo '  const EmbeddedFile kEmbeddedFiles[] = {'
+  i=0
+  for file in "$@"; do
+    echo "    { \"`basename $file`\", cat_embedded_$i, cat_embedded_${i}_end },"
+    i=$((i + 1))
+  done
+  echo '    { NULL, NULL, NULL }'
+  echo '  };'
+  echo "  const unsigned int kNumEmbeddedFiles = $i;"
+  echo
+  echo '} // namespace cat'
+} > $output
@@ -0,0 +1,157 @@
+// Times TGA decoding, mainly to see what the vector paths in image.cpp are
+// worth. The Makefile's bench target builds this twice, once against the
+// normal image.o and once against a copy with the SSE2 code compiled out,
+// and runs both.
+//
+// Usage: imagebench [<image.tga> ...]
+//
+// With no arguments it decodes a couple of large, synthetic RLE images
+// instead: one 32-bit and one 24-bit, each 4096 x 4096.
+
+#include "image.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sys/time.h>
+#include <vector>
+
+using namespace cat;
+
+
+//
+// Constants
+//
+
+static const int kSyntheticSize = 4096;
+
+// Each image gets decoded repeatedly until at least this much time has
+// passed, and then for at least kMinDecodes times.
+static const double kMinBenchTime = 2000.0;
+static const int kMinDecodes = 5;
+
+
+//
+// Forward declarations
+//
+
+double Now();
+void MakeRLETGA(std::vector<unsigned char>& tga, int width, int height, int bytesPerPixel);
+bool ReadFile(const char* path, std::vector<unsigned char>& data);
+void Bench(const char* label, const char* name, const std::vector<unsigned char>& data);
+
+
+//
+// Functions
+//
+
+int main(int argc, char** argv)
+{
+  const char* label = strrchr(argv[0], '/');
+  label = (label != NULL) ? label + 1 : argv[0];
+
+  std::vector<unsigned char> data;
+  if (argc < 2) {
+    MakeRLETGA(data, kSyntheticSize, kSyntheticSize, 4);
+    Bench(label, "synthetic-32.tga", data);
+    MakeRLETGA(data, kSyntheticSize, kSyntheticSize, 3);
+    Bench(label, "synthetic-24.tga", data);
+    return 0;
+  }
+
+  int status = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (ReadFile(argv[i], data))
+      Bench(label, argv[i], data);
+    else
+      status = 1;
+  }
+  return status;
+}
+
+
+double Now()
+{
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec * 1000.0 + t.tv_usec / 1000.0;
+}
+
+
+// Something like the game's sprites: mostly long runs of transparent or
+// flat colour, broken up by short stretches of literal pixels.
+void MakeRLETGA(std::vector<unsigned char>& tga, int width, int height, int bytesPerPixel)
+{
+  tga.assign(18, 0);
+  tga[2] = 10; // TrueColor, RLE compressed
+  tga[0xC] = width & 0xFF;
+  tga[0xD] = width >> 8;
+  tga[0xE] = height & 0xFF;
+  tga[0xF] = height >> 8;
+  tga[0x10] = bytesPerPixel * 8;
+
+  unsigned int seed = 1;
+  for (int y = 0; y < height; ++y) {
+    int x = 0;
+    while (x < width) {
+      seed = seed * 1103515245 + 12345;
+      bool isRun = ((seed >> 16) % 10) < 7;
+      int maxLength = isRun ? 128 : 16;
+      int length = 1 + int((seed >> 8) % maxLength);
+      if (length > width - x)
+        length = width - x;
+
+      tga.push_back((isRun ? 0x80 : 0x00) | (length - 1));
+      for (int i = 0; i < (isRun ? 1 : length); ++i) {
+        for (int c = 0; c < bytesPerPixel; ++c)
+          tga.push_back((unsigned char)(seed >> (c * 8)) + i);
+      }
+      x += length;
+    }
+  }
+}
+
+
+bool ReadFile(const char* path, std::vector<unsigned char>& data)
+{
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Unable to open %s\n", path);
+    return false;
+  }
+
+  data.clear();
+  unsigned char buffer[65536];
+  size_t len;
+  while ((len = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    data.insert(data.end(), buffer, buffer + len);
+  fclose(f);
+  return true;
+}
+
+
+void Bench(const char* label, const char* name, const std::vector<unsigned char>& data)
+{
+  double elapsed = 0;
+  int decodes = 0;
+  unsigned int width = 0, height = 0, bytesPerPixel = 0;
+  try {
+    double start = Now();
+    while (elapsed < kMinBenchTime || decodes < kMinDecodes) {
+      Image image(name, &data[0], data.size());
+      width = image.getWidth();
+      height = image.getHeight();
+      bytesPerPixel = image.getBytesPerPixel();
+      ++decodes;
+      elapsed = Now() - start;
+    }
+  } catch (ImageException& ex) {
+    fprintf(stderr, "%s: %s\n", name, ex.what());
+    return;
+  }
+
+  double perDecode = elapsed / decodes;
+  double megabytes = double(width) * height * bytesPerPixel / (1024.0 * 1024.0);
+  printf("%-18s %-24s %5ux%-5u %u bpp  %8.2lf ms  %8.1lf MB/s\n", label, name,
+         width, height, bytesPerPixel * 8, perDecode, megabytes / (perDecode / 1000.0));
+}
+